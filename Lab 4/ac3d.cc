@@ -0,0 +1,240 @@
+/** \file ac3d.cc
+    \brief Implements the parser of AC3D files, ported from the OpenGL
+    labs.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "ac3d.h"
+
+AC3DObject::AC3DObject() { nChildren=0; children=NULL; vertices=NULL; surfaces=NULL; }
+AC3DObject::~AC3DObject() {
+  int i;
+  for(i=0;i<nChildren;i++) delete children[i];
+  delete [] children;
+  delete [] vertices;
+  delete [] surfaces;
+}
+void AC3DObject::finalize() {}
+AC3DObjectFactory::AC3DObjectFactory() :nMaterials(0), allocatedMaterials(0), materials(NULL), currentDepth(0) {}
+AC3DObjectFactory::~AC3DObjectFactory() {
+  delete [] materials;
+}
+AC3DObject *AC3DObjectFactory::makeObject() { return new AC3DObject(); }
+int AC3DObjectFactory::getMaterialCount() { return nMaterials; }
+AC3DMaterial *AC3DObjectFactory::getMaterial(int index) { return &materials[index]; }
+AC3DObject *AC3DObjectFactory::loadAC3D(const char *filename) {
+  FILE *fp;
+  char str[256];
+  fp = fopen(filename,"rb");
+  if(!fp) {
+    fprintf(stderr,"Error - could not open '%s'\n",filename);
+    return NULL;
+  }
+  /* Could not read header, or invalid header */
+  if(fread(str,1,5,fp) != 5 || strncmp(str,"AC3D",4) != 0) {
+    fprintf(stderr,"Error - '%s' is not an AC3D file\n",filename);
+    fclose(fp);
+    return NULL;
+  }
+  /* Flush to first line after header */
+  while(fgetc(fp) != '\n') { if(feof(fp)) { fclose(fp); return NULL; } }
+
+  /* Reset all materials */
+  delete [] materials;
+  materials=NULL;
+  nMaterials=0;
+  allocatedMaterials=0;
+  currentDepth=0;
+
+  AC3DObject *root = parseObject(fp);
+  fclose(fp);
+  return root;
+}
+AC3DObject *AC3DObjectFactory::parseObject(FILE *fp) {
+  char str[256];
+  int i;
+
+  while(1) {
+    str[0]=0;
+    if(fscanf(fp,"%32s",str) != 1) {
+      fprintf(stderr,"Parse error in AC3D file, no object found\n");
+      return NULL;
+    }
+    /* Scan past any material definitions until the next object is found */
+    if(strncmp(str,"OBJECT",32) == 0) break;
+    else if(strncmp(str,"MATERIAL",32) == 0) {
+      /* make sure we have enough memory to store this material objects */
+      if(allocatedMaterials < nMaterials+1) {
+	allocatedMaterials = allocatedMaterials ? 2*allocatedMaterials : 32;
+	AC3DMaterial *newMat = new AC3DMaterial[allocatedMaterials];
+	if(nMaterials) memcpy((void*) newMat, materials, sizeof(AC3DMaterial)*nMaterials);
+	delete [] materials;
+	materials=newMat;
+      }
+      AC3DMaterial *material = &materials[nMaterials];
+      /* Read name of material */
+      if(fscanf(fp,"%31s",material->name) != 1 ||
+	 fscanf(fp," rgb %f %f %f",&material->rgb[0],&material->rgb[1],&material->rgb[2]) != 3 ||
+	 fscanf(fp," amb %f %f %f",&material->amb[0],&material->amb[1],&material->amb[2]) != 3 ||
+	 fscanf(fp," emis %f %f %f",&material->emis[0],&material->emis[1],&material->emis[2]) != 3 ||
+	 fscanf(fp," spec %f %f %f",&material->spec[0],&material->spec[1],&material->spec[2]) != 3 ||
+	 fscanf(fp," shi %d",&i) != 1) {
+	fprintf(stderr,"Parse error in AC3D file, material\n");
+	return NULL;
+      }
+      material->shi = (float) i;
+      if(fscanf(fp," trans %f",&material->trans) != 1) {
+	fprintf(stderr,"Parse error in AC3D file, material\n");
+	return NULL;
+      }
+      nMaterials++;
+    } else {
+      fprintf(stderr,"Parse error in AC3D file (unknown top-level tag %s)\n",str);
+      return NULL;
+    }
+  }
+
+  AC3DObject *object = makeObject();
+  /* Default values for rotation/translation matrix */
+  object->mat.setIdentity();
+  object->url[0]=0;
+  object->name[0]=0;
+  object->type[0]=0;
+  object->textureName[0]=0;
+  object->textureRepeat[0]=1.0;
+  object->textureRepeat[1]=1.0;
+  object->nVertices=0;
+  object->nSurfaces=0;
+  object->nTriangles=0;
+  object->nQuads=0;
+
+  /* Definition of this object found - parse type */
+  if(fscanf(fp,"%31s",object->type) != 1) {
+    fprintf(stderr,"Parse error in AC3D file, could not read type\n");
+    delete object;
+    return NULL;
+  }
+  /* Parse each of the contents, stop after finding the kids */
+  while(1) {
+    if(fscanf(fp,"%32s",str) != 1) {
+      fprintf(stderr,"Parse error in AC3D file, EOF before end of object\n");
+      delete object;
+      return NULL;
+    }
+    else if(strncmp(str,"name",32) == 0) {
+      if(fscanf(fp,"%127s",object->name) != 1) object->name[0]=0;
+    }
+    else if(strncmp(str,"data",32) == 0) {
+      /* Skip the data section of the object. The standard does not say anything about what it contains */
+      if(fscanf(fp,"%d",&i) != 1)  { printf("Parse error in AC3D file, could not skip data tag\n"); delete object; return NULL; }
+      while(fgetc(fp) != '\n') if(feof(fp)) { printf("Parse error in AC3D file, error skipping data tag\n"); delete object; return NULL; }
+      for(;i>0;i--) { fgetc(fp); if(feof(fp)) { printf("Parse error in AC3D file, error skipping data tag\n"); delete object; return NULL; }}
+    }
+    else if(strncmp(str,"texture",32) == 0) {
+      if(fscanf(fp,"%127s",object->textureName) != 1) object->textureName[0]=0;
+    }
+    else if(strncmp(str,"texrep",32) == 0) {
+      if(fscanf(fp,"%f %f",&object->textureRepeat[0], &object->textureRepeat[1]) != 2)  { printf("Parse error in AC3D file, texture repeat\n"); delete object; return NULL; }
+    }
+    else if(strncmp(str,"rot",32) == 0) {
+      /* The nine numbers are given column by column, as read by the
+	 OpenGL labs into a glm::mat4 */
+      double rot[9];
+      if(fscanf(fp,"%lf %lf %lf %lf %lf %lf %lf %lf %lf",
+		&rot[0],&rot[1],&rot[2],&rot[3],&rot[4],&rot[5],&rot[6],&rot[7],&rot[8]) != 9) {
+	printf("Parse error in AC3D file, rotation matrix\n"); delete object; return NULL;
+      }
+      int row, column;
+      for(column=0;column<3;column++)
+	for(row=0;row<3;row++) object->mat.m[row][column] = rot[3*column+row];
+    }
+    else if(strncmp(str,"loc",32) == 0) {
+      if(fscanf(fp,"%lf %lf %lf",&object->mat.m[0][3],&object->mat.m[1][3],&object->mat.m[2][3]) != 3) {
+	printf("Parse error in AC3D file, location matrix\n"); delete object; return NULL;
+      }
+    }
+    else if(strncmp(str,"url",32) == 0) {
+      if(fscanf(fp,"%127s",object->url) != 1) object->url[0]=0;
+    }
+    else if(strncmp(str,"numvert",32) == 0) {
+      if(fscanf(fp,"%d",&i) != 1 || i < 0) { printf("Parse error in AC3D file, numvertices\n"); delete object; return NULL; }
+      object->nVertices=i;
+      object->vertices=new float[object->nVertices*3];
+      for(i=0;i<object->nVertices;i++) {
+	if(fscanf(fp," %f %f %f",object->vertices+i*3+0,object->vertices+i*3+1,object->vertices+i*3+2) != 3) {
+	  printf("Parse error in AC3D file,numvertices (2)\n"); delete object; return NULL;
+	}
+      }
+    }
+    else if(strncmp(str,"numsurf",32) == 0) {
+      if(fscanf(fp," %d",&i) != 1 || i < 0) { printf("Parse error in AC3D file, numsurf\n"); delete object; return NULL; }
+      object->nSurfaces=i;
+      object->surfaces = new AC3DSurface[object->nSurfaces];
+      for(int surf=0;surf<object->nSurfaces;surf++) {
+	AC3DSurface *surface=&object->surfaces[surf];
+	if(fscanf(fp," %32s",str) != 1 || strncmp(str,"SURF",32) != 0) {
+	  printf("Parse error in AC3D file, expected another surface (got %s)\n",str); delete object; return NULL;
+	}
+	if(fscanf(fp," %x",&i) != 1) { printf("Parse error in AC3D file, expected surface type\n"); delete object; return NULL; }
+	surface->flags=i;
+	if(fscanf(fp," mat %d",&i) != 1) { printf("Parse error in AC3D file, expected mat\n"); delete object; return NULL; }
+	surface->material=i;
+	if(fscanf(fp," refs %d",&i) != 1) { printf("Parse error in AC3D file, expected refs\n"); delete object; return NULL; }
+	surface->nVertices=i;
+	if(surface->nVertices == 3) object->nTriangles++;
+	else if(surface->nVertices == 4) object->nQuads++;
+	if(surface->nVertices < 0 || surface->nVertices > AC3D_MAX_SURFACE_VERTICES) {
+	  printf("Too many vertices (%d) in surface inside AC3D file (max %d supported)\n",surface->nVertices,AC3D_MAX_SURFACE_VERTICES);
+	  delete object; return NULL;
+	}
+	for(i=0;i<surface->nVertices;i++) {
+	  if(fscanf(fp," %d %f %f",&surface->vert[i].index,&surface->vert[i].uv[0],&surface->vert[i].uv[1]) != 3) {
+	    printf("Parse error in AC3D file, could not read vertice\n"); delete object; return NULL;
+	  }
+	  if(surface->vert[i].index < 0 || surface->vert[i].index >= object->nVertices) {
+	    printf("Parse error in AC3D file, vertice %d out of range\n",surface->vert[i].index); delete object; return NULL;
+	  }
+	}
+      }
+    }
+    else if(strncmp(str,"kids",32) == 0) {
+      if(fscanf(fp,"%d",&i) != 1 || i < 0) { printf("Parse error in AC3D file, no kids\n"); delete object; return NULL; }
+      object->nChildren=i;
+      break;
+    }
+    else {
+      /* Tags that do not matter here, eg. crease, take the rest of the line */
+      int c;
+      do c = fgetc(fp); while(c != '\n' && c != EOF);
+    }
+  }
+  currentDepth++;
+  /* Parse any children */
+  if(object->nChildren) {
+    object->children = new AC3DObject*[object->nChildren];
+    for(i=0;i<object->nChildren;i++) object->children[i]=NULL;
+    for(i=0;i<object->nChildren;i++) {
+      object->children[i] = parseObject(fp);
+      if(!object->children[i]) { delete object; return NULL; }
+    }
+  }
+  object->finalize();
+  currentDepth--;
+  return object;
+}
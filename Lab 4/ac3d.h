@@ -0,0 +1,120 @@
+/** \file ac3d.h
+    \brief Declares the AC3DObjectFactory, which parses models from
+    AC3D files, and the classes holding the parsed models.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	AC3D_H_
+# define   	AC3D_H_
+
+#include <stdio.h>
+#include "vecmath.h"
+
+/** Largest number of vertices of a surface. Quads are the most
+    common polygons, but some exporters write larger ones. */
+#define AC3D_MAX_SURFACE_VERTICES 16
+
+/** Surface flags. The low four bits give the type of the surface, only
+    polygons have an area, the others are lines. */
+#define AC3D_SURFACE_TYPE 0xf
+#define AC3D_SURFACE_POLYGON 0x0
+#define AC3D_SURFACE_SHADED 0x10
+#define AC3D_SURFACE_TWOSIDED 0x20
+
+class AC3DMaterial {
+ public:
+  char name[32];
+  float rgb[3];
+  float amb[3];
+  float emis[3];
+  float spec[3];
+  float shi, trans;
+};
+class AC3DSurface {
+ public:
+  int material;
+  int flags;
+  int nVertices;
+  class Vertice {
+  public:
+    int index;
+    float uv[2];
+  };
+  Vertice vert[AC3D_MAX_SURFACE_VERTICES];
+};
+
+/** \brief An object of an AC3D file, and its children.
+
+    The same classes as used by the OpenGL labs, without the OpenGL
+    types. The vertices are given in the coordinate system of the
+    object, which mat brings into that of the parent. */
+class AC3DObject {
+ public:
+  AC3DObject();
+  /** Deletes the children, vertices and surfaces */
+  virtual ~AC3DObject();
+  virtual void finalize();
+
+  /** From the coordinate system of the object to that of the parent,
+      given by the rot and loc tags */
+  Mat4<double> mat;
+  char type[32], name[128], textureName[128], url[128];
+  float textureRepeat[2];
+  int nChildren;
+  class AC3DObject **children;
+
+  int nVertices, nSurfaces, nQuads, nTriangles;
+  /** Pointer to buffer of nVertices*3 floats */
+  float *vertices;
+  AC3DSurface *surfaces;
+};
+
+class AC3DObjectFactory {
+ public:
+  AC3DObjectFactory();
+  virtual ~AC3DObjectFactory();
+
+  /** Constructs the next object to be populated with data. If you
+      want to implement a new form of objects to be parsed and created
+      from AC3D files you should inherit from the AC3DObject class and
+      from the AC3DObjectFactory -- letting this function create
+      instances of your new object class. */
+  virtual AC3DObject *makeObject();
+
+  /** Attempts to open and parse the given ac3d file. Returns a
+      reference to the first object in the file if successfull, which
+      the caller must delete.
+      Returns NULL on any error. */
+  AC3DObject *loadAC3D(const char *filename);
+
+  /** The materials of the last file loaded, which the surfaces refer
+      to by their index. They are kept until the next file is
+      loaded. */
+  int getMaterialCount();
+  AC3DMaterial *getMaterial(int index);
+ private:
+  /** Parses a new object from file and populates a correpondigly created object (using self as factory). */
+  AC3DObject *parseObject(FILE *fp);
+
+  int nMaterials,  allocatedMaterials;
+  AC3DMaterial *materials;
+
+  int currentDepth;
+};
+
+#endif 	    /* !AC3D_H_ */
@@ -0,0 +1,715 @@
+/** \file benchmark.cc
+    \brief Measures how line tests scale with the number of objects in
+    the scene, with and without the bounding volume hierarchy, how much
+    faster coherent rays are when traced as packets, what CSG
+    objects cost compared to plain primitives, how fast the noise
+    functions used by the materials are, how well the light tree
+    picks lights, how much the hierarchy of a triangle mesh saves
+    over testing all of its triangles, how fast scene files load
+    with and without their cache, how fast the camera makes the
+    primary rays and how fast the frame buffer is resolved to the
+    screen.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "general.h"
+#include "bvh.h"
+#include "sphere.h"
+#include "plane.h"
+#include "transform.h"
+#include "csg.h"
+#include "noise.h"
+#include "lighttree.h"
+#include "trianglemesh.h"
+#include "scene.h"
+#include "raytracer.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include <map>
+#include <omp.h>
+
+using namespace std;
+
+/* Globals normally given by main.cc */
+int screenWidth=320, screenHeight=240;
+int debugThisPixel=0, debugIndentation=0;
+void printDebugIndentation() {}
+
+#define N_RAYS 20000
+/* Resolution used when measuring primary rays */
+#define PRIMARY_SIZE 512
+
+static double randomValue(double low,double high) { return low + (high-low)*rand()/(double)RAND_MAX; }
+
+/* Closest hit by testing every object, as done by the raytracer
+   before the hierarchy was added. */
+static double linearLineTest(set<Object*> *objects,double origin[3],double direction[3],Object **hitObject) {
+  double closestDistance=MAX_DISTANCE, distance;
+  set<Object*>::iterator objIterator;
+  *hitObject=NULL;
+  for(objIterator=objects->begin();objIterator != objects->end();objIterator++) {
+    distance = (*objIterator)->lineTest(origin,direction,closestDistance,NULL);
+    if(distance < closestDistance && distance > 1e-5) {
+      closestDistance = distance;
+      *hitObject = *objIterator;
+    }
+  }
+  return closestDistance;
+}
+static bool linearShadowTest(set<Object*> *objects,double origin[3],double direction[3],double maxDistance) {
+  set<Object*>::iterator objIterator;
+  for(objIterator=objects->begin();objIterator != objects->end();objIterator++)
+    if((*objIterator)->lineTest(origin,direction,maxDistance,NULL) < maxDistance) return true;
+  return false;
+}
+
+/* Creates a scene with a floor and nObjects spheres at a constant
+   density, so that rays see roughly the same amount of objects
+   regardless of scene size. */
+static void createScene(set<Object*> *objects,int nObjects) {
+  int i;
+  double size = 2.0*pow((double)nObjects,1.0/3.0);
+  double floorNormal[3] = { 0.0, 1.0, 0.0 };
+  objects->insert(new Plane(floorNormal,-size));
+  for(i=0;i<nObjects;i++) {
+    Transform *transform = new Transform(new Sphere(randomValue(0.1,0.4)));
+    transform->translate(randomValue(-size,size),randomValue(-size,size),randomValue(-size,size));
+    objects->insert(transform);
+  }
+}
+
+/* Compares tracing coherent primary rays one by one against tracing
+   them as packets of RAY_PACKET_SIZE neighbouring pixels. */
+static void primaryRayBenchmark() {
+  int sizes[] = { 10, 100, 1000, 5000 };
+  int nSizes = sizeof(sizes)/sizeof(sizes[0]);
+  int s, i, j, x, y;
+
+  printf("\nPrimary rays at %dx%d, packets of %d rays\n",PRIMARY_SIZE,PRIMARY_SIZE,RAY_PACKET_SIZE);
+  printf("%8s %12s %12s %9s %8s\n","objects","single ms","packet ms","speedup","errors");
+  for(s=0;s<nSizes;s++) {
+    int nObjects = sizes[s];
+    set<Object*> objects;
+    createScene(&objects,nObjects);
+    double size = 2.0*pow((double)nObjects,1.0/3.0);
+    BVH bvh;
+    bvh.build(&objects);
+
+    /* A pinhole camera looking at the scene from the outside */
+    double origin[3] = { 0.0, 0.0, -3.0*size };
+    double (*directions)[3] = new double[PRIMARY_SIZE*PRIMARY_SIZE][3];
+    for(y=0;y<PRIMARY_SIZE;y++)
+      for(x=0;x<PRIMARY_SIZE;x++) {
+	double *d = directions[y*PRIMARY_SIZE+x];
+	d[0] = (x+0.5)/PRIMARY_SIZE-0.5;
+	d[1] = 0.5-(y+0.5)/PRIMARY_SIZE;
+	d[2] = 1.0;
+	normalize(d);
+      }
+
+    double *singleDistance = new double[PRIMARY_SIZE*PRIMARY_SIZE];
+    Object **singleObject = new Object*[PRIMARY_SIZE*PRIMARY_SIZE];
+    double t0 = omp_get_wtime();
+    for(i=0;i<PRIMARY_SIZE*PRIMARY_SIZE;i++)
+      singleDistance[i] = bvh.lineTest(origin,directions[i],MAX_DISTANCE,&singleObject[i],NULL);
+    double singleTime = omp_get_wtime()-t0;
+
+    /* Packets are made from horizontal runs of pixels */
+    int errors=0;
+    t0 = omp_get_wtime();
+    for(i=0;i<PRIMARY_SIZE*PRIMARY_SIZE;i+=RAY_PACKET_SIZE) {
+      RayPacket packet;
+      double distance[RAY_PACKET_SIZE];
+      Object *hitObject[RAY_PACKET_SIZE];
+      for(j=0;j<RAY_PACKET_SIZE;j++) {
+	for(int k=0;k<3;k++) {
+	  packet.origin[k][j] = origin[k];
+	  packet.direction[k][j] = directions[i+j][k];
+	}
+	packet.active[j] = 1;
+      }
+      bvh.lineTestPacket(&packet,MAX_DISTANCE,distance,hitObject,NULL);
+      for(j=0;j<RAY_PACKET_SIZE;j++)
+	if(hitObject[j] != singleObject[i+j] || fabs(distance[j]-singleDistance[i+j]) > 1e-9) errors++;
+    }
+    double packetTime = omp_get_wtime()-t0;
+
+    printf("%8d %12.2f %12.2f %8.1fx %8d\n",nObjects,1e3*singleTime,1e3*packetTime,
+	   singleTime/packetTime,errors);
+    delete [] directions;
+    delete [] singleDistance;
+    delete [] singleObject;
+  }
+}
+
+/* Creates an object of the given kind (0 for a plain sphere, 1
+   intersection, 2 union, 3 difference), made from two overlapping
+   spheres for the CSG objects */
+static Object *createCSGObject(int kind) {
+  if(kind == 0) return new Sphere(0.5);
+  CSG *csg;
+  if(kind == 1) csg = new Intersection();
+  else if(kind == 2) csg = new Union();
+  else csg = new Difference();
+  Transform *offset = new Transform(new Sphere(0.5));
+  offset->translate(0.5,0.0,0.0);
+  csg->addObject(new Sphere(0.5));
+  csg->addObject(offset);
+  return csg;
+}
+
+/* Compares line tests and shadow tests of CSG objects with those of a
+   plain sphere, using rays aimed at the object so that most of them
+   hit it */
+static void csgBenchmark() {
+  const char *names[] = { "sphere", "intersection", "union", "difference" };
+  int kind, i, j, repeat;
+  double baseTime=0.0;
+  static double origins[N_RAYS][3], directions[N_RAYS][3];
+
+  for(i=0;i<N_RAYS;i++) {
+    double target[3];
+    for(j=0;j<3;j++) {
+      origins[i][j] = randomValue(-1.0,1.0);
+      target[j] = randomValue(-0.5,0.5);
+    }
+    normalize(origins[i]);
+    for(j=0;j<3;j++) {
+      origins[i][j] *= 3.0;
+      directions[i][j] = target[j]-origins[i][j];
+    }
+    normalize(directions[i]);
+  }
+  printf("\nCSG objects made of two spheres, %d rays aimed at the object\n",10*N_RAYS);
+  printf("%14s %12s %12s %12s %10s\n","object","lineTest ms","shadow ms","vs sphere","hits");
+  for(kind=0;kind<4;kind++) {
+    Transform *object = new Transform(createCSGObject(kind));
+    object->translate(0.1,0.2,0.3);
+    object->prepare();
+    HitRecord hit;
+    int hits=0;
+    double t0 = omp_get_wtime();
+    for(repeat=0;repeat<10;repeat++)
+      for(i=0;i<N_RAYS;i++)
+	hits += object->lineTest(origins[i],directions[i],MAX_DISTANCE,&hit) < MAX_DISTANCE;
+    double lineTime = omp_get_wtime()-t0;
+    t0 = omp_get_wtime();
+    for(repeat=0;repeat<10;repeat++)
+      for(i=0;i<N_RAYS;i++) object->occluded(origins[i],directions[i],10.0);
+    double shadowTime = omp_get_wtime()-t0;
+    if(kind == 0) baseTime = lineTime+shadowTime;
+    printf("%14s %12.2f %12.2f %11.1fx %10d\n",names[kind],1e3*lineTime,1e3*shadowTime,
+	   (lineTime+shadowTime)/baseTime,hits);
+  }
+}
+
+/* Compares evaluating six octaves of noise one point and one octave
+   at a time, as the materials used to do, with the batch versions */
+static void noiseBenchmark() {
+  const int n = 200000;
+  int i, octave;
+  double *x = new double[n], *y = new double[n], *z = new double[n];
+  double *scalar = new double[n], *batch = new double[n];
+  double maxError = 0.0, checksum = 0.0;
+
+  initNoise();
+  for(i=0;i<n;i++) {
+    x[i] = randomValue(-10.0,10.0);
+    y[i] = randomValue(-10.0,10.0);
+    z[i] = randomValue(-10.0,10.0);
+  }
+  printf("\nSix octaves of noise for %d points\n",n);
+  printf("%24s %10s\n","method","ms");
+
+  double t0 = omp_get_wtime();
+  for(i=0;i<n;i++) {
+    double scale=1.0, amplitude=1.0;
+    scalar[i]=0.0;
+    for(octave=0;octave<6;octave++) {
+      scalar[i] += amplitude*noise(x[i]*scale,y[i]*scale,z[i]*scale);
+      scale *= 2.0;
+      amplitude *= 0.5;
+    }
+  }
+  printf("%24s %10.2f\n","noise, one at a time",1e3*(omp_get_wtime()-t0));
+
+  t0 = omp_get_wtime();
+  for(i=0;i<n;i++) batch[i] = fbm(x[i],y[i],z[i],6);
+  printf("%24s %10.2f\n","fbm, one point",1e3*(omp_get_wtime()-t0));
+  for(i=0;i<n;i++) maxError = MAX(maxError,fabs(batch[i]-scalar[i]));
+
+  t0 = omp_get_wtime();
+  fbm(n,x,y,z,6,batch);
+  printf("%24s %10.2f\n","fbm, all points",1e3*(omp_get_wtime()-t0));
+  for(i=0;i<n;i++) maxError = MAX(maxError,fabs(batch[i]-scalar[i]));
+
+  t0 = omp_get_wtime();
+  for(i=0;i<n;i++) checksum += gradientFbm(x[i],y[i],z[i],6);
+  printf("%24s %10.2f\n","gradientFbm, one point",1e3*(omp_get_wtime()-t0));
+  printf("Largest difference between fbm and noise: %g\n",maxError);
+
+  delete [] x; delete [] y; delete [] z;
+  delete [] scalar; delete [] batch;
+}
+
+/* Unshadowed diffuse light from the light at the point on the floor,
+   which has the normal 0,1,0 */
+static double floorLight(Light *light,double colour[3],double point[3]) {
+  double min[3], max[3], L[3];
+  int i;
+  light->getBounds(min,max);
+  for(i=0;i<3;i++) L[i] = 0.5*(min[i]+max[i]) - point[i];
+  double distance = length(L);
+  if(L[1] <= 0.0) return 0.0;
+  return (colour[0]+colour[1]+colour[2])/3.0 * L[1]/distance;
+}
+
+/* Compares summing the light of every light with the cuts and the
+   random samples of the light tree, for points on a floor below many
+   lights that fade with the given falloff distance, or not at all if
+   it is 0 */
+static void lightBenchmark(double falloff) {
+  const int nPoints = 20000;
+  int counts[] = { 10, 200, 2000 };
+  int c, i, j, k;
+  static double points[nPoints][3];
+  double normal[3] = { 0.0, 1.0, 0.0 };
+
+  if(falloff > 0.0) printf("\nUnshadowed light of many lights with a falloff of %g at %d points\n",falloff,nPoints);
+  else printf("\nUnshadowed light of many lights without a falloff at %d points\n",nPoints);
+  printf("%8s %10s %10s %10s %12s %12s %12s\n","lights","all ms","cut ms","per point",
+	 "mean error","max error","sampled/all");
+  for(c=0;c<(int)(sizeof(counts)/sizeof(counts[0]));c++) {
+    int nLights = counts[c];
+    set<Light*> lights;
+    vector<Light*> lightList;
+    /* The colours are not readable from the lights */
+    vector<Vec3<double> > colourList;
+    map<Light*,Vec3<double> > colours;
+    for(i=0;i<nLights;i++) {
+      double position[3] = { randomValue(-10.0,10.0), randomValue(0.5,3.0), randomValue(-10.0,10.0) };
+      double colour[3] = { randomValue(0.2,1.0), randomValue(0.2,1.0), randomValue(0.2,1.0) };
+      Light *light = new Light(position,colour);
+      light->setFalloff(falloff);
+      lights.insert(light);
+      lightList.push_back(light);
+      colourList.push_back(Vec3<double>(colour));
+      colours[light] = Vec3<double>(colour);
+    }
+    for(i=0;i<nPoints;i++) {
+      points[i][0] = randomValue(-10.0,10.0);
+      points[i][1] = 0.0;
+      points[i][2] = randomValue(-10.0,10.0);
+    }
+    LightTree tree;
+    tree.build(&lights);
+
+    double *all = new double[nPoints];
+    double t0 = omp_get_wtime();
+    for(i=0;i<nPoints;i++) {
+      all[i] = 0.0;
+      for(j=0;j<nLights;j++) {
+	double min[3], max[3], L[3], colour[3];
+	lightList[j]->getBounds(min,max);
+	for(k=0;k<3;k++) L[k] = 0.5*(min[k]+max[k]) - points[i][k];
+	double attenuation = lightList[j]->getAttenuation(length(L));
+	for(k=0;k<3;k++) colour[k] = colourList[j][k]*attenuation;
+	all[i] += floorLight(lightList[j],colour,points[i]);
+      }
+    }
+    double allTime = omp_get_wtime()-t0;
+
+    LightChoice choices[MAX_LIGHT_CUT];
+    long nChoices = 0;
+    double meanError = 0.0, maxError = 0.0;
+    t0 = omp_get_wtime();
+    for(i=0;i<nPoints;i++) {
+      int n = tree.selectLights(points[i],normal,choices);
+      double cut = 0.0;
+      for(j=0;j<n;j++) cut += floorLight(choices[j].light,choices[j].colour,points[i]);
+      nChoices += n;
+      double error = all[i] > 0.0 ? fabs(cut-all[i])/all[i] : 0.0;
+      meanError += error/nPoints;
+      maxError = MAX(maxError,error);
+    }
+    double cutTime = omp_get_wtime()-t0;
+
+    /* One light picked at random per point, divided by its
+       probability, should on average give all the light */
+    double sampled = 0.0, total = 0.0;
+    for(i=0;i<nPoints;i++) {
+      double probability, colour[3], L[3], min[3], max[3];
+      Light *light = tree.sampleLight(points[i],normal,rand()/(RAND_MAX+1.0),&probability);
+      total += all[i];
+      if(!light) continue;
+      light->getBounds(min,max);
+      for(k=0;k<3;k++) L[k] = 0.5*(min[k]+max[k]) - points[i][k];
+      double attenuation = light->getAttenuation(length(L));
+      for(k=0;k<3;k++) colour[k] = colours[light][k]*attenuation/probability;
+      sampled += floorLight(light,colour,points[i]);
+    }
+
+    printf("%8d %10.2f %10.2f %10.1f %11.2f%% %11.2f%% %12.3f\n",nLights,1e3*allTime,1e3*cutTime,
+	   nChoices/(double)nPoints,100.0*meanError,100.0*maxError,sampled/total);
+    delete [] all;
+    for(i=0;i<nLights;i++) lightList[i]->dereference();
+  }
+}
+
+/* Moller-Trumbore test of one triangle, written out separately from
+   the one in TriangleMesh so the two can be compared */
+static double triangleTest(double a[3],double b[3],double c[3],double origin[3],double direction[3]) {
+  Vec3<double> A(a), E1 = Vec3<double>(b)-A, E2 = Vec3<double>(c)-A, D(direction);
+  Vec3<double> P = D.cross(E2);
+  double det = E1.dot(P);
+  if(det == 0.0) return MAX_DISTANCE;
+  Vec3<double> S = Vec3<double>(origin)-A;
+  double u = S.dot(P)/det;
+  if(u < 0.0 || u > 1.0) return MAX_DISTANCE;
+  Vec3<double> Q = S.cross(E1);
+  double v = D.dot(Q)/det;
+  if(v < 0.0 || u+v > 1.0) return MAX_DISTANCE;
+  double t = E2.dot(Q)/det;
+  return t > 1e-5 ? t : MAX_DISTANCE;
+}
+
+/* Shoots rays from a sphere around the models of the OpenGL labs
+   towards random points inside their bounds, and compares the
+   hierarchy of the TriangleMesh with testing every triangle. */
+static void meshBenchmark() {
+  const char *files[] = { "../Lab 3/fighter.ac", "../Lab 3/fighter-hires.ac" };
+  const int nRays = 20000, nLinear = 1000;
+  int f, i, j;
+
+  printf("\nRays towards triangle meshes\n");
+  printf("%10s %8s %10s %12s %12s %10s %8s %8s\n","triangles","nodes","build ms","linear ms","mesh ms","speedup","hits","errors");
+  for(f=0;f<(int)(sizeof(files)/sizeof(files[0]));f++) {
+    TriangleMesh *mesh = TriangleMesh::loadAC3D(files[f]);
+    if(!mesh) continue;
+    double t0 = omp_get_wtime();
+    mesh->prepare();
+    double buildTime = omp_get_wtime()-t0;
+
+    double min[3], max[3];
+    for(i=0;i<3;i++) { min[i] = -MAX_DISTANCE; max[i] = MAX_DISTANCE; }
+    mesh->getBounds(min,max);
+    Vec3<double> center = (Vec3<double>(min)+Vec3<double>(max))*0.5;
+    double radius = (Vec3<double>(max)-Vec3<double>(min)).length();
+
+    vector<Vec3<double> > origins, directions;
+    srand(1);
+    for(i=0;i<nRays;i++) {
+      Vec3<double> origin(randomValue(-1.0,1.0),randomValue(-1.0,1.0),randomValue(-1.0,1.0));
+      origin = center + origin*(radius/origin.length());
+      Vec3<double> target(randomValue(min[0],max[0]),randomValue(min[1],max[1]),randomValue(min[2],max[2]));
+      Vec3<double> direction = target-origin;
+      origins.push_back(origin);
+      directions.push_back(direction/direction.length());
+    }
+
+    int nTriangles = mesh->getTriangleCount();
+    vector<double> linearDistances(nLinear);
+    t0 = omp_get_wtime();
+    for(i=0;i<nLinear;i++) {
+      double closest = MAX_DISTANCE, a[3], b[3], c[3];
+      for(j=0;j<nTriangles;j++) {
+	mesh->getTriangle(j,a,b,c);
+	closest = MIN(closest,triangleTest(a,b,c,origins[i].v,directions[i].v));
+      }
+      linearDistances[i] = closest;
+    }
+    double linearTime = (omp_get_wtime()-t0)*nRays/nLinear;
+
+    int hits = 0, errors = 0;
+    HitRecord hit;
+    t0 = omp_get_wtime();
+    for(i=0;i<nRays;i++)
+      if(mesh->lineTest(origins[i].v,directions[i].v,MAX_DISTANCE,&hit) < MAX_DISTANCE) hits++;
+    double meshTime = omp_get_wtime()-t0;
+
+    /* Both must find the same distances, and occluded must agree */
+    for(i=0;i<nLinear;i++) {
+      double d = mesh->lineTest(origins[i].v,directions[i].v,MAX_DISTANCE,&hit);
+      if(fabs(d-linearDistances[i]) > 1e-9) errors++;
+      if(mesh->occluded(origins[i].v,directions[i].v,radius) != (linearDistances[i] < radius)) errors++;
+    }
+
+    printf("%10d %8d %10.2f %12.2f %12.2f %9.1fx %7.1f%% %8d\n",nTriangles,mesh->getNodeCount(),
+	   1e3*buildTime,1e3*linearTime,1e3*meshTime,linearTime/meshTime,100.0*hits/nRays,errors);
+  }
+  printf("All times are for %d rays\n",nRays);
+}
+
+/* Writes a scene file with many spheres and boxes made by CSG, and
+   the detailed fighter if it is found, and loads it by parsing the
+   text and from the cache */
+static void sceneBenchmark() {
+  const char *sceneName = "benchmark.scene", *cacheName = "benchmark.scene.cache";
+  int sizes[] = { 1000, 10000, 50000 };
+  int s, i, run;
+
+  printf("\nLoading scene files\n");
+  printf("%8s %8s %12s %12s %12s %10s\n","objects","meshes","kB","parse ms","cache ms","speedup");
+  for(s=0;s<(int)(sizeof(sizes)/sizeof(sizes[0]));s++) {
+    FILE *fp = fopen(sceneName,"w");
+    if(!fp) { printf("Could not write %s\n",sceneName); return; }
+    fprintf(fp,"camera origin 0 5 20 focus 0 0 0\nambient 0.2 0.2 0.2\n");
+    fprintf(fp,"light sphere position 1 30 1 radius 0.3 colour 1 1 1\n");
+    fprintf(fp,"properties red ambient 0.8 0.2 0.2 diffuse 0.8 0.2 0.2 specular 1 1 1 shininess 10\n");
+    fprintf(fp,"properties white ambient 0.8 0.8 0.8 diffuse 0.8 0.8 0.8 specular 1 1 1 shininess 10\n");
+    fprintf(fp,"material red simple red\nmaterial checkers checkerboard 1 red white\n");
+    srand(1);
+    for(i=0;i<sizes[s];i++) {
+      double x = randomValue(-20.0,20.0), y = randomValue(0.0,10.0), z = randomValue(-20.0,20.0);
+      if(i % 10 == 0)
+	fprintf(fp,"transform {\n  rotatey %g\n  translate %g %g %g\n  intersection {\n"
+		"    plane 1 0 0 0.2 material checkers plane -1 0 0 0.2 material checkers\n"
+		"    plane 0 1 0 0.2 material checkers plane 0 -1 0 0.2 material checkers\n"
+		"    plane 0 0 1 0.2 material checkers plane 0 0 -1 0.2 material checkers\n  }\n}\n",
+		randomValue(0.0,3.0),x,y,z);
+      else fprintf(fp,"transform { translate %g %g %g sphere %g material red }\n",x,y,z,randomValue(0.1,0.3));
+    }
+    FILE *model = fopen("../Lab 3/fighter-hires.ac","r");
+    if(model) {
+      fclose(model);
+      fprintf(fp,"transform { scale 0.5 0.5 0.5 mesh \"../Lab 3/fighter-hires.ac\" }\n");
+    }
+    long bytes = ftell(fp);
+    fclose(fp);
+
+    /* Parse the text, write the cache and load it twice, keeping the
+       fastest */
+    double parseTime = 0.0, cacheTime = MAX_DISTANCE;
+    for(run=0;run<4;run++) {
+      SceneFile scene;
+      Raytracer *raytracer = new Raytracer();
+      double t0 = omp_get_wtime();
+      if(!scene.load(sceneName,raytracer,run > 0)) { printf("Could not load %s\n",sceneName); return; }
+      double t = omp_get_wtime()-t0;
+      if(run == 0) parseTime = t;
+      else if(run > 1) {
+	if(!scene.loadedFromCache()) printf("The cache was not used\n");
+	cacheTime = MIN(cacheTime,t);
+      }
+      delete raytracer;
+    }
+    printf("%8d %8d %12.1f %12.2f %12.2f %9.1fx\n",sizes[s],model ? 1 : 0,bytes/1024.0,
+	   1e3*parseTime,1e3*cacheTime,parseTime/cacheTime);
+  }
+  remove(sceneName);
+  remove(cacheName);
+}
+
+/* Makes the primary rays of a 1920x1080 frame a pixel at a time, as
+   the raytracer used to, and a tile of 16x16 pixels at a time */
+static void cameraBenchmark() {
+  const int width = 1920, height = 1080, tile = 16, frames = 10;
+  int frame, tx, ty, i, j, k;
+  double origin[3] = { 1.0, 2.0, 4.0 }, up[3] = { 0.0, 1.0, 0.0 }, focus[3] = { 0.0, 0.0, 0.0 };
+  Camera camera;
+  camera.setUp(up);
+  camera.setOrigin(origin);
+  camera.setFocus(focus);
+  camera.setImageSize(width,height);
+
+  /* Summed so the compiler can not skip any of the work */
+  double sum = 0.0, maxError = 0.0;
+  double t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++)
+    for(j=0;j<height;j++)
+      for(i=0;i<width;i++) {
+	double o[3], d[3];
+	camera.getPixelRay(i/(double)width,j/(double)height,o,d);
+	sum += d[0]+d[1]+d[2];
+      }
+  double pixelTime = (omp_get_wtime()-t0)/frames;
+
+  double x[tile*tile], y[tile*tile], dx[tile*tile], dy[tile*tile], dz[tile*tile];
+  t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++)
+    for(ty=0;ty<height;ty+=tile)
+      for(tx=0;tx<width;tx+=tile) {
+	int n = 0;
+	for(j=ty;j<MIN(ty+tile,height);j++)
+	  for(i=tx;i<MIN(tx+tile,width);i++) { x[n] = i; y[n] = j; n++; }
+	camera.getPixelRays(n,x,y,dx,dy,dz);
+	for(k=0;k<n;k++) sum += dx[k]+dy[k]+dz[k];
+      }
+  double tileTime = (omp_get_wtime()-t0)/frames;
+
+  /* Both must give the same directions, up to rounding */
+  for(ty=0;ty<height;ty+=tile) {
+    for(i=0;i<width;i+=tile*tile) {
+      int m = MIN(tile*tile,width-i);
+      for(k=0;k<m;k++) { x[k] = i+k; y[k] = ty; }
+      camera.getPixelRays(m,x,y,dx,dy,dz);
+      for(k=0;k<m;k++) {
+	double o[3], d[3];
+	camera.getPixelRay(x[k]/width,y[k]/height,o,d);
+	maxError = MAX(maxError,fabs(d[0]-dx[k])+fabs(d[1]-dy[k])+fabs(d[2]-dz[k]));
+      }
+    }
+  }
+
+  printf("\nPrimary rays of a %dx%d frame\n",width,height);
+  printf("%12s %12s %10s %12s\n","pixel ms","tile ms","speedup","max error");
+  printf("%12.2f %12.2f %9.1fx %12.2g\n",1e3*pixelTime,1e3*tileTime,pixelTime/tileTime,maxError);
+  if(sum == 0.0) printf("\n");
+}
+
+/* Resolves a 4K frame buffer of bright colours, compared to
+   clamping and converting every pixel by SDL_MapRGB */
+static void resolveBenchmark() {
+  const int width = 3840, height = 2160, tile = 16, frames = 10;
+  int frame, x, y, j;
+  FrameBuffer frameBuffer;
+  SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE,width,height,32,0xff0000,0x00ff00,0x0000ff,0);
+  Uint32 *expected = new Uint32[width*height];
+
+  frameBuffer.resize(width,height);
+  srand(1);
+  for(y=0;y<height;y++)
+    for(x=0;x<width;x++) {
+      double rgb[3];
+      for(j=0;j<3;j++) rgb[j] = randomValue(-0.1,1.5);
+      frameBuffer.setPixel(x,y,rgb);
+    }
+
+  double t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++)
+    for(y=0;y<height;y++)
+      for(x=0;x<width;x++) {
+	double rgb[3];
+	frameBuffer.getPixel(x,y,rgb);
+	for(j=0;j<3;j++) if(rgb[j] > 1.0) rgb[j]=1.0; else if(rgb[j] < 0.0) rgb[j]=0.0;
+	expected[y*width+x] =
+	  SDL_MapRGB(surface->format,(Uint8)(rgb[0]*255.0),(Uint8)(rgb[1]*255.0),(Uint8)(rgb[2]*255.0));
+      }
+  double mapTime = (omp_get_wtime()-t0)/frames;
+
+  t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++) frameBuffer.resolve(surface,0,0,width,height);
+  double clampTime = (omp_get_wtime()-t0)/frames;
+
+  /* The default resolve must give exactly the same pixels */
+  int errors=0;
+  for(y=0;y<height;y++)
+    for(x=0;x<width;x++)
+      if(((Uint32*)((Uint8*)surface->pixels+y*surface->pitch))[x] != expected[y*width+x]) errors++;
+
+  frameBuffer.setToneMap(FrameBuffer::Filmic);
+  frameBuffer.setSRGB(true);
+  frameBuffer.setDither(true);
+  t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++) frameBuffer.resolve(surface,0,0,width,height);
+  double filmicTime = (omp_get_wtime()-t0)/frames;
+
+  /* The renderer resolves every tile right after writing it, when
+     its pixels are still in the cache. Resolving the same tile over
+     and over gives that cost, here for all tiles of the frame. */
+  int nTiles = (width/tile)*(height/tile);
+  t0 = omp_get_wtime();
+  for(frame=0;frame<frames;frame++)
+    for(x=0;x<nTiles;x++) frameBuffer.resolve(surface,0,0,tile,tile);
+  double tileTime = (omp_get_wtime()-t0)/frames;
+
+  printf("\nResolving a %dx%d frame\n",width,height);
+  printf("%14s %14s %14s %14s %8s\n","SDL_MapRGB ms","clamp ms","filmic ms","hot tiles ms","errors");
+  printf("%14.2f %14.2f %14.2f %14.2f %8d\n",1e3*mapTime,1e3*clampTime,1e3*filmicTime,1e3*tileTime,errors);
+  printf("filmic uses sRGB and dither, as do the %dx%d tiles. All on one thread.\n",tile,tile);
+  delete [] expected;
+  SDL_FreeSurface(surface);
+}
+
+int main(int argc,char **args) {
+  int sizes[] = { 10, 100, 1000, 5000, 20000, 50000 };
+  int nSizes = sizeof(sizes)/sizeof(sizes[0]);
+  int s, i, j;
+  static double origins[N_RAYS][3], directions[N_RAYS][3];
+
+  srand(1);
+  printf("%8s %10s %12s %12s %9s %12s %12s %9s %8s\n","objects","build ms",
+	 "linear ms","bvh ms","speedup","lin.shadow","bvh shadow","speedup","errors");
+  for(s=0;s<nSizes;s++) {
+    int nObjects = sizes[s];
+    set<Object*> objects;
+    createScene(&objects,nObjects);
+    double size = 2.0*pow((double)nObjects,1.0/3.0);
+
+    /* Rays start at random points in the scene and go in random
+       directions, similar to a mix of primary and secondary rays */
+    for(i=0;i<N_RAYS;i++) {
+      for(j=0;j<3;j++) {
+	origins[i][j] = randomValue(-size,size);
+	directions[i][j] = randomValue(-1.0,1.0);
+      }
+      normalize(directions[i]);
+    }
+
+    BVH bvh;
+    double t0 = omp_get_wtime();
+    bvh.build(&objects);
+    double buildTime = omp_get_wtime()-t0;
+
+    /* Linear scans get far too slow for the largest scenes, so only
+       trace a subset of the rays for them and scale the timing. */
+    int nLinear = MIN(N_RAYS,(int)(2e7/nObjects));
+    double checksum=0.0;
+    Object *hitObject;
+    t0 = omp_get_wtime();
+    for(i=0;i<nLinear;i++) checksum += linearLineTest(&objects,origins[i],directions[i],&hitObject);
+    double linearTime = (omp_get_wtime()-t0)*N_RAYS/nLinear;
+    t0 = omp_get_wtime();
+    for(i=0;i<N_RAYS;i++) checksum += bvh.lineTest(origins[i],directions[i],MAX_DISTANCE,&hitObject,NULL);
+    double bvhTime = omp_get_wtime()-t0;
+
+    int shadows=0;
+    t0 = omp_get_wtime();
+    for(i=0;i<nLinear;i++) shadows += linearShadowTest(&objects,origins[i],directions[i],size);
+    double linearShadowTime = (omp_get_wtime()-t0)*N_RAYS/nLinear;
+    t0 = omp_get_wtime();
+    for(i=0;i<N_RAYS;i++) shadows += bvh.occluded(origins[i],directions[i],size,NULL);
+    double bvhShadowTime = omp_get_wtime()-t0;
+
+    /* Both methods must give exactly the same answers */
+    int errors=0;
+    for(i=0;i<nLinear;i++) {
+      Object *linearObject, *bvhObject;
+      double d1 = linearLineTest(&objects,origins[i],directions[i],&linearObject);
+      double d2 = bvh.lineTest(origins[i],directions[i],MAX_DISTANCE,&bvhObject,NULL);
+      if(fabs(d1-d2) > 1e-9 || linearObject != bvhObject) errors++;
+      if(linearShadowTest(&objects,origins[i],directions[i],size) !=
+	 bvh.occluded(origins[i],directions[i],size,NULL)) errors++;
+    }
+
+    printf("%8d %10.2f %12.2f %12.2f %8.1fx %12.2f %12.2f %8.1fx %8d\n",nObjects,1e3*buildTime,
+	   1e3*linearTime,1e3*bvhTime,linearTime/bvhTime,
+	   1e3*linearShadowTime,1e3*bvhShadowTime,linearShadowTime/bvhShadowTime,errors);
+  }
+  printf("All times are for %d rays\n",N_RAYS);
+
+  primaryRayBenchmark();
+  csgBenchmark();
+  noiseBenchmark();
+  lightBenchmark(1.0);
+  lightBenchmark(0.0);
+  meshBenchmark();
+  sceneBenchmark();
+  cameraBenchmark();
+  resolveBenchmark();
+  return 0;
+}
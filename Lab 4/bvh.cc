@@ -0,0 +1,473 @@
+/** \file bvh.cc
+    \brief Implements the BVH class used to accelerate line tests
+    against all objects in a scene.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "bvh.h"
+#include <algorithm>
+
+using namespace std;
+
+/* Number of bins used when evaluating the surface area heuristic */
+#define BVH_BINS 16
+/* Cost of testing a node relative to the cost of one Object::lineTest,
+   or one triangle test in a TriangleMesh */
+#define BVH_TRAVERSAL_COST 0.125
+/* Leaves larger than this are split even if the SAH says otherwise */
+#define BVH_MAX_LEAF_SIZE 4
+/* Beyond this depth nodes are split at the median to bound the depth
+   of the tree, and thereby the size of the traversal stacks. */
+#define BVH_MAX_SAH_DEPTH 64
+#define BVH_STACK_SIZE 128
+
+BVH::BVH() {}
+BVH::~BVH() {}
+
+int BVH::getBoundedCount() { return boundedObjects.size(); }
+int BVH::getUnboundedCount() { return unboundedObjects.size(); }
+int BVH::getNodeCount() { return nodes.size(); }
+
+void BVH::build(set<Object*> *objects) {
+  int i;
+  set<Object*>::iterator objIterator;
+  set<Object*>::iterator objIteratorEnd;
+  vector<BuildItem> items;
+  /* The objects of the items, by their index */
+  vector<Object*> itemObjects;
+
+  nodes.clear();
+  boundedObjects.clear();
+  unboundedObjects.clear();
+
+  for(objIterator=objects->begin(),objIteratorEnd=objects->end();
+      objIterator != objIteratorEnd;objIterator++) {
+    BuildItem item;
+    bool bounded=true, empty=false;
+    Object *object = *objIterator;
+    for(i=0;i<3;i++) { item.min[i] = -MAX_DISTANCE; item.max[i] = MAX_DISTANCE; }
+    object->getBounds(item.min,item.max);
+    for(i=0;i<3;i++) {
+      /* Written so that NaN bounds count as empty too */
+      if(!(item.min[i] <= item.max[i])) empty=true;
+      if(item.min[i] < -0.5*MAX_DISTANCE || item.max[i] > 0.5*MAX_DISTANCE) bounded=false;
+    }
+    if(empty)
+      /* Nothing of this object can ever be hit */
+      continue;
+    if(!bounded) {
+      unboundedObjects.push_back(object);
+      continue;
+    }
+    for(i=0;i<3;i++) {
+      /* Pad the bounds slightly so that rays grazing the object are
+	 not lost due to rounding errors */
+      item.min[i] -= 1e-6; item.max[i] += 1e-6;
+      item.centroid[i] = 0.5*(item.min[i]+item.max[i]);
+    }
+    item.index = (int) itemObjects.size();
+    itemObjects.push_back(object);
+    items.push_back(item);
+  }
+
+  if(items.empty()) return;
+  nodes.reserve(2*items.size());
+  nodes.resize(1);
+  buildNode(0,&items[0],0,items.size(),0);
+
+  /* The leaves hold ranges of the items in their final order */
+  boundedObjects.resize(items.size());
+  for(i=0;i<(int)items.size();i++) boundedObjects[i] = itemObjects[items[i].index];
+}
+
+static double surfaceArea(double min[3],double max[3]) {
+  double dx=max[0]-min[0], dy=max[1]-min[1], dz=max[2]-min[2];
+  return 2.0*(dx*dy+dy*dz+dz*dx);
+}
+
+/* Bin of a centroid along an axis of the centroid bounds. Written so
+   that a NaN centroid still gives a valid bin. */
+static inline int binIndex(double centroid,double centroidMin,double extent) {
+  double bin = BVH_BINS*(centroid-centroidMin)/extent;
+  if(!(bin > 0.0)) return 0;
+  return bin >= BVH_BINS ? BVH_BINS-1 : (int) bin;
+}
+
+/* Orders build items along one axis */
+class CentroidOrder {
+ public:
+  CentroidOrder(int axis) : axis(axis) {}
+  bool operator()(const BuildItem &a,const BuildItem &b) const { return a.centroid[axis] < b.centroid[axis]; }
+ private:
+  int axis;
+};
+
+int splitBuildItems(BuildItem *items,int first,int count,int depth,double min[3],double max[3]) {
+  int i, j, axis;
+  double centroidMin[3], centroidMax[3];
+
+  /* Compute the bounds of the node and of the centroids in it */
+  for(i=0;i<3;i++) {
+    min[i] = centroidMin[i] = MAX_DISTANCE;
+    max[i] = centroidMax[i] = -MAX_DISTANCE;
+  }
+  for(j=first;j<first+count;j++)
+    for(i=0;i<3;i++) {
+      min[i] = MIN(min[i],items[j].min[i]);
+      max[i] = MAX(max[i],items[j].max[i]);
+      centroidMin[i] = MIN(centroidMin[i],items[j].centroid[i]);
+      centroidMax[i] = MAX(centroidMax[i],items[j].centroid[i]);
+    }
+
+  /* Find the best split by evaluating the surface area heuristic at
+     the borders between BVH_BINS equally sized bins along each
+     axis. The cost of not splitting at all is count. */
+  double parentArea = surfaceArea(min,max);
+  if(parentArea <= 0.0) parentArea = 1.0;
+  double bestCost = count;
+  int bestAxis = -1, bestSplit = 0;
+  for(axis=0;axis<3 && depth < BVH_MAX_SAH_DEPTH;axis++) {
+    double extent = centroidMax[axis]-centroidMin[axis];
+    if(extent <= 1e-12) continue;
+    int binCount[BVH_BINS];
+    double binMin[BVH_BINS][3], binMax[BVH_BINS][3];
+    for(j=0;j<BVH_BINS;j++) {
+      binCount[j] = 0;
+      for(i=0;i<3;i++) { binMin[j][i] = MAX_DISTANCE; binMax[j][i] = -MAX_DISTANCE; }
+    }
+    for(j=first;j<first+count;j++) {
+      int bin = binIndex(items[j].centroid[axis],centroidMin[axis],extent);
+      binCount[bin]++;
+      for(i=0;i<3;i++) {
+	binMin[bin][i] = MIN(binMin[bin][i],items[j].min[i]);
+	binMax[bin][i] = MAX(binMax[bin][i],items[j].max[i]);
+      }
+    }
+    /* Sweep from the right to get the cost of everything right of
+       each split, then from the left to get the total cost */
+    double rightArea[BVH_BINS];
+    int rightCount[BVH_BINS];
+    double boxMin[3], boxMax[3];
+    int n=0;
+    for(i=0;i<3;i++) { boxMin[i] = MAX_DISTANCE; boxMax[i] = -MAX_DISTANCE; }
+    for(j=BVH_BINS-1;j>0;j--) {
+      n += binCount[j];
+      for(i=0;i<3;i++) {
+	boxMin[i] = MIN(boxMin[i],binMin[j][i]);
+	boxMax[i] = MAX(boxMax[i],binMax[j][i]);
+      }
+      rightCount[j] = n;
+      rightArea[j] = n ? surfaceArea(boxMin,boxMax) : 0.0;
+    }
+    n=0;
+    for(i=0;i<3;i++) { boxMin[i] = MAX_DISTANCE; boxMax[i] = -MAX_DISTANCE; }
+    for(j=1;j<BVH_BINS;j++) {
+      n += binCount[j-1];
+      for(i=0;i<3;i++) {
+	boxMin[i] = MIN(boxMin[i],binMin[j-1][i]);
+	boxMax[i] = MAX(boxMax[i],binMax[j-1][i]);
+      }
+      if(n == 0 || rightCount[j] == 0) continue;
+      double cost = BVH_TRAVERSAL_COST +
+	(n*surfaceArea(boxMin,boxMax) + rightCount[j]*rightArea[j]) / parentArea;
+      if(cost < bestCost) {
+	bestCost = cost;
+	bestAxis = axis;
+	bestSplit = j;
+      }
+    }
+  }
+
+  int middle = first;
+  if(bestAxis != -1) {
+    /* Move all items left of the split to the beginning */
+    double extent = centroidMax[bestAxis]-centroidMin[bestAxis];
+    for(j=first;j<first+count;j++)
+      if(binIndex(items[j].centroid[bestAxis],centroidMin[bestAxis],extent) < bestSplit) {
+	BuildItem tmp = items[j]; items[j] = items[middle]; items[middle] = tmp;
+	middle++;
+      }
+  } else if(count > BVH_MAX_LEAF_SIZE) {
+    /* Too many items for a leaf, but the SAH found no good split
+       (eg. all centroids coincide). Split at the median along the
+       largest axis instead. */
+    axis = 0;
+    for(i=1;i<3;i++)
+      if(centroidMax[i]-centroidMin[i] > centroidMax[axis]-centroidMin[axis]) axis=i;
+    middle = first+count/2;
+    nth_element(items+first,items+middle,items+first+count,CentroidOrder(axis));
+  }
+  return middle;
+}
+
+void BVH::buildNode(int nodeIndex,BuildItem *items,int first,int count,int depth) {
+  Node node;
+  int middle = splitBuildItems(items,first,count,depth,node.min,node.max);
+
+  if(middle == first || middle == first+count) {
+    /* Make this node a leaf */
+    node.first = first;
+    node.count = count;
+    nodes[nodeIndex] = node;
+    return;
+  }
+
+  /* Note that nodes may be reallocated by the recursion, so we cannot
+     hold any pointers into it. */
+  int left = nodes.size();
+  node.first = left;
+  node.count = 0;
+  nodes[nodeIndex] = node;
+  nodes.resize(left+2);
+  buildNode(left,items,first,middle-first,depth+1);
+  buildNode(left+1,items,middle,first+count-middle,depth+1);
+}
+
+bool BVH::boxTest(Node *node,double origin[3],double invDirection[3],double maxDistance,double *entry) {
+  int i;
+  double tEnter=0.0, tExit=maxDistance;
+  for(i=0;i<3;i++) {
+    double t1 = (node->min[i]-origin[i])*invDirection[i];
+    double t2 = (node->max[i]-origin[i])*invDirection[i];
+    if(t1 > t2) { double tmp=t1; t1=t2; t2=tmp; }
+    if(t1 > tEnter) tEnter=t1;
+    if(t2 < tExit) tExit=t2;
+  }
+  *entry = tEnter;
+  return tEnter <= tExit;
+}
+
+/* Computes the inverse of the direction, avoiding divisions by zero
+   so that no NaN's are created in the box tests. */
+static inline void inverseDirection(double direction[3],double invDirection[3]) {
+  int i;
+  for(i=0;i<3;i++)
+    invDirection[i] = 1.0 / (direction[i] != 0.0 ? direction[i] : 1e-30);
+}
+
+double BVH::lineTest(double origin[3],double direction[3],double maxDistance,Object **hitObject,HitRecord *hit) {
+  int i;
+  double closestDistance=maxDistance, distance;
+  Object *closestObject=NULL;
+  /* Objects fill in the record before we know if the hit is accepted,
+     so let them use a separate one */
+  HitRecord candidate;
+  HitRecord *candidateHit = hit ? &candidate : NULL;
+
+  /* Test the unbounded objects first, they are usually few and large
+     (eg. a floor) and may give a closest distance that lets us skip
+     large parts of the hierarchy. */
+  for(i=0;i<(int)unboundedObjects.size();i++) {
+    distance = unboundedObjects[i]->lineTest(origin,direction,closestDistance,candidateHit);
+    if(distance < closestDistance && distance > 1e-5) {
+      closestDistance = distance;
+      closestObject = unboundedObjects[i];
+      if(hit) *hit = candidate;
+    }
+  }
+
+  if(!nodes.empty()) {
+    double invDirection[3], entry;
+    int stack[BVH_STACK_SIZE];
+    double stackEntry[BVH_STACK_SIZE];
+    int stackSize=0;
+    inverseDirection(direction,invDirection);
+
+    if(boxTest(&nodes[0],origin,invDirection,closestDistance,&entry)) {
+      stack[0] = 0; stackEntry[0] = entry; stackSize = 1;
+    }
+    while(stackSize) {
+      stackSize--;
+      if(stackEntry[stackSize] > closestDistance) continue;
+      Node *node = &nodes[stack[stackSize]];
+      if(node->count) {
+	for(i=node->first;i<node->first+node->count;i++) {
+	  distance = boundedObjects[i]->lineTest(origin,direction,closestDistance,candidateHit);
+	  if(distance < closestDistance && distance > 1e-5) {
+	    closestDistance = distance;
+	    closestObject = boundedObjects[i];
+	    if(hit) *hit = candidate;
+	  }
+	}
+	continue;
+      }
+      /* Push the children so that the closest one is visited first */
+      double entryLeft, entryRight;
+      bool hitLeft = boxTest(&nodes[node->first],origin,invDirection,closestDistance,&entryLeft);
+      bool hitRight = boxTest(&nodes[node->first+1],origin,invDirection,closestDistance,&entryRight);
+      if(hitLeft && hitRight) {
+	int nearChild = entryLeft <= entryRight ? node->first : node->first+1;
+	stack[stackSize] = 2*node->first+1-nearChild;
+	stackEntry[stackSize++] = MAX(entryLeft,entryRight);
+	stack[stackSize] = nearChild;
+	stackEntry[stackSize++] = MIN(entryLeft,entryRight);
+      } else if(hitLeft) {
+	stack[stackSize] = node->first; stackEntry[stackSize++] = entryLeft;
+      } else if(hitRight) {
+	stack[stackSize] = node->first+1; stackEntry[stackSize++] = entryRight;
+      }
+    }
+  }
+
+  *hitObject = closestObject;
+  return closestObject ? closestDistance : MAX_DISTANCE;
+}
+
+bool BVH::boxTestPacket(Node *node,RayPacket *packet,double invDirection[3][RAY_PACKET_SIZE],
+			double maxDistance[],int mask[],double *entry) {
+  int i,j;
+  double tEnter[RAY_PACKET_SIZE], tExit[RAY_PACKET_SIZE];
+  for(i=0;i<RAY_PACKET_SIZE;i++) { tEnter[i]=0.0; tExit[i]=maxDistance[i]; }
+  for(j=0;j<3;j++)
+    for(i=0;i<RAY_PACKET_SIZE;i++) {
+      double t1 = (node->min[j]-packet->origin[j][i])*invDirection[j][i];
+      double t2 = (node->max[j]-packet->origin[j][i])*invDirection[j][i];
+      tEnter[i] = MAX(tEnter[i],MIN(t1,t2));
+      tExit[i] = MIN(tExit[i],MAX(t1,t2));
+    }
+  int any=0;
+  double closestEntry=MAX_DISTANCE;
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    mask[i] = packet->active[i] && tEnter[i] <= tExit[i];
+    any |= mask[i];
+    closestEntry = MIN(closestEntry,mask[i] ? tEnter[i] : MAX_DISTANCE);
+  }
+  *entry = closestEntry;
+  return any != 0;
+}
+
+void BVH::lineTestPacket(RayPacket *packet,double maxDistance,double distance[],Object *hitObject[],HitRecord hit[]) {
+  int i,j,k;
+  double closestDistance[RAY_PACKET_SIZE], thisDistance[RAY_PACKET_SIZE];
+  int active[RAY_PACKET_SIZE];
+  HitRecord candidate[RAY_PACKET_SIZE];
+  HitRecord *candidateHit = hit ? candidate : NULL;
+
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    closestDistance[i] = maxDistance;
+    thisDistance[i] = MAX_DISTANCE;
+    hitObject[i] = NULL;
+    active[i] = packet->active[i];
+  }
+
+  for(k=0;k<(int)unboundedObjects.size();k++) {
+    unboundedObjects[k]->lineTestPacket(packet,closestDistance,thisDistance,candidateHit);
+    for(i=0;i<RAY_PACKET_SIZE;i++)
+      if(active[i] && thisDistance[i] < closestDistance[i] && thisDistance[i] > 1e-5) {
+	closestDistance[i] = thisDistance[i];
+	hitObject[i] = unboundedObjects[k];
+	if(hit) hit[i] = candidate[i];
+      }
+  }
+
+  if(!nodes.empty()) {
+    double invDirection[3][RAY_PACKET_SIZE];
+    int mask[RAY_PACKET_SIZE];
+    int stack[BVH_STACK_SIZE];
+    int stackSize=1;
+    double entry;
+    for(j=0;j<3;j++)
+      for(i=0;i<RAY_PACKET_SIZE;i++)
+	invDirection[j][i] = 1.0 / (packet->direction[j][i] != 0.0 ? packet->direction[j][i] : 1e-30);
+
+    stack[0]=0;
+    while(stackSize) {
+      Node *node = &nodes[stack[--stackSize]];
+      if(!boxTestPacket(node,packet,invDirection,closestDistance,mask,&entry)) continue;
+      if(node->count) {
+	/* Only test the rays that hit this leaf. When a single ray is
+	   left there is nothing to gain from the packet version. */
+	int nActive=0, lastActive=0;
+	for(i=0;i<RAY_PACKET_SIZE;i++)
+	  if(mask[i]) { nActive++; lastActive=i; }
+	if(nActive == 1) {
+	  double origin[3], direction[3];
+	  i=lastActive;
+	  for(j=0;j<3;j++) { origin[j]=packet->origin[j][i]; direction[j]=packet->direction[j][i]; }
+	  for(k=node->first;k<node->first+node->count;k++) {
+	    double d = boundedObjects[k]->lineTest(origin,direction,closestDistance[i],hit ? &candidate[i] : NULL);
+	    if(d < closestDistance[i] && d > 1e-5) {
+	      closestDistance[i] = d;
+	      hitObject[i] = boundedObjects[k];
+	      if(hit) hit[i] = candidate[i];
+	    }
+	  }
+	  continue;
+	}
+	for(i=0;i<RAY_PACKET_SIZE;i++) packet->active[i] = mask[i];
+	for(k=node->first;k<node->first+node->count;k++) {
+	  boundedObjects[k]->lineTestPacket(packet,closestDistance,thisDistance,candidateHit);
+	  for(i=0;i<RAY_PACKET_SIZE;i++)
+	    if(mask[i] && thisDistance[i] < closestDistance[i] && thisDistance[i] > 1e-5) {
+	      closestDistance[i] = thisDistance[i];
+	      hitObject[i] = boundedObjects[k];
+	      if(hit) hit[i] = candidate[i];
+	    }
+	}
+	for(i=0;i<RAY_PACKET_SIZE;i++) packet->active[i] = active[i];
+	continue;
+      }
+      /* Visit the child that the packet enters first before the
+	 other, and skip children that no ray in the packet hits */
+      double entryLeft, entryRight;
+      int hitLeft = boxTestPacket(&nodes[node->first],packet,invDirection,closestDistance,mask,&entryLeft);
+      int hitRight = boxTestPacket(&nodes[node->first+1],packet,invDirection,closestDistance,mask,&entryRight);
+      if(entryLeft <= entryRight) {
+	if(hitRight) stack[stackSize++] = node->first+1;
+	if(hitLeft) stack[stackSize++] = node->first;
+      } else {
+	if(hitLeft) stack[stackSize++] = node->first;
+	if(hitRight) stack[stackSize++] = node->first+1;
+      }
+    }
+  }
+
+  for(i=0;i<RAY_PACKET_SIZE;i++)
+    distance[i] = hitObject[i] ? closestDistance[i] : MAX_DISTANCE;
+}
+
+bool BVH::occluded(double origin[3],double direction[3],double maxDistance,Object *ignore) {
+  int i;
+
+  for(i=0;i<(int)unboundedObjects.size();i++) {
+    if(unboundedObjects[i] == ignore) continue;
+    if(unboundedObjects[i]->occluded(origin,direction,maxDistance)) return true;
+  }
+  if(nodes.empty()) return false;
+
+  double invDirection[3], entry;
+  int stack[BVH_STACK_SIZE];
+  int stackSize=1;
+  inverseDirection(direction,invDirection);
+  stack[0]=0;
+  while(stackSize) {
+    Node *node = &nodes[stack[--stackSize]];
+    if(!boxTest(node,origin,invDirection,maxDistance,&entry)) continue;
+    if(node->count) {
+      for(i=node->first;i<node->first+node->count;i++) {
+	if(boundedObjects[i] == ignore) continue;
+	if(boundedObjects[i]->occluded(origin,direction,maxDistance)) return true;
+      }
+    } else {
+      stack[stackSize++] = node->first;
+      stack[stackSize++] = node->first+1;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,118 @@
+/** \file bvh.h
+    \brief Declares the BVH class used to accelerate line tests
+    against all objects in a scene.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	BVH_H_
+# define   	BVH_H_
+
+#ifndef OBJECT_H_
+#include "object.h"
+#endif
+
+#include <vector>
+
+/** \brief Something to place in a hierarchy, with its bounds. Only
+    used while building.
+
+    index tells the caller which object or triangle the item stands
+    for. */
+typedef struct {
+  double min[3], max[3], centroid[3];
+  int index;
+} BuildItem;
+
+/** Assigns to min and max the bounds of items[first .. first+count-1]
+    and finds where to split them using the binned surface area
+    heuristic, as for the nodes of a BVH or a TriangleMesh. Moves the
+    items of the left child to the beginning and returns the index of
+    the first item of the right child. Returns first if the items are
+    better kept in one leaf. Nodes at depth BVH_MAX_SAH_DEPTH or
+    deeper are split at the median. */
+int splitBuildItems(BuildItem *items,int first,int count,int depth,double min[3],double max[3]);
+
+/** \brief Bounding volume hierarchy over a set of objects.
+
+    The hierarchy is built using the surface area heuristic (SAH) over
+    the world space bounds given by Object::getBounds. Objects that
+    are not bounded in all directions (eg. planes) cannot be placed in
+    the hierarchy and are instead kept in a separate list that is
+    tested against every ray.
+
+    Since objects may move between frames (eg. by changing a
+    Transform) the hierarchy must be rebuilt using BVH::build whenever
+    the scene has changed. Queries are reentrant and can be performed
+    from multiple threads at the same time.
+*/
+class BVH {
+ public:
+  BVH();
+  ~BVH();
+
+  /** Rebuilds the hierarchy from scratch over the given objects. The
+      objects are not referenced, the caller must keep them alive for
+      as long as the hierarchy is used. */
+  void build(class std::set<Object*> *objects);
+
+  /** Finds the closest object intersecting the ray, using the same
+      conventions as Object::lineTest. Intersections closer than 1e-5
+      are ignored. Returns MAX_DISTANCE and assigns NULL to hitObject
+      if no intersection closer than maxDistance exists. If hit is not
+      NULL it is filled in for the closest intersection. */
+  double lineTest(double origin[3],double direction[3],double maxDistance,Object **hitObject,HitRecord *hit);
+
+  /** Packet version of lineTest. For every active ray i of the packet
+      assigns the closest distance to distance[i], the object to
+      hitObject[i] and fills in hit[i] if hit is not NULL. Nodes are
+      visited if any of the active rays intersects them, and only
+      those rays are then tested against the objects. */
+  void lineTestPacket(RayPacket *packet,double maxDistance,double distance[],Object *hitObject[],HitRecord hit[]);
+
+  /** Returns true if any object except ignore intersects the ray
+      closer than maxDistance. Stops as soon as the first such object
+      is found, using Object::occluded on the candidates. */
+  bool occluded(double origin[3],double direction[3],double maxDistance,Object *ignore);
+
+  /** Number of objects stored in the hierarchy */
+  int getBoundedCount();
+  /** Number of objects stored in the list of unbounded objects */
+  int getUnboundedCount();
+  /** Number of nodes in the hierarchy */
+  int getNodeCount();
+
+ private:
+  /** A node is a leaf if count > 0, in which case it holds the
+      objects first .. first+count-1. Otherwise the children are
+      found at first and first+1. */
+  typedef struct {
+    double min[3], max[3];
+    int first, count;
+  } Node;
+
+  void buildNode(int nodeIndex,BuildItem *items,int first,int count,int depth);
+  static bool boxTest(Node *node,double origin[3],double invDirection[3],double maxDistance,double *entry);
+  static bool boxTestPacket(Node *node,RayPacket *packet,double invDirection[3][RAY_PACKET_SIZE],
+			    double maxDistance[],int mask[],double *entry);
+
+  std::vector<Node> nodes;
+  std::vector<Object*> boundedObjects;
+  std::vector<Object*> unboundedObjects;
+};
+
+#endif 	    /* !BVH_H_ */
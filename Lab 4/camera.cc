@@ -28,12 +28,30 @@
 Camera::Camera() {
   zero(origin); zero(up); zero(right); zero(forward);
   tanFovX=1.0;
-  tanFovY=240./320.*tanFovX;
+  setImageSize(320,240);
 }
 void Camera::setOrigin(double v[3]) { assign(v,origin); }
-void Camera::setUp(double v[3]) { assign(v,up); normalize(up); }
-void Camera::setRight(double v[3]) { assign(v,right); normalize(right); }
-void Camera::setForward(double v[3]) { assign(v,forward); normalize(forward); }
+void Camera::setUp(double v[3]) { assign(v,up); normalize(up); updateSteps(); }
+void Camera::setRight(double v[3]) { assign(v,right); normalize(right); updateSteps(); }
+void Camera::setForward(double v[3]) { assign(v,forward); normalize(forward); updateSteps(); }
+void Camera::setImageSize(int width,int height) {
+  this->width=width;
+  this->height=height;
+  tanFovY=height/(double)width*tanFovX;
+  updateSteps();
+}
+void Camera::getOrigin(double origin[3]) { assign(this->origin,origin); }
+
+void Camera::updateSteps() {
+  int i;
+  for(i=0;i<3;i++) {
+    corner[i]=forward[i]+up[i]*0.5*tanFovY-right[i]*0.5*tanFovX;
+    across[i]=right[i]*tanFovX;
+    down[i]=-up[i]*tanFovY;
+    pixelAcross[i]=across[i]/width;
+    pixelDown[i]=down[i]/height;
+  }
+}
 
 void Camera::setFocus(double focus[3]) {
   int i;
@@ -49,6 +67,7 @@ void Camera::setFocus(double focus[3]) {
   for(i=0;i<3;i++) up[i] -= dot*forward[i];
   normalize(up);
   crossProduct(forward,up,right);
+  updateSteps();
   /*printf("forward: %3.1f %3.1f %3.1f\n",forward[0],forward[1],forward[2]);
   printf("up: %3.1f %3.1f %3.1f\n",up[0],up[1],up[2]);
   printf("right: %3.1f %3.1f %3.1f\n",right[0],right[1],right[2]);*/
@@ -57,6 +76,23 @@ void Camera::setFocus(double focus[3]) {
 void Camera::getPixelRay(double x,double y,double origin[3],double direction[3]) {
   int i;
   assign(this->origin,origin);
-  for(i=0;i<3;i++) direction[i]=forward[i]+up[i]*(0.5-y)*tanFovY+right[i]*(x-0.5)*tanFovX;
+  for(i=0;i<3;i++) direction[i]=corner[i]+x*across[i]+y*down[i];
   normalize(direction);
 }
+
+void Camera::getPixelRays(int n,const double x[],const double y[],double directionX[],double directionY[],double directionZ[]) {
+  int i;
+  /* Copies, so the compiler knows that the outputs do not change them */
+  double c0=corner[0], c1=corner[1], c2=corner[2];
+  double a0=pixelAcross[0], a1=pixelAcross[1], a2=pixelAcross[2];
+  double d0=pixelDown[0], d1=pixelDown[1], d2=pixelDown[2];
+  for(i=0;i<n;i++) {
+    double dx=c0+x[i]*a0+y[i]*d0;
+    double dy=c1+x[i]*a1+y[i]*d1;
+    double dz=c2+x[i]*a2+y[i]*d2;
+    double scale=1.0/sqrt(dx*dx+dy*dy+dz*dz);
+    directionX[i]=dx*scale;
+    directionY[i]=dy*scale;
+    directionZ[i]=dz*scale;
+  }
+}
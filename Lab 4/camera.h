@@ -52,10 +52,29 @@ class Camera {
       given point. Uses old values of up as hint whenever possible. */
   void setFocus(double[3]);
 
+  /** Sets the size of the image in pixels, which the rays of
+      getPixelRays are given in. The vertical field of view follows
+      the aspect of the image, the horizontal one stays 90 degrees. The
+      default is 320x240. */
+  void setImageSize(int width,int height);
+
   /** Assigns the origin/direction ray corresponding to a given pixel
       where x/y is a fraction 0.0 - 1.0 of screen width/height */
   void getPixelRay(double x,double y,double origin[3],double direction[3]);
+
+  /** Assigns the unit directions of the rays through the n points
+      (x[i],y[i]) of the image, given in pixels, to directionX[i],
+      directionY[i] and directionZ[i]. All of them start at the origin
+      of the camera. The directions are stepped linearly from the
+      corner of the image, without per ray calls, and normalized with
+      one square root and division each, so the compiler can do many
+      rays at once with SIMD instructions. */
+  void getPixelRays(int n,const double x[],const double y[],double directionX[],double directionY[],double directionZ[]);
+  void getOrigin(double origin[3]);
  private:
+  /** Recomputes the corner and the steps after any change */
+  void updateSteps();
+
   double origin[3];
 
   double up[3];
@@ -63,6 +82,11 @@ class Camera {
   double forward[3];
 
   double tanFovY,tanFovX;
+  int width, height;
+  /** Direction through the top left corner of the image, and the
+      change of the direction across the whole image and across one
+      pixel, to the right and downwards */
+  double corner[3], across[3], down[3], pixelAcross[3], pixelDown[3];
 };
 
 #endif 	    /* !CAMERA_H_ */
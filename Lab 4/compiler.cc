@@ -0,0 +1,421 @@
+/** \file compiler.cc
+    \brief Implements the SceneCompiler and CompiledObject classes.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "compiler.h"
+#include "sphere.h"
+#include "plane.h"
+#include "cone.h"
+#include "transform.h"
+#include "csg.h"
+#include <typeinfo>
+
+using namespace std;
+
+CompiledObject::CompiledObject(SceneCompiler *compiler,int root,Object *original) {
+  this->compiler=compiler;
+  this->root=root;
+  this->original=original;
+}
+CompiledObject::~CompiledObject() {}
+double CompiledObject::lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  if(debugThisPixel) return original->lineTest(origin,direction,maxDistance,hit);
+  return compiler->lineTest(root,origin,direction,maxDistance,hit);
+}
+void CompiledObject::lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  compiler->lineTestPacket(root,packet,maxDistance,distance,hit);
+}
+bool CompiledObject::occluded(double origin[3],double direction[3],double maxDistance) {
+  return compiler->occluded(root,origin,direction,maxDistance);
+}
+void CompiledObject::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  compiler->getSpans(root,origin,direction,maxDistance,spans,fillHits);
+}
+void CompiledObject::getNormal(double point[3],double normal[3]) { original->getNormal(point,normal); }
+bool CompiledObject::isInside(double point[3]) { return compiler->isInside(root,point); }
+void CompiledObject::getBounds(double min[3],double max[3]) { original->getBounds(min,max); }
+void CompiledObject::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
+  original->getLightingProperties(point,props,normal);
+}
+
+SceneCompiler::SceneCompiler() {}
+SceneCompiler::~SceneCompiler() {
+  int i;
+  for(i=0;i<(int)compiledObjects.size();i++) delete compiledObjects[i];
+}
+
+void SceneCompiler::compile(set<Object*> *sceneObjects) {
+  int i;
+  set<Object*>::iterator objIterator;
+
+  for(i=0;i<(int)compiledObjects.size();i++) delete compiledObjects[i];
+  compiledObjects.clear();
+  objects.clear();
+  nodes.clear();
+  matrices.clear();
+  operands.clear();
+  for(objIterator=sceneObjects->begin();objIterator != sceneObjects->end();objIterator++) {
+    int root = compileNode(*objIterator,-1,-1,NULL,-1);
+    if(nodes[root].type == VirtualNode && nodes[root].toObject == -1) {
+      /* Nothing gained by compiling it */
+      objects.insert(*objIterator);
+      continue;
+    }
+    CompiledObject *compiled = new CompiledObject(this,root,*objIterator);
+    compiledObjects.push_back(compiled);
+    objects.insert(compiled);
+  }
+}
+
+set<Object*> *SceneCompiler::getObjects() { return &objects; }
+
+int SceneCompiler::getMemoryUsage() {
+  return (int)(nodes.size()*sizeof(Node) + matrices.size()*sizeof(Mat4<double>) + operands.size()*sizeof(int));
+}
+
+int SceneCompiler::addMatrix(Mat4<double> *matrix) {
+  matrices.push_back(*matrix);
+  return (int)matrices.size()-1;
+}
+
+/* Compiles the object, where toObject and toScene are the matrices of
+   all transforms above it and material, toMaterial the outermost
+   material override. Returns the index of its node. */
+int SceneCompiler::compileNode(Object *object,int toObject,int toScene,Material *material,int toMaterial) {
+  int i;
+  Node node;
+  node.toObject=toObject;
+  node.toScene=toScene;
+  node.first=node.count=0;
+  node.material=material;
+  node.toMaterial=toMaterial;
+  node.object=object;
+
+  /* Only the exact classes are compiled, subclasses may have changed
+     any of their functions */
+  const type_info &type = typeid(*object);
+  if(type == typeid(Transform)) {
+    /* Fold the transform into the matrices of everything below it.
+       Identity transforms disappear completely. */
+    Transform *transform = (Transform*) object;
+    const Mat4<double> &inverse = transform->getInverse();
+    if(!transform->isIdentity) {
+      Mat4<double> newToObject = toObject == -1 ? inverse : inverse*matrices[toObject];
+      Mat4<double> newToScene = toScene == -1 ? transform->forward : matrices[toScene]*transform->forward;
+      toObject = addMatrix(&newToObject);
+      toScene = addMatrix(&newToScene);
+    }
+    if(transform->material && !material) {
+      material=transform->material;
+      toMaterial=toObject;
+    }
+    return compileNode(transform->child,toObject,toScene,material,toMaterial);
+  }
+
+  if(type == typeid(Sphere)) {
+    node.type=SphereNode;
+    node.params[0]=((Sphere*)object)->radius;
+  } else if(type == typeid(Plane)) {
+    node.type=PlaneNode;
+    for(i=0;i<3;i++) node.params[i]=((Plane*)object)->normal[i];
+    node.params[3]=((Plane*)object)->offset;
+  } else if(type == typeid(Cone)) node.type=ConeNode;
+  else if(type == typeid(Intersection) || type == typeid(Union) ||
+	  type == typeid(Difference) || type == typeid(Inverse)) {
+    /* The operands are compiled after this node, and listed once they
+       are all done */
+    vector<int> children;
+    int index = (int)nodes.size();
+    if(type == typeid(Inverse)) node.type = InverseNode;
+    else if(type == typeid(Union)) node.type = UnionNode;
+    else if(type == typeid(Difference)) node.type = DifferenceNode;
+    else node.type = IntersectionNode;
+    nodes.push_back(node);
+    if(node.type == InverseNode)
+      children.push_back(compileNode(((Inverse*)object)->object,toObject,toScene,material,toMaterial));
+    else {
+      vector<Object*> &childObjects = ((CSG*)object)->objects;
+      for(i=0;i<(int)childObjects.size();i++)
+	children.push_back(compileNode(childObjects[i],toObject,toScene,material,toMaterial));
+    }
+    nodes[index].first = (int)operands.size();
+    nodes[index].count = (int)children.size();
+    operands.insert(operands.end(),children.begin(),children.end());
+    return index;
+  } else node.type=VirtualNode;
+  nodes.push_back(node);
+  return (int)nodes.size()-1;
+}
+
+void SceneCompiler::finishHit(Node *node,HitRecord *hit,double origin[3],double direction[3],double distance) {
+  if(node->toScene != -1) matrices[node->toScene].transformVector(Vec3<double>(hit->normal)).store(hit->normal);
+  if(node->material) {
+    hit->material = node->material;
+    if(node->toMaterial == -1) {
+      (Vec3<double>(origin) + Vec3<double>(direction)*distance).store(hit->point);
+      return;
+    }
+    Mat4<double> *M = &matrices[node->toMaterial];
+    (M->transformPoint(Vec3<double>(origin)) + M->transformVector(Vec3<double>(direction))*distance).store(hit->point);
+  }
+}
+
+double SceneCompiler::lineTest(int index,double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  int i;
+  Node *node = &nodes[index];
+  double distance;
+
+  if(node->type == IntersectionNode || node->type == UnionNode || node->type == DifferenceNode) {
+    return firstBoundary(index,origin,direction,maxDistance,hit);
+  }
+  if(node->type == InverseNode) {
+    distance = lineTest(operands[node->first],origin,direction,maxDistance,hit);
+    if(hit && distance < maxDistance)
+      for(i=0;i<3;i++) hit->normal[i] = -hit->normal[i];
+    return distance;
+  }
+
+  /* All leaves start by bringing the ray into the object */
+  Vec3<double> O(origin), D(direction);
+  if(node->toObject != -1) {
+    Mat4<double> *M = &matrices[node->toObject];
+    O = M->transformPoint(O);
+    D = M->transformVector(D);
+  }
+  switch(node->type) {
+  case SphereNode: distance = Sphere::intersect(node->params[0],O.v,D.v); break;
+  case PlaneNode: distance = Plane::intersect(node->params,node->params[3],O.v,D.v,maxDistance); break;
+  case ConeNode: distance = Cone::intersect(O.v,D.v,maxDistance); break;
+  default:
+    distance = node->object->lineTest(O.v,D.v,maxDistance,hit);
+    if(hit && distance < maxDistance) finishHit(node,hit,origin,direction,distance);
+    return distance;
+  }
+  if(hit && distance < maxDistance) primitiveHit(node,hit,O,D,origin,direction,distance);
+  return distance;
+}
+
+double SceneCompiler::firstBoundary(int index,double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  int i;
+  double O[3], offset=0.0, distance;
+  SpanList spans;
+  /* Same as CSG::firstBoundary */
+  assign(origin,O);
+  for(;;) {
+    getSpans(index,O,direction,maxDistance-offset,&spans,hit != NULL);
+    distance = spans.first(hit);
+    if(distance != MAX_DISTANCE || !spans.isTruncated()) break;
+    offset += spans.limit;
+    for(i=0;i<3;i++) O[i] = origin[i]+offset*direction[i];
+  }
+  if(distance == MAX_DISTANCE) return distance;
+  if(hit) hit->distance += offset;
+  return distance+offset;
+}
+
+void SceneCompiler::primitiveHit(Node *node,HitRecord *hit,Vec3<double> &O,Vec3<double> &D,
+				 double origin[3],double direction[3],double distance) {
+  /* Same as Object::fillHitRecord followed by getNormal of the
+     primitive */
+  Vec3<double> point = O + D*distance;
+  hit->distance = distance;
+  hit->object = node->object;
+  hit->material = node->object;
+  point.store(hit->point);
+  switch(node->type) {
+  case SphereNode: point.store(hit->normal); break;
+  case PlaneNode: Vec3<double>(node->params).store(hit->normal); break;
+  default: Vec3<double>(2*point[0],2*point[1],-2*point[2]).store(hit->normal); break;
+  }
+  finishHit(node,hit,origin,direction,distance);
+}
+
+void SceneCompiler::getSpans(int index,double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i, j, count=0;
+  Node *node = &nodes[index];
+  double enter[2], exit[2];
+  SpanList childSpans;
+
+  switch(node->type) {
+  case IntersectionNode:
+  case UnionNode:
+  case DifferenceNode:
+    /* Same merging as in the getSpans functions of the CSG classes */
+    if(node->count == 0) { spans->clear(maxDistance,fillHits); return; }
+    getSpans(operands[node->first],origin,direction,maxDistance,spans,fillHits);
+    for(j=1;j<node->count;j++) {
+      if(node->type != UnionNode && spans->count == 0) return;
+      getSpans(operands[node->first+j],origin,direction,maxDistance,&childSpans,fillHits);
+      if(node->type == DifferenceNode) SpanList::complement(&childSpans,&childSpans);
+      SpanList::combine(spans,&childSpans,node->type == UnionNode,spans);
+    }
+    return;
+  case InverseNode:
+    getSpans(operands[node->first],origin,direction,maxDistance,spans,fillHits);
+    SpanList::complement(spans,spans);
+    return;
+  }
+
+  Vec3<double> O(origin), D(direction);
+  if(node->toObject != -1) {
+    Mat4<double> *M = &matrices[node->toObject];
+    O = M->transformPoint(O);
+    D = M->transformVector(D);
+  }
+  switch(node->type) {
+  case SphereNode: count = Sphere::span(node->params[0],O.v,D.v,enter,exit) ? 1 : 0; break;
+  case PlaneNode: count = Plane::span(node->params,node->params[3],O.v,D.v,enter,exit) ? 1 : 0; break;
+  case ConeNode: count = Cone::spans(O.v,D.v,enter,exit); break;
+  default:
+    node->object->getSpans(O.v,D.v,maxDistance,spans,fillHits);
+    if(!fillHits) return;
+    for(i=0;i<spans->count;i++) {
+      Span *span = &spans->spans[i];
+      if(span->enter != -MAX_DISTANCE) finishHit(node,&span->enterHit,origin,direction,span->enter);
+      if(span->exit != MAX_DISTANCE) finishHit(node,&span->exitHit,origin,direction,span->exit);
+    }
+    return;
+  }
+
+  spans->clear(maxDistance,fillHits);
+  for(i=0;i<count;i++) {
+    HitRecord enterHit, exitHit;
+    if(fillHits) {
+      if(enter[i] > 0.0 && enter[i] < maxDistance) primitiveHit(node,&enterHit,O,D,origin,direction,enter[i]);
+      if(exit[i] > 0.0 && exit[i] < maxDistance) primitiveHit(node,&exitHit,O,D,origin,direction,exit[i]);
+    }
+    spans->add(enter[i],fillHits ? &enterHit : NULL,exit[i],fillHits ? &exitHit : NULL);
+  }
+}
+
+void SceneCompiler::lineTestPacket(int index,RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i,j;
+  Node *node = &nodes[index];
+
+  if(node->type == IntersectionNode || node->type == UnionNode ||
+     node->type == DifferenceNode || node->type == InverseNode) {
+    /* CSG is traced one ray at a time */
+    for(i=0;i<RAY_PACKET_SIZE;i++) {
+      if(!packet->active[i]) continue;
+      double origin[3], direction[3];
+      for(j=0;j<3;j++) {
+	origin[j] = packet->origin[j][i];
+	direction[j] = packet->direction[j][i];
+      }
+      distance[i] = lineTest(index,origin,direction,maxDistance[i],hit ? &hit[i] : NULL);
+    }
+    return;
+  }
+
+  /* Leaves trace the whole packet with the SIMD version of their
+     line test, which is one virtual call per packet */
+  RayPacket newPacket;
+  RayPacket *localPacket = packet;
+  if(node->toObject != -1) {
+    Mat4<double> *M = &matrices[node->toObject];
+    M->transform(RAY_PACKET_SIZE,packet->origin[0],packet->origin[1],packet->origin[2],1.0,
+		 newPacket.origin[0],newPacket.origin[1],newPacket.origin[2]);
+    M->transform(RAY_PACKET_SIZE,packet->direction[0],packet->direction[1],packet->direction[2],0.0,
+		 newPacket.direction[0],newPacket.direction[1],newPacket.direction[2]);
+    for(i=0;i<RAY_PACKET_SIZE;i++) newPacket.active[i]=packet->active[i];
+    localPacket = &newPacket;
+  }
+  node->object->lineTestPacket(localPacket,maxDistance,distance,hit);
+  if(!hit) return;
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    if(!packet->active[i] || distance[i] >= maxDistance[i]) continue;
+    double origin[3], direction[3];
+    for(j=0;j<3;j++) {
+      origin[j] = packet->origin[j][i];
+      direction[j] = packet->direction[j][i];
+    }
+    finishHit(node,&hit[i],origin,direction,distance[i]);
+  }
+}
+
+bool SceneCompiler::occluded(int index,double origin[3],double direction[3],double maxDistance) {
+  int i, j;
+  Node *node = &nodes[index];
+  if(node->type == IntersectionNode || node->type == DifferenceNode) {
+    /* The early outs of Intersection::occluded and
+       Difference::occluded, which only look at the first operand of
+       a difference */
+    double nudged[3];
+    bool anyCrossed = false;
+    int n = node->type == IntersectionNode ? node->count : MIN(node->count,1);
+    if(node->count == 0) return false;
+    for(i=0;i<3;i++) nudged[i] = origin[i]+1e-5*direction[i];
+    for(j=0;j<n;j++) {
+      int operand = operands[node->first+j];
+      if(occluded(operand,origin,direction,maxDistance)) anyCrossed = true;
+      else if(!isInside(operand,origin) && !isInside(operand,nudged)) return false;
+    }
+    if(node->type == IntersectionNode) {
+      for(j=0;j<n && isInside(operands[node->first+j],origin);j++) ;
+      if(j == n) return anyCrossed;
+    }
+  }
+  if(node->type == IntersectionNode || node->type == UnionNode || node->type == DifferenceNode) {
+    return firstBoundary(index,origin,direction,maxDistance,NULL) < maxDistance;
+  }
+  if(node->type == InverseNode) return occluded(operands[node->first],origin,direction,maxDistance);
+
+  Vec3<double> O(origin), D(direction);
+  if(node->toObject != -1) {
+    Mat4<double> *M = &matrices[node->toObject];
+    O = M->transformPoint(O);
+    D = M->transformVector(D);
+  }
+  switch(node->type) {
+  case SphereNode: return Sphere::occludes(node->params[0],O.v,D.v,maxDistance);
+  case PlaneNode: return Plane::intersect(node->params,node->params[3],O.v,D.v,maxDistance) < maxDistance;
+  case ConeNode: return Cone::intersect(O.v,D.v,maxDistance) < maxDistance;
+  default: return node->object->occluded(O.v,D.v,maxDistance);
+  }
+}
+
+bool SceneCompiler::isInside(int index,double point[3]) {
+  int j;
+  Node *node = &nodes[index];
+  switch(node->type) {
+  case IntersectionNode:
+    for(j=0;j<node->count;j++)
+      if(!isInside(operands[node->first+j],point)) return false;
+    return true;
+  case UnionNode:
+    for(j=0;j<node->count;j++)
+      if(isInside(operands[node->first+j],point)) return true;
+    return false;
+  case DifferenceNode:
+    for(j=0;j<node->count;j++)
+      if(isInside(operands[node->first+j],point) != (j == 0)) return false;
+    return node->count > 0;
+  case InverseNode: return !isInside(operands[node->first],point);
+  }
+
+  Vec3<double> P(point);
+  if(node->toObject != -1) P = matrices[node->toObject].transformPoint(P);
+  switch(node->type) {
+  case SphereNode: return Sphere::inside(node->params[0],P.v);
+  case PlaneNode: return Plane::inside(node->params,node->params[3],P.v);
+  case ConeNode: return Cone::inside(P.v);
+  default: return node->object->isInside(P.v);
+  }
+}
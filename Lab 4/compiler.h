@@ -0,0 +1,146 @@
+/** \file compiler.h
+    \brief Declares the SceneCompiler class, which flattens the graph
+    of objects into arrays that are traced without virtual calls.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	COMPILER_H_
+# define   	COMPILER_H_
+
+#ifndef OBJECT_H_
+#include "object.h"
+#endif
+
+#include <vector>
+
+class SceneCompiler;
+
+/** \brief Takes the place of an object of the scene once it has been
+    compiled, tracing it using the SceneCompiler.
+
+    Everything needed while tracing rays (line tests, shadow feelers
+    and inside tests) is done by the compiled kernel. The remaining
+    functions are passed on to the original object. */
+class CompiledObject : public Object {
+ public:
+  CompiledObject(SceneCompiler *compiler,int root,Object *original);
+  ~CompiledObject();
+
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  void lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getNormal(double point[3],double normal[3]);
+  bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
+  void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
+
+ private:
+  SceneCompiler *compiler;
+  /** Index of the node of the compiled object */
+  int root;
+  Object *original;
+};
+
+/** \brief Compiles the scene into flat arrays traced by a switch
+    based kernel.
+
+    Following the pointers of the object graph (eg. Transform to
+    Intersection to Transform to Cone) costs a virtual call and a cache
+    miss for every node. The compiler lowers every object into a
+    contiguous array of nodes. Nested transforms are folded into a
+    single pair of matrices for every primitive. The CSG objects become
+    nodes listing their operands. The kernel traces the
+    nodes with a switch on the node type and calls the inline line
+    tests of Sphere, Plane and Cone directly.
+
+    Objects of any other class, including subclasses of the known
+    classes, become virtual nodes that are traced through their
+    virtual functions, as before. The same goes for the debugged
+    pixel, so that the debug output is not lost.
+
+    The matrices are copied when compiling, so the scene must be
+    compiled again after any change to it, which is done by
+    Raytracer::prepareFrame. */
+class SceneCompiler {
+ public:
+  SceneCompiler();
+  ~SceneCompiler();
+
+  /** Compiles the given objects, replacing the previous compilation */
+  void compile(std::set<Object*> *objects);
+  /** Gives the objects to trace in place of the compiled objects. The
+      set contains a CompiledObject for every compiled object, and
+      the objects that could not be compiled at all. */
+  std::set<Object*> *getObjects();
+  /** Number of bytes used by the nodes, matrices and operand lists */
+  int getMemoryUsage();
+
+  /* The kernel. Same as the Object functions, for the compiled
+     object starting at the given node. */
+  double lineTest(int node,double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  void lineTestPacket(int node,RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  bool occluded(int node,double origin[3],double direction[3],double maxDistance);
+  bool isInside(int node,double point[3]);
+  void getSpans(int node,double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
+
+ private:
+  enum NodeType { SphereNode, PlaneNode, ConeNode, IntersectionNode, UnionNode, DifferenceNode, InverseNode, VirtualNode };
+
+  /** A node of a compiled object. Leaves are primitives and virtual
+      nodes, CSG nodes list their operands. */
+  typedef struct {
+    int type;
+    /** Leaves: index of the matrix from the coordinate system of the
+	rays to that of the object (toObject) and of the matrix for
+	bringing normals back (toScene). -1 for the identity. */
+    int toObject, toScene;
+    /** Operands of CSG nodes are operands[first .. first+count-1] */
+    int first, count;
+    /** Material of a Transform above the leaf that overrides its own
+	material, or NULL. The material is evaluated in the coordinate
+	system given by the matrix toMaterial. */
+    Material *material;
+    int toMaterial;
+    /** The original object */
+    Object *object;
+    /** Radius of spheres, normal and offset of planes */
+    double params[4];
+  } Node;
+
+  int compileNode(Object *object,int toObject,int toScene,Material *material,int toMaterial);
+  int addMatrix(Mat4<double> *matrix);
+  /** Brings a hit record of a leaf, for a hit at distance along the
+      given ray, into the coordinate system of the ray */
+  void finishHit(Node *node,HitRecord *hit,double origin[3],double direction[3],double distance);
+  /** Fills in the hit record of a primitive, for a hit at distance
+      along the ray O,D in its own coordinate system */
+  void primitiveHit(Node *node,HitRecord *hit,Vec3<double> &O,Vec3<double> &D,
+		    double origin[3],double direction[3],double distance);
+  /** The line test of CSG nodes, see CSG::firstBoundary */
+  double firstBoundary(int node,double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+
+  std::vector<Node> nodes;
+  std::vector<Mat4<double> > matrices;
+  std::vector<int> operands;
+
+  std::vector<CompiledObject*> compiledObjects;
+  std::set<Object*> objects;
+};
+
+#endif 	    /* !COMPILER_H_ */
@@ -9,22 +9,11 @@ Cone::~Cone()
 
 }
 
-double Cone::lineTest(double origin[3], double direction[3], double maxDistance)
+double Cone::lineTest(double origin[3], double direction[3], double maxDistance, HitRecord *hit)
 {
-	double a = pow(direction[0], 2) + pow(direction[1], 2) - pow(direction[2], 2);
-	double b = 2 * (origin[0] * direction[0] + origin[1] * direction[1] - origin[2] * direction[2]);
-	double c = pow(origin[0], 2) + pow(origin[1], 2) - pow(origin[2], 2);
-
-	double discriminant = pow(b, 2) - (4 * a * c);
-	if (discriminant >= 0)
-	{
-		double s = sqrt(discriminant);
-		double sol1 = (-b - s) / (2 * a);
-		if (sol1 > 0 && sol1 <= maxDistance && (origin[2] + sol1 * direction[2]) > 0) return sol1;
-		double sol2 = (-b + s) / (2 * a);
-		if (sol2 > 0 && sol2 <= maxDistance && (origin[2] + sol2 * direction[2]) > 0) return sol2;
-	}
-	return maxDistance;
+	double result = intersect(origin, direction, maxDistance);
+	if (hit && result < maxDistance) fillHitRecord(hit, origin, direction, result);
+	return result;
 
 	/*double alpha = pow(b, 2) - (4 * a * c);
 	if (alpha < 0)
@@ -54,6 +43,15 @@ double Cone::lineTest(double origin[3], double direction[3], double maxDistance)
 	return maxDistance;*/
 }
 
+void Cone::getSpans(double origin[3], double direction[3], double maxDistance, SpanList *spans, bool fillHits)
+{
+	double enter[2], exit[2];
+	int count = Cone::spans(origin, direction, enter, exit);
+	spans->clear(maxDistance,fillHits);
+	for (int i = 0; i < count; i++)
+		addSpan(spans, enter[i], exit[i], origin, direction, fillHits);
+}
+
 void Cone::getNormal(double point[3], double normal[3])
 {
 	double gradient[3] = { 2 * point[0], 2 * point[1], -2 * point[2] };
@@ -62,8 +60,45 @@ void Cone::getNormal(double point[3], double normal[3])
 
 bool Cone::isInside(double point[3])
 {
-	//return pow(point[0], 2) + pow(point[1], 2) - pow(point[2], 2) <= 0 && point[2] <= 0;
-	if (point[2] <= 0)
-		return false;
-	return point[0] * point[0] + point[1] * point[1] - point[2] * point[2] <= 0;
-}
\ No newline at end of file
+	return inside(point);
+}
+
+void Cone::getBounds(double min[3], double max[3])
+{
+	/* Only the part of the cone with z > 0 is inside, and there the
+	   radius is equal to z. */
+	min[2] = MAX(min[2], 0.0);
+	if (max[2] < min[2])
+		return;
+	for (int i = 0; i < 2; i++)
+	{
+		min[i] = MAX(min[i], -max[2]);
+		max[i] = MIN(max[i], max[2]);
+	}
+}
+
+void Cone::lineTestPacket(RayPacket *packet, double maxDistance[], double distance[], HitRecord hit[])
+{
+	/* Same computations as in lineTest, but without branches so that
+	   all rays are handled by SIMD instructions in parallel. */
+	for (int i = 0; i < RAY_PACKET_SIZE; i++)
+	{
+		double Ox = packet->origin[0][i], Oy = packet->origin[1][i], Oz = packet->origin[2][i];
+		double Dx = packet->direction[0][i], Dy = packet->direction[1][i], Dz = packet->direction[2][i];
+		double a = Dx * Dx + Dy * Dy - Dz * Dz;
+		double b = 2 * (Ox * Dx + Oy * Dy - Oz * Dz);
+		double c = Ox * Ox + Oy * Oy - Oz * Oz;
+		double discriminant = b * b - (4 * a * c);
+		double s = sqrt(discriminant < 0 ? 0.0 : discriminant);
+		double sol1 = (-b - s) / (2 * a);
+		double sol2 = (-b + s) / (2 * a);
+		bool hit1 = sol1 > 0 && sol1 <= maxDistance[i] && (Oz + sol1 * Dz) > 0;
+		bool hit2 = sol2 > 0 && sol2 <= maxDistance[i] && (Oz + sol2 * Dz) > 0;
+		double result = hit1 ? sol1 : (hit2 ? sol2 : maxDistance[i]);
+		if (discriminant < 0)
+			result = maxDistance[i];
+		distance[i] = packet->active[i] ? result : distance[i];
+	}
+	if (hit)
+		fillHitRecords(packet, maxDistance, distance, hit);
+}
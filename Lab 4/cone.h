@@ -7,8 +7,86 @@ class Cone :
 public:
 	Cone();
 	~Cone();
-	double lineTest(double origin[3], double direction[3], double maxDistance);
+	double lineTest(double origin[3], double direction[3], double maxDistance, HitRecord *hit);
+	void getSpans(double origin[3], double direction[3], double maxDistance, SpanList *spans, bool fillHits);
+	void lineTestPacket(RayPacket *packet, double maxDistance[], double distance[], HitRecord hit[]);
 	void getNormal(double point[3], double normal[3]);
 	bool isInside(double point[3]);
+	void getBounds(double min[3], double max[3]);
+
+	/** Line test of the cone, without filling in any hit record.
+	    Returns maxDistance if there is no intersection. Also used by
+	    the SceneCompiler kernel. */
+	static double intersect(double origin[3], double direction[3], double maxDistance)
+	{
+		double a = pow(direction[0], 2) + pow(direction[1], 2) - pow(direction[2], 2);
+		double b = 2 * (origin[0] * direction[0] + origin[1] * direction[1] - origin[2] * direction[2]);
+		double c = pow(origin[0], 2) + pow(origin[1], 2) - pow(origin[2], 2);
+
+		double discriminant = pow(b, 2) - (4 * a * c);
+		if (discriminant < 0)
+			return maxDistance;
+		double s = sqrt(discriminant);
+		double sol1 = (-b - s) / (2 * a);
+		double sol2 = (-b + s) / (2 * a);
+		if (sol1 > 0 && sol1 <= maxDistance && (origin[2] + sol1 * direction[2]) > 0) return sol1;
+		if (sol2 > 0 && sol2 <= maxDistance && (origin[2] + sol2 * direction[2]) > 0) return sol2;
+		return maxDistance;
+	}
+	/** Assigns to enter[i] and exit[i] the parts of the ray that are
+	    inside the cone and returns their number, at most two. Unbounded
+	    parts start at -MAX_DISTANCE or end at MAX_DISTANCE. */
+	static int spans(double origin[3], double direction[3], double enter[2], double exit[2])
+	{
+		double a = direction[0] * direction[0] + direction[1] * direction[1] - direction[2] * direction[2];
+		double b = 2 * (origin[0] * direction[0] + origin[1] * direction[1] - origin[2] * direction[2]);
+		double c = origin[0] * origin[0] + origin[1] * origin[1] - origin[2] * origin[2];
+		double roots[4];
+		int nRoots = 0, count = 0;
+
+		/* The surface can only be crossed where the ray meets the
+		   double cone, and only the crossings with z > 0 belong to
+		   this cone */
+		double candidates[2];
+		int nCandidates = 0;
+		if (a == 0.0) {
+			if (b != 0.0) candidates[nCandidates++] = -c / b;
+		}
+		else {
+			double discriminant = b * b - 4 * a * c;
+			if (discriminant >= 0) {
+				double s = sqrt(discriminant);
+				double sol1 = (-b - s) / (2 * a), sol2 = (-b + s) / (2 * a);
+				candidates[nCandidates++] = sol1 < sol2 ? sol1 : sol2;
+				candidates[nCandidates++] = sol1 < sol2 ? sol2 : sol1;
+			}
+		}
+		roots[nRoots++] = -MAX_DISTANCE;
+		for (int i = 0; i < nCandidates; i++)
+			if (origin[2] + candidates[i] * direction[2] > 0) roots[nRoots++] = candidates[i];
+		roots[nRoots++] = MAX_DISTANCE;
+		/* Inside or outside is decided by any point between two
+		   crossings */
+		for (int i = 0; i + 1 < nRoots; i++)
+		{
+			double t0 = roots[i], t1 = roots[i + 1], middle;
+			if (nRoots == 2) middle = 0.0;
+			else if (i == 0) middle = t1 - 1.0;
+			else if (i == nRoots - 2) middle = t0 + 1.0;
+			else middle = 0.5 * (t0 + t1);
+			double point[3] = { origin[0] + middle * direction[0], origin[1] + middle * direction[1], origin[2] + middle * direction[2] };
+			if (!inside(point)) continue;
+			if (count > 0 && exit[count - 1] == t0) exit[count - 1] = t1;
+			else { enter[count] = t0; exit[count] = t1; count++; }
+		}
+		return count;
+	}
+	static bool inside(double point[3])
+	{
+		//return pow(point[0], 2) + pow(point[1], 2) - pow(point[2], 2) <= 0 && point[2] <= 0;
+		if (point[2] <= 0)
+			return false;
+		return point[0] * point[0] + point[1] * point[1] - point[2] * point[2] <= 0;
+	}
 };
 
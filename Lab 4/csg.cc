@@ -23,132 +23,250 @@
 
 #include "general.h"
 #include "csg.h"
-#include <omp.h>
 
 using namespace std;
 
-Intersection::Intersection() {
-  objects = new std::set<Object*>();
-  for(int i=0;i<MAX_OMP_THREADS;i++) lastObject[i] = NULL;
-}
-Intersection::~Intersection() {
-  set<Object*>::iterator objIterator;
-  set<Object*>::iterator objIteratorEnd;
-  for(objIterator=objects->begin(),objIteratorEnd=objects->end();
-      objIterator != objIteratorEnd;objIterator++) {
-    (*objIterator)->dereference();
-  }
+CSG::CSG() {}
+CSG::~CSG() {
+  int i;
+  for(i=0;i<(int)objects.size();i++) objects[i]->dereference();
 }
-void Intersection::addObject(Object *object) {
+void CSG::addObject(Object *object) {
   object->reference();
-  objects->insert(object);
+  objects.push_back(object);
 }
 
-double Intersection::lineTest(double O1[3],double dir[3],double maxDistance) {
-  int i;
-  bool findOutsides;
-  double O[3],point[3];
-  double dist, progress, offset;
-  set<Object*>::iterator objIterator;
-  set<Object*>::iterator objIteratorEnd;
+double CSG::lineTest(double origin[3],double dir[3],double maxDistance,HitRecord *hit) {
+  SpanList spans;
 
   /*  This is just to illustrate how you can debug your linetest functions */
   if(debugThisPixel) {
     printDebugIndentation(); 
-    printf("-> Intersection::lineTest\n");
+    printf("-> CSG::lineTest\n");
     debugIndentation++;
   }
 
-  findOutsides = isInside(O1);
-  assign(O1,O);
-  offset=0.0;
-  while(1) {
-    progress = maxDistance;
-    dist = maxDistance;
-
-    for(objIterator=objects->begin(),objIteratorEnd=objects->end();
-	objIterator != objIteratorEnd;objIterator++) {
-      double thisDist = (*objIterator)->lineTest(O,dir,maxDistance);
-      if(thisDist >= maxDistance) continue;
-      if(thisDist < progress) progress = thisDist + 1e-5;
-      for(i=0;i<3;i++) point[i] = O[i]+(thisDist+1e-3)*dir[i];
-      if(thisDist < dist && (isInside(point) ^ findOutsides)) {
-	dist = thisDist;
-	lastObject[omp_get_thread_num()] = *objIterator;
-      }
-    }  
-    if(dist < maxDistance) 
-      /* Found closest point inside all objects */
-      break; 
-    else if(progress >= maxDistance) {
-      /* no intersection with any points found */
-      if(debugThisPixel) { debugIndentation--; printDebugIndentation(); printf("<- miss (1)\n"); }      
-      return MAX_DISTANCE;
-    }
-    else {
-      /* If no line intersection that satisfied the inside test was
-      found, we have to try again from a new vantage point to find the
-      next set of solutions for each object, if it exists. */
-      if(progress < 1e-5) {
-	printf("ERROR\n"); exit(0);
-      }
-      for(i=0;i<3;i++) O[i] += progress*dir[i];      
-      offset += progress;
-      maxDistance -= progress;
-      if(maxDistance < 0.0) 
-	/* We have progresses too far ahead, intersections no longer
-	   interesting */
-	if(debugThisPixel) { debugIndentation--; printDebugIndentation(); printf("<- miss (2)\n"); }
-	return MAX_DISTANCE;
-    }
-  }
+  /* The ray hits the surface where it first enters or leaves the
+     combined object */
+  double distance = firstBoundary(origin,dir,maxDistance,&spans,hit);
 
   if(debugThisPixel) {
     debugIndentation--; printDebugIndentation(); 
-    printf("<- %3.2f\n",dist+offset);
+    if(distance < maxDistance) printf("<- %3.2f (%d spans)\n",distance,spans.count);
+    else printf("<- miss\n");
   }
+  return distance;
+}
 
-  return dist + offset;
+bool CSG::occluded(double origin[3],double direction[3],double maxDistance) {
+  SpanList spans;
+  return firstBoundary(origin,direction,maxDistance,&spans,NULL) < maxDistance;
 }
 
-void Intersection::getNormal(double point[3],double normal[3]) {
-  /* Simplifying assumption, this function is only called after a
-  successfull lineintersection test. Otherwise we would have to
-  compute which object is actually the limiting object at this point.
-  This is a lot faster than the alternative to compute the correct
-  intersecting point, but it is not correct when running with multiple
-  threads and not even with a single thread and some special scene
-  graphs. */
-  lastObject[omp_get_thread_num()]->getNormal(point,normal);
+double CSG::firstBoundary(double origin[3],double direction[3],double maxDistance,SpanList *spans,HitRecord *hit) {
+  int i;
+  double O[3], offset=0.0, distance;
+  /* A truncated list without a boundary says nothing about the rest
+     of the ray, which is followed further from where the list stops */
+  assign(origin,O);
+  for(;;) {
+    getSpans(O,direction,maxDistance-offset,spans,hit != NULL);
+    distance = spans->first(hit);
+    if(distance != MAX_DISTANCE || !spans->isTruncated()) break;
+    offset += spans->limit;
+    for(i=0;i<3;i++) O[i] = origin[i]+offset*direction[i];
+  }
+  if(distance == MAX_DISTANCE) return distance;
+  if(hit) hit->distance += offset;
+  return distance+offset;
+}
+
+Object *CSG::getSurfaceObject(double point[3]) {
+  int i, j;
+  double normal[3], below[3], above[3];
+  /* The point lies on the surface of a child if stepping a small
+     distance along the normal of that child takes us from its inside
+     to its outside. */
+  for(j=0;j<(int)objects.size();j++) {
+    objects[j]->getNormal(point,normal);
+    normalize(normal);
+    for(i=0;i<3;i++) {
+      below[i] = point[i]-1e-4*normal[i];
+      above[i] = point[i]+1e-4*normal[i];
+    }
+    if(objects[j]->isInside(below) != objects[j]->isInside(above)) return objects[j];
+  }
+  return objects.empty() ? NULL : objects[0];
+}
+
+void CSG::getNormal(double point[3],double normal[3]) {
+  /* Note that the raytracer uses the normal given by the hit record
+     of lineTest instead, which is both faster and exact. */
+  Object *surface = getSurfaceObject(point);
+  if(surface) surface->getNormal(point,normal);
+  else zero(normal);
+}
+
+void CSG::prepare() {
+  int i;
+  for(i=0;i<(int)objects.size();i++) objects[i]->prepare();
+}
+
+void CSG::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
+  Object *surface = getSurfaceObject(point);
+  if(surface) surface->getLightingProperties(point,props,normal);
+  else Object::getLightingProperties(point,props,normal);
+}
+
+bool Intersection::occluded(double origin[3],double direction[3],double maxDistance) {
+  int i, j;
+  double nudged[3];
+  bool anyCrossed = false;
+
+  /* A child whose surface is not crossed by the ray keeps the whole
+     ray either inside or outside of it. If outside, the ray can never
+     enter the intersection. Rays often start exactly on the surface
+     of a child, so a point slightly along the ray must also be
+     outside before we can be sure. If we start inside all children,
+     crossing any of their surfaces means leaving the intersection.
+     Only the remaining cases need the spans. */
+  if(objects.empty()) return false;
+  for(i=0;i<3;i++) nudged[i] = origin[i]+1e-5*direction[i];
+  for(j=0;j<(int)objects.size();j++) {
+    if(objects[j]->occluded(origin,direction,maxDistance)) anyCrossed = true;
+    else if(!objects[j]->isInside(origin) && !objects[j]->isInside(nudged)) return false;
+  }
+  for(j=0;j<(int)objects.size() && objects[j]->isInside(origin);j++) ;
+  if(j == (int)objects.size()) return anyCrossed;
+  return CSG::occluded(origin,direction,maxDistance);
+}
+
+void Intersection::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i;
+  SpanList childSpans;
+  if(objects.empty()) { spans->clear(maxDistance,fillHits); return; }
+  objects[0]->getSpans(origin,direction,maxDistance,spans,fillHits);
+  /* Nothing can be added back once the intersection is empty */
+  for(i=1;i<(int)objects.size() && spans->count > 0;i++) {
+    objects[i]->getSpans(origin,direction,maxDistance,&childSpans,fillHits);
+    SpanList::combine(spans,&childSpans,false,spans);
+  }
 }
 
 bool Intersection::isInside(double point[3]) {
   /* Iterate over all objects, return true if we are inside all of
      them */
-  set<Object*>::iterator objIterator;
-  set<Object*>::iterator objIteratorEnd;
-  for(objIterator=objects->begin(),objIteratorEnd=objects->end();
-      objIterator != objIteratorEnd;objIterator++) {
-    if(!(*objIterator)->isInside(point)) return false;
-  }  
+  int i;
+  for(i=0;i<(int)objects.size();i++)
+    if(!objects[i]->isInside(point)) return false;
+  return true;
+}
+
+void Intersection::getBounds(double min[3],double max[3]) {
+  int pass, i;
+  /* Every child only needs to enclose the part of the box that the
+     other children left, so shrink the box with each of them in
+     turn. A second pass lets children whose bounds depend on the box
+     (eg. cones) benefit from what the later children removed. */
+  for(pass=0;pass<2;pass++)
+    for(i=0;i<(int)objects.size();i++)
+      objects[i]->getBounds(min,max);
+}
+
+void Union::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i;
+  SpanList childSpans;
+  if(objects.empty()) { spans->clear(maxDistance,fillHits); return; }
+  objects[0]->getSpans(origin,direction,maxDistance,spans,fillHits);
+  for(i=1;i<(int)objects.size();i++) {
+    objects[i]->getSpans(origin,direction,maxDistance,&childSpans,fillHits);
+    SpanList::combine(spans,&childSpans,true,spans);
+  }
+}
+
+bool Union::isInside(double point[3]) {
+  int i;
+  for(i=0;i<(int)objects.size();i++)
+    if(objects[i]->isInside(point)) return true;
+  return false;
+}
+
+void Union::getBounds(double min[3],double max[3]) {
+  int i, j;
+  double unionMin[3]={0.0,0.0,0.0}, unionMax[3]={0.0,0.0,0.0};
+  bool empty = true;
+  /* Every child shrinks its own copy of the box, the result is the
+     box around everything that is left */
+  for(i=0;i<(int)objects.size();i++) {
+    double childMin[3], childMax[3];
+    assign(min,childMin);
+    assign(max,childMax);
+    objects[i]->getBounds(childMin,childMax);
+    if(childMin[0] > childMax[0] || childMin[1] > childMax[1] || childMin[2] > childMax[2]) continue;
+    for(j=0;j<3;j++) {
+      unionMin[j] = empty ? childMin[j] : MIN(unionMin[j],childMin[j]);
+      unionMax[j] = empty ? childMax[j] : MAX(unionMax[j],childMax[j]);
+    }
+    empty = false;
+  }
+  if(empty) { max[0] = min[0] - 1.0; return; }
+  assign(unionMin,min);
+  assign(unionMax,max);
+}
+
+bool Difference::occluded(double origin[3],double direction[3],double maxDistance) {
+  int i;
+  double nudged[3];
+  /* Everything lies inside the first child, so a ray that stays
+     outside of it, as in Intersection::occluded, crosses nothing */
+  if(objects.empty()) return false;
+  for(i=0;i<3;i++) nudged[i] = origin[i]+1e-5*direction[i];
+  if(!objects[0]->occluded(origin,direction,maxDistance) &&
+     !objects[0]->isInside(origin) && !objects[0]->isInside(nudged)) return false;
+  return CSG::occluded(origin,direction,maxDistance);
+}
+
+void Difference::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i;
+  SpanList childSpans;
+  if(objects.empty()) { spans->clear(maxDistance,fillHits); return; }
+  objects[0]->getSpans(origin,direction,maxDistance,spans,fillHits);
+  /* Intersect with the outside of every other child */
+  for(i=1;i<(int)objects.size() && spans->count > 0;i++) {
+    objects[i]->getSpans(origin,direction,maxDistance,&childSpans,fillHits);
+    SpanList::complement(&childSpans,&childSpans);
+    SpanList::combine(spans,&childSpans,false,spans);
+  }
+}
+
+bool Difference::isInside(double point[3]) {
+  int i;
+  if(objects.empty() || !objects[0]->isInside(point)) return false;
+  for(i=1;i<(int)objects.size();i++)
+    if(objects[i]->isInside(point)) return false;
   return true;
 }
 
-void Intersection::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
-  /* Simplifying assumption, this function is only called after a
-  successfull lineintersection test. Otherwise we would have to
-  compute which object is actually the limiting object at this point.
-  This is a lot faster than the alternative to compute the correct
-  intersecting point, but it is not correct when running with multiple
-  threads and not even with a single thread and some special scene
-  graphs. */
-  lastObject[omp_get_thread_num()]->getLightingProperties(point,props,normal);
+void Difference::getBounds(double min[3],double max[3]) {
+  /* Removing the other children can only make the first one smaller */
+  if(!objects.empty()) objects[0]->getBounds(min,max);
 }
 
 Inverse::Inverse(Object *o) { object=o; o->reference(); }
 Inverse::~Inverse() { object->dereference(); }
-double Inverse::lineTest(double origin[3],double direction[3],double maxDistance) {
-  return object->lineTest(origin,direction,maxDistance);
+double Inverse::lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  int i;
+  double distance = object->lineTest(origin,direction,maxDistance,hit);
+  if(hit && distance < maxDistance)
+    for(i=0;i<3;i++) hit->normal[i] = -hit->normal[i];
+  return distance;
+}
+bool Inverse::occluded(double origin[3],double direction[3],double maxDistance) {
+  return object->occluded(origin,direction,maxDistance);
+}
+void Inverse::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  object->getSpans(origin,direction,maxDistance,spans,fillHits);
+  SpanList::complement(spans,spans);
 }
 void Inverse::getNormal(double point[3],double normal[3]) {
   int i;
@@ -158,6 +276,7 @@ void Inverse::getNormal(double point[3],double normal[3]) {
 bool Inverse::isInside(double point[3]) {
   return !object->isInside(point);
 }
+void Inverse::prepare() { object->prepare(); }
 void Inverse::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
   int i;
 
@@ -1,5 +1,6 @@
 /** \file csg.h
-    \brief Declares all methods for all CSG classes (Intersection, Inverse)
+    \brief Declares all methods for all CSG classes (Intersection,
+    Union, Difference, Inverse)
  */
 /* Made by Mathias Broxvall 
 
@@ -28,29 +29,77 @@
 #include "object.h"
 #endif
 
+#include <vector>
+
+/** \brief Common base of the CSG objects combining several child
+    objects.
+
+    The children give the intervals of a ray that lie inside of them
+    (see Object::getSpans), which are merged by the getSpans function
+    of the subclass. The first boundary of the merged spans is the
+    result of the line test, with the hit record of the child whose
+    surface it is. */
+class CSG : public Object {
+ public:
+  CSG();
+  ~CSG();
+  void addObject(Object *);
+
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getNormal(double point[3],double normal[3]);
+  void prepare();
+
+  void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
+
+ protected:
+  /** Finds the child on whose surface the given point lies, NULL if
+      there are no children */
+  Object *getSurfaceObject(double point[3]);
+  /** Finds the first boundary of the spans of the ray like
+      SpanList::first, and follows the ray on past the limit of
+      truncated lists. spans is left with the last part examined. */
+  double firstBoundary(double origin[3],double direction[3],double maxDistance,SpanList *spans,HitRecord *hit);
+
+  friend class SceneCompiler;
+  /** The children, in the order they were added */
+  std::vector<Object*> objects;
+};
+
 /** \brief Creates new objects as the intersection of multiple child
     objects. 
 
     This is one of the basic CSG building blocks of more complex
-    geometry. In this current implementation it is done in a generic,
-    but inefficeint manner. More efficient code can be made using
-    harder restrictions on the contained child objects.  */
-class Intersection : public Object {
+    geometry. */
+class Intersection : public CSG {
  public:
-  Intersection();
-  ~Intersection();
-  void addObject(Object *);
-  
-  double lineTest(double origin[3],double direction[3],double maxDistance);
-  void getNormal(double point[3],double normal[3]);
+  /** Answers the easy cases from the children alone, before merging
+      their spans as CSG::occluded does */
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
   bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+};
 
-  void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
+/** \brief Creates new objects as the union of multiple child
+    objects. */
+class Union : public CSG {
+ public:
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
+  bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+};
 
- private:
-  class std::set<Object*> *objects;
-  /* This will hold a pointer to the last used object, saved on a per thread basis */
-  Object *lastObject[MAX_OMP_THREADS];
+/** \brief Creates new objects by removing all the other children
+    from the first child added. */
+class Difference : public CSG {
+ public:
+  /** Gives false without merging spans if the ray never gets inside
+      the first child */
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
+  bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
 };
 
 /** \brief Creates the inverse of an object by negating the
@@ -60,12 +109,16 @@ class Inverse : public Object {
   Inverse(Object *);
   ~Inverse();
 
-  double lineTest(double origin[3],double direction[3],double maxDistance);
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
   void getNormal(double point[3],double normal[3]);
   bool isInside(double point[3]);
+  void prepare();
 
   void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
  private:
+  friend class SceneCompiler;
   Object *object;
 };
 
@@ -0,0 +1,161 @@
+/** \file framebuffer.cc
+    \brief Implements the FrameBuffer class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "framebuffer.h"
+
+/* Order in which the pixels of a 4x4 block are rounded up */
+static const int bayer[4][4] = {
+  {  0,  8,  2, 10 },
+  { 12,  4, 14,  6 },
+  {  3, 11,  1,  9 },
+  { 15,  7, 13,  5 }
+};
+
+FrameBuffer::FrameBuffer() {
+  int i;
+  width=height=0;
+  exposure=1.0f;
+  curve=Clamp;
+  srgb=false;
+  setDither(false);
+  for(i=0;i<=SRGB_TABLE_SIZE;i++) {
+    double linear = i/(double)SRGB_TABLE_SIZE;
+    double encoded = linear <= 0.0031308 ? 12.92*linear : 1.055*pow(linear,1.0/2.4)-0.055;
+    srgbTable[i] = (float) (encoded*255.0);
+  }
+  srgbTable[SRGB_TABLE_SIZE+1] = srgbTable[SRGB_TABLE_SIZE];
+}
+
+void FrameBuffer::resize(int width,int height) {
+  int i;
+  this->width=width;
+  this->height=height;
+  for(i=0;i<3;i++) planes[i].assign(width*height,0.0f);
+}
+int FrameBuffer::getWidth() { return width; }
+int FrameBuffer::getHeight() { return height; }
+
+void FrameBuffer::setExposure(double exposure) { this->exposure=(float)exposure; }
+void FrameBuffer::setToneMap(ToneMap toneMap) { curve=toneMap; }
+bool FrameBuffer::setToneMap(const char *name) {
+  if(strcmp(name,"clamp") == 0) setToneMap(Clamp);
+  else if(strcmp(name,"reinhard") == 0) setToneMap(Reinhard);
+  else if(strcmp(name,"filmic") == 0) setToneMap(Filmic);
+  else return false;
+  return true;
+}
+void FrameBuffer::setSRGB(bool enabled) { srgb=enabled; }
+void FrameBuffer::setDither(bool enabled) {
+  int i, j;
+  /* Threshold in the middle of each of the 16 steps, which averages
+     to rounding to the closest value */
+  for(i=0;i<4;i++)
+    for(j=0;j<4;j++) dither[i][j] = enabled ? (bayer[i][j]+0.5f)/16.0f : 0.0f;
+}
+
+/* Every curve is its own loop without branches, written with
+   comparisons that the compiler turns into SIMD min and max */
+void FrameBuffer::toneMap(const float *source,float *values,int n) {
+  int i;
+  float e = exposure;
+  switch(curve) {
+  case Clamp:
+    for(i=0;i<n;i++) {
+      float v = source[i]*e;
+      v = v < 1.0f ? v : 1.0f;
+      values[i] = v > 0.0f ? v : 0.0f;
+    }
+    break;
+  case Reinhard:
+    for(i=0;i<n;i++) {
+      float v = source[i]*e;
+      v = v > 0.0f ? v : 0.0f;
+      v = v/(1.0f+v);
+      /* Also catches infinite colours, which give NaN */
+      values[i] = v < 1.0f ? v : 1.0f;
+    }
+    break;
+  case Filmic:
+    /* The fit of the ACES filmic curve by Krzysztof Narkowicz */
+    for(i=0;i<n;i++) {
+      float v = source[i]*e;
+      v = v > 0.0f ? v : 0.0f;
+      v = (v*(2.51f*v+0.03f))/(v*(2.43f*v+0.59f)+0.14f);
+      values[i] = v < 1.0f ? v : 1.0f;
+    }
+    break;
+  }
+}
+
+void FrameBuffer::encode(float *values,int n) {
+  int i;
+  if(!srgb) {
+    for(i=0;i<n;i++) values[i] *= 255.0f;
+    return;
+  }
+  for(i=0;i<n;i++) {
+    float t = values[i]*SRGB_TABLE_SIZE;
+    int j = (int) t;
+    values[i] = srgbTable[j] + (t-j)*(srgbTable[j+1]-srgbTable[j]);
+  }
+}
+
+/* Works on RESOLVE_CHUNK pixels at a time, which fit in the first
+   level cache together with their source and destination. Narrow
+   regions, like the tiles of the renderer, are handled several rows
+   at a time so that the loops still run over many pixels. */
+void FrameBuffer::resolve(SDL_Surface *surface,int x0,int y0,int x1,int y1) {
+  int x, y, i, j, c, n;
+  float values[3][RESOLVE_CHUNK], offsets[RESOLVE_CHUNK];
+  Uint32 pixels[RESOLVE_CHUNK];
+  SDL_PixelFormat *format = surface->format;
+  int rShift=format->Rshift, gShift=format->Gshift, bShift=format->Bshift;
+  int rLoss=format->Rloss, gLoss=format->Gloss, bLoss=format->Bloss;
+  Uint32 alpha=format->Amask;
+
+  if(x1 <= x0 || y1 <= y0) return;
+  int columns = MIN(x1-x0,RESOLVE_CHUNK);
+  int rows = RESOLVE_CHUNK/columns;
+  for(y=y0;y<y1;y+=rows) {
+    int nRows = MIN(rows,y1-y);
+    for(x=x0;x<x1;x+=columns) {
+      int width = MIN(columns,x1-x);
+      /* Gather the rows of the block */
+      n = nRows*width;
+      for(j=0;j<nRows;j++) {
+	for(c=0;c<3;c++) memcpy(&values[c][j*width],getRow(c,y+j)+x,width*sizeof(float));
+	for(i=0;i<width;i++) offsets[j*width+i] = dither[(y+j)&3][(x+i)&3];
+      }
+      for(c=0;c<3;c++) {
+	toneMap(values[c],values[c],n);
+	encode(values[c],n);
+      }
+      for(i=0;i<n;i++) {
+	Uint32 r = (Uint32) (int) (values[0][i]+offsets[i]);
+	Uint32 g = (Uint32) (int) (values[1][i]+offsets[i]);
+	Uint32 b = (Uint32) (int) (values[2][i]+offsets[i]);
+	pixels[i] = (r >> rLoss << rShift) | (g >> gLoss << gShift) | (b >> bLoss << bShift) | alpha;
+      }
+      for(j=0;j<nRows;j++)
+	memcpy((Uint8*)surface->pixels+(y+j)*surface->pitch+x*4,&pixels[j*width],width*sizeof(Uint32));
+    }
+  }
+}
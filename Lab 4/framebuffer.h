@@ -0,0 +1,120 @@
+/** \file framebuffer.h
+    \brief Declares the FrameBuffer class, which holds the rendered
+    image in floating point and converts it to the screen.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	FRAMEBUFFER_H_
+# define   	FRAMEBUFFER_H_
+
+#include <vector>
+
+/** Number of steps of the table used for the sRGB curve, which is
+    interpolated linearly between them */
+#define SRGB_TABLE_SIZE 1024
+/** Number of pixels of a row converted at a time by resolve */
+#define RESOLVE_CHUNK 256
+
+/** \brief A high dynamic range image of linear RGB floats that the
+    renderer writes into, and which is resolved to the pixels of an
+    SDL surface.
+
+    The colours are not clamped when written, so bright highlights
+    keep their value until the resolve. Each channel is stored as its
+    own plane of floats, so that the resolve works on whole rows of
+    one channel at a time and the compiler can convert many pixels in
+    each SIMD instruction.
+
+    Resolving a pixel takes these steps:
+    - multiply by the exposure
+    - apply the tone map curve, which brings the colour to 0 .. 1. The
+      default, Clamp, cuts off everything above 1.
+    - encode the colour for the display, either linearly as 0 .. 255
+      or by the sRGB curve taken from a table
+    - add an ordered 4x4 Bayer dither pattern before rounding down,
+      which removes banding in smooth gradients
+    - pack the three bytes into the pixel format of the surface
+
+    By default, without the sRGB curve and the dither, the resolve
+    gives the same 8 bit colours as clamping the colour and scaling it
+    by 255.
+
+    Different threads may write and resolve different pixels at the
+    same time. */
+class FrameBuffer {
+ public:
+  /** Curves mapping exposed colours to 0 .. 1 */
+  enum ToneMap { Clamp, Reinhard, Filmic };
+
+  FrameBuffer();
+
+  /** Allocates the pixels of an image of the given size, which are
+      all black */
+  void resize(int width,int height);
+  int getWidth();
+  int getHeight();
+
+  /** Row y of channel 0, 1 or 2 (red, green, blue), which holds width
+      floats */
+  inline float *getRow(int channel,int y) { return &planes[channel][y*width]; }
+  inline void setPixel(int x,int y,const double rgb[3]) {
+    int i = y*width+x;
+    planes[0][i]=(float)rgb[0]; planes[1][i]=(float)rgb[1]; planes[2][i]=(float)rgb[2];
+  }
+  inline void getPixel(int x,int y,double rgb[3]) {
+    int i = y*width+x;
+    rgb[0]=planes[0][i]; rgb[1]=planes[1][i]; rgb[2]=planes[2][i];
+  }
+
+  /** Colours are multiplied by this before the tone map, default 1 */
+  void setExposure(double exposure);
+  void setToneMap(ToneMap toneMap);
+  /** Parses "clamp", "reinhard" or "filmic", returns false for
+      unknown names. */
+  bool setToneMap(const char *name);
+  /** Encodes the colours by the sRGB curve instead of linearly */
+  void setSRGB(bool enabled);
+  void setDither(bool enabled);
+
+  /** Converts the pixels x0 <= x < x1, y0 <= y < y1 and writes them to
+      the same pixels of the surface, which must have 32 bits per
+      pixel and be at least as large as the frame buffer. The surface
+      must be locked if needed. */
+  void resolve(SDL_Surface *surface,int x0,int y0,int x1,int y1);
+
+ private:
+  /** Assigns n values of a channel with the exposure and tone map
+      applied to values */
+  void toneMap(const float *source,float *values,int n);
+  /** Encodes n values in 0 .. 1 as 0 .. 255 */
+  void encode(float *values,int n);
+
+  int width, height;
+  std::vector<float> planes[3];
+  float exposure;
+  ToneMap curve;
+  bool srgb;
+  /** Added to the encoded values before rounding down, 0 without
+      dithering. Indexed by the row and column modulo 4. */
+  float dither[4][4];
+  /** The sRGB curve scaled to 0 .. 255 at SRGB_TABLE_SIZE+1 evenly
+      spaced values, and one more so that 1.0 can be interpolated */
+  float srgbTable[SRGB_TABLE_SIZE+2];
+};
+
+#endif 	    /* !FRAMEBUFFER_H_ */
@@ -54,4 +54,3 @@
 extern int debugThisPixel, debugIndentation;
 extern void printDebugIndentation();
 
-#define MAX_OMP_THREADS 32
@@ -0,0 +1,53 @@
+/** \file hit.h
+    \brief Declares the HitRecord class describing where a ray hit an
+    object.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	HIT_H_
+# define   	HIT_H_
+
+class Object;
+class Material;
+
+/** \brief Everything needed to shade the point where a ray hit an
+    object.
+
+    Filled in by Object::lineTest on the way back from the primitive
+    that was hit (eg. a Sphere) to the object in the scene. Every ray
+    has its own record, so no object needs to remember anything about
+    the last line test and any number of threads can trace rays
+    through the same objects. */
+class HitRecord {
+ public:
+  /** Distance along the ray, as returned by the line test */
+  double distance;
+  /** The primitive whose surface was hit */
+  Object *object;
+  /** Material giving the lighting properties at the point. This is
+      the primitive itself unless a Transform above it has a material
+      of its own. */
+  Material *material;
+  /** The hit point in the coordinate system of the material */
+  double point[3];
+  /** Surface normal in the coordinate system of the ray. Not
+      necessarily of unit length. */
+  double normal[3];
+};
+
+#endif 	    /* !HIT_H_ */
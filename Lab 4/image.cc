@@ -0,0 +1,145 @@
+/** \file image.cc
+    \brief Implements functions for saving rendered images to disk.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "image.h"
+
+/* Extracts one row of the surface as packed 8 bit RGB triplets */
+static void getRow(SDL_Surface *surface,int y,Uint8 *rgb) {
+  int x;
+  Uint8 *row = (Uint8*) surface->pixels + y*surface->pitch;
+  for(x=0;x<surface->w;x++) {
+    Uint32 pixel;
+    switch(surface->format->BytesPerPixel) {
+    case 4: pixel = ((Uint32*)row)[x]; break;
+    case 2: pixel = ((Uint16*)row)[x]; break;
+    case 1: pixel = row[x]; break;
+    default: pixel = row[3*x] | (row[3*x+1]<<8) | (row[3*x+2]<<16); break;
+    }
+    SDL_GetRGB(pixel,surface->format,&rgb[3*x],&rgb[3*x+1],&rgb[3*x+2]);
+  }
+}
+
+int saveImage(const char *filename,SDL_Surface *surface) {
+  int len = strlen(filename);
+  if(len >= 4 && (strcmp(filename+len-4,".png") == 0 || strcmp(filename+len-4,".PNG") == 0))
+    return savePNG(filename,surface);
+  return savePPM(filename,surface);
+}
+
+int savePPM(const char *filename,SDL_Surface *surface) {
+  int y;
+  FILE *fp = fopen(filename,"wb");
+  if(!fp) return 0;
+  Uint8 *rgb = new Uint8[3*surface->w];
+  fprintf(fp,"P6\n%d %d\n255\n",surface->w,surface->h);
+  for(y=0;y<surface->h;y++) {
+    getRow(surface,y,rgb);
+    fwrite(rgb,3,surface->w,fp);
+  }
+  delete [] rgb;
+  return fclose(fp) == 0;
+}
+
+/* CRC used by the PNG chunks */
+static Uint32 crcTable[256];
+static Uint32 updateCRC(Uint32 crc,const Uint8 *data,int len) {
+  int i,k;
+  if(!crcTable[1])
+    for(i=0;i<256;i++) {
+      Uint32 c=i;
+      for(k=0;k<8;k++) c = (c&1) ? 0xedb88320 ^ (c>>1) : c>>1;
+      crcTable[i]=c;
+    }
+  for(i=0;i<len;i++) crc = crcTable[(crc^data[i])&0xff] ^ (crc>>8);
+  return crc;
+}
+
+static void putBigEndian(Uint8 *p,Uint32 v) { p[0]=v>>24; p[1]=v>>16; p[2]=v>>8; p[3]=v; }
+
+/* Writes one complete PNG chunk (length, type, data and CRC) */
+static void writeChunk(FILE *fp,const char *type,const Uint8 *data,Uint32 len) {
+  Uint8 buf[4];
+  putBigEndian(buf,len); fwrite(buf,1,4,fp);
+  fwrite(type,1,4,fp);
+  if(len) fwrite(data,1,len,fp);
+  Uint32 crc = updateCRC(0xffffffff,(const Uint8*)type,4);
+  crc = updateCRC(crc,data,len) ^ 0xffffffff;
+  putBigEndian(buf,crc); fwrite(buf,1,4,fp);
+}
+
+int savePNG(const char *filename,SDL_Surface *surface) {
+  int y;
+  FILE *fp = fopen(filename,"wb");
+  if(!fp) return 0;
+
+  static const Uint8 signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  fwrite(signature,1,8,fp);
+
+  Uint8 header[13];
+  putBigEndian(header,surface->w);
+  putBigEndian(header+4,surface->h);
+  header[8]=8;   /* Bits per channel */
+  header[9]=2;   /* RGB */
+  header[10]=0;  /* Deflate */
+  header[11]=0;  /* Standard filters */
+  header[12]=0;  /* Not interlaced */
+  writeChunk(fp,"IHDR",header,13);
+
+  /* The raw image data is every row prefixed by filter type 0. This
+     is wrapped in a zlib stream consisting of uncompressed deflate
+     blocks of at most 65535 bytes each. */
+  Uint32 rowSize = 1+3*surface->w;
+  Uint32 rawSize = rowSize*surface->h;
+  Uint32 nBlocks = (rawSize+65534)/65535;
+  if(nBlocks == 0) nBlocks=1;
+  Uint32 dataSize = 2 + 5*nBlocks + rawSize + 4;
+  Uint8 *raw = new Uint8[rawSize];
+  Uint8 *data = new Uint8[dataSize];
+  for(y=0;y<surface->h;y++) {
+    raw[y*rowSize]=0;
+    getRow(surface,y,raw+y*rowSize+1);
+  }
+
+  Uint8 *p = data;
+  *p++ = 0x78; *p++ = 0x01;
+  Uint32 pos=0, a=1, b=0;
+  do {
+    Uint32 len = MIN(65535,rawSize-pos);
+    *p++ = (pos+len == rawSize) ? 1 : 0;
+    *p++ = len & 0xff; *p++ = len >> 8;
+    *p++ = ~len & 0xff; *p++ = (~len >> 8) & 0xff;
+    memcpy(p,raw+pos,len);
+    p += len;
+    pos += len;
+  } while(pos < rawSize);
+  for(pos=0;pos<rawSize;pos++) {
+    a = (a + raw[pos]) % 65521;
+    b = (b + a) % 65521;
+  }
+  putBigEndian(p,(b<<16)|a);
+  p += 4;
+  writeChunk(fp,"IDAT",data,p-data);
+  writeChunk(fp,"IEND",NULL,0);
+
+  delete [] raw;
+  delete [] data;
+  return fclose(fp) == 0;
+}
@@ -0,0 +1,36 @@
+/** \file image.h
+    \brief Declares functions for saving rendered images to disk.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	IMAGE_H_
+# define   	IMAGE_H_
+
+/** Saves the content of a surface to the given file. Files ending in
+    ".png" are written as PNG images, all other files as binary
+    PPM images. Returns 0 if the file could not be written. */
+int saveImage(const char *filename,SDL_Surface *surface);
+
+/** Saves the surface as a binary (P6) PPM image. */
+int savePPM(const char *filename,SDL_Surface *surface);
+
+/** Saves the surface as a 24 bit PNG image. The image data is stored
+    without compression so that no external libraries are needed. */
+int savePNG(const char *filename,SDL_Surface *surface);
+
+#endif 	    /* !IMAGE_H_ */
@@ -27,4 +27,51 @@
 Light::Light(double pos[3],double col[3]) {
   assign(pos,position);
   assign(col,colour);
+  falloff = 0.0;
+}
+bool Light::hasArea() { return false; }
+void Light::getSample(double point[3],double u,double v,double sample[3]) { assign(position,sample); }
+void Light::getBounds(double min[3],double max[3]) { assign(position,min); assign(position,max); }
+void Light::setFalloff(double distance) { falloff = distance; }
+double Light::getFalloff() { return falloff; }
+double Light::getAttenuation(double distance) {
+  if(falloff <= 0.0) return 1.0;
+  double d = distance/falloff;
+  return 1.0/(1.0+d*d);
+}
+
+SphereLight::SphereLight(double pos[3],double r,double col[3]) : Light(pos,col) { radius=r; }
+bool SphereLight::hasArea() { return true; }
+void SphereLight::getBounds(double min[3],double max[3]) {
+  int i;
+  for(i=0;i<3;i++) { min[i] = position[i]-radius; max[i] = position[i]+radius; }
+}
+void SphereLight::getSample(double point[3],double u,double v,double sample[3]) {
+  Vec3<double> center(position);
+  Vec3<double> axis = (Vec3<double>(point) - center).normalized();
+  /* Two directions spanning the disc facing point */
+  Vec3<double> helper = fabs(axis[0]) < 0.5 ? Vec3<double>(1.0,0.0,0.0) : Vec3<double>(0.0,1.0,0.0);
+  Vec3<double> tangent = axis.cross(helper).normalized();
+  Vec3<double> bitangent = axis.cross(tangent);
+  /* The square root keeps the points evenly spread over the disc */
+  double r = radius*sqrt(u), angle = 2.0*M_PI*v;
+  (center + tangent*(r*cos(angle)) + bitangent*(r*sin(angle))).store(sample);
+}
+
+RectangleLight::RectangleLight(double pos[3],double e1[3],double e2[3],double col[3]) : Light(pos,col) {
+  assign(e1,edge1);
+  assign(e2,edge2);
+}
+bool RectangleLight::hasArea() { return true; }
+void RectangleLight::getBounds(double min[3],double max[3]) {
+  int i;
+  for(i=0;i<3;i++) {
+    double extent = 0.5*(fabs(edge1[i])+fabs(edge2[i]));
+    min[i] = position[i]-extent;
+    max[i] = position[i]+extent;
+  }
+}
+void RectangleLight::getSample(double point[3],double u,double v,double sample[3]) {
+  int i;
+  for(i=0;i<3;i++) sample[i] = position[i] + (u-0.5)*edge1[i] + (v-0.5)*edge2[i];
 }
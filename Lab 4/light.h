@@ -30,15 +30,72 @@
 
 /** \brief Represents a simple direct point light in the scene. 
     
-    Must be added to the raytracer using the raytracer::addLight function. */
+    Must be added to the raytracer using the raytracer::addLight
+    function. A point light casts hard shadows and needs a single
+    shadow feeler. The subclasses have an area, and cast soft shadows
+    found by sending feelers towards several points of the light (see
+    getSample). */
 class Light :public ReferencedObject {
  public:
   Light(double position[3],double colour[3]);
- private:
+
+  /** True if the light has an area, false for a point light */
+  virtual bool hasArea();
+  /** Assigns to sample the point of the light given by u,v in
+      [0,1) as seen from point. The points given by uniformly
+      distributed u,v cover the light evenly, so stratified u,v give
+      stratified points on the light. A point light always gives its
+      position. */
+  virtual void getSample(double point[3],double u,double v,double sample[3]);
+  /** Assigns to min/max a box containing the whole light */
+  virtual void getBounds(double min[3],double max[3]);
+
+  /** Lets the light fade with the distance. The colour is halved at
+      the given distance and falls off with the inverse square of the
+      distance beyond it. A distance of 0 (the default) means that the
+      light does not fade at all, which is needed for lights to be
+      culled by distance in scenes with many lights (see LightTree). */
+  void setFalloff(double distance);
+  double getFalloff();
+  /** Gives the factor the colour is multiplied with at the given
+      distance from the light */
+  double getAttenuation(double distance);
+ protected:
+  /** Center of the light, also used as the direction of the light when
+      computing the diffuse and specular colours */
   double position[3];
   double colour[3];
+  double falloff;
   
   friend class Raytracer;
+  friend class LightTree;
+};
+
+/** \brief A light shaped as a sphere with the given center and radius. */
+class SphereLight :public Light {
+ public:
+  SphereLight(double position[3],double radius,double colour[3]);
+  bool hasArea();
+  /** Gives a point on the disc through the center of the sphere
+      facing point, which is the outline of the sphere seen from
+      point for all but very close points. */
+  void getSample(double point[3],double u,double v,double sample[3]);
+  void getBounds(double min[3],double max[3]);
+ private:
+  double radius;
+};
+
+/** \brief A light shaped as a parallelogram centered at the given
+    position, with the two edges edge1 and edge2. It gives light to
+    both sides. */
+class RectangleLight :public Light {
+ public:
+  RectangleLight(double position[3],double edge1[3],double edge2[3],double colour[3]);
+  bool hasArea();
+  void getSample(double point[3],double u,double v,double sample[3]);
+  void getBounds(double min[3],double max[3]);
+ private:
+  double edge1[3], edge2[3];
 };
 
 #endif 	    /* !LIGHT_H_ */
@@ -0,0 +1,229 @@
+/** \file lighttree.cc
+    \brief Implements the LightTree class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "object.h"
+#include "lighttree.h"
+#include <algorithm>
+
+using namespace std;
+
+/* Nodes that can give a point less light than this are culled. Far
+   below what can be seen in an image with 8 bits per colour. */
+#define LIGHT_CULL 1e-4
+/* A cluster may replace its lights when the light it can give is at
+   most this fraction of the total light of the cut */
+#define LIGHT_CUT_ERROR 0.02
+
+/* A node of the cut, kept in a heap with the largest error on top */
+class CutNode {
+ public:
+  int node;
+  double error, estimate;
+  bool operator<(const CutNode &other) const { return error < other.error; }
+};
+
+/* Orders lights along one axis while building */
+class CenterOrder {
+ public:
+  CenterOrder(int axis) : axis(axis) {}
+  template<class T> bool operator()(const T &a,const T &b) const { return a.center[axis] < b.center[axis]; }
+ private:
+  int axis;
+};
+
+void LightTree::build(set<Light*> *lightSet) {
+  int i;
+  double min[3], max[3];
+  vector<BuildLight> items;
+  set<Light*>::iterator iterator;
+
+  for(iterator=lightSet->begin();iterator!=lightSet->end();iterator++) {
+    BuildLight item;
+    item.light = *iterator;
+    item.light->getBounds(min,max);
+    for(i=0;i<3;i++) item.center[i] = 0.5*(min[i]+max[i]);
+    items.push_back(item);
+  }
+  nodes.clear();
+  lights.clear();
+  leaves.clear();
+  anyFalloff = false;
+  if(items.empty()) return;
+  nodes.resize(1);
+  buildNode(0,&items[0],0,(int) items.size());
+}
+
+void LightTree::buildNode(int nodeIndex,BuildLight *items,int first,int count) {
+  int i, j, axis=0;
+  Node node;
+
+  if(count == 1) {
+    Light *light = items[first].light;
+    light->getBounds(node.min,node.max);
+    assign(light->colour,node.colour);
+    node.intensity = (light->colour[0]+light->colour[1]+light->colour[2])/3.0;
+    node.falloff = light->falloff > 0.0 ? light->falloff : MAX_DISTANCE;
+    node.representative = light;
+    node.first = (int) lights.size();
+    node.count = 1;
+    lights.push_back(light);
+    leaves.push_back(nodeIndex);
+    if(light->falloff > 0.0) anyFalloff = true;
+    nodes[nodeIndex] = node;
+    return;
+  }
+
+  /* Split at the median of the longest axis of the centers, which
+     keeps the tree balanced and the boxes small */
+  double centerMin[3], centerMax[3];
+  for(i=0;i<3;i++) { centerMin[i] = MAX_DISTANCE; centerMax[i] = -MAX_DISTANCE; }
+  for(j=first;j<first+count;j++)
+    for(i=0;i<3;i++) {
+      centerMin[i] = MIN(centerMin[i],items[j].center[i]);
+      centerMax[i] = MAX(centerMax[i],items[j].center[i]);
+    }
+  for(i=1;i<3;i++)
+    if(centerMax[i]-centerMin[i] > centerMax[axis]-centerMin[axis]) axis=i;
+  int middle = first+count/2;
+  nth_element(items+first,items+middle,items+first+count,CenterOrder(axis));
+
+  int left = (int) nodes.size();
+  nodes.resize(left+2);
+  buildNode(left,items,first,middle-first);
+  buildNode(left+1,items,middle,first+count-middle);
+
+  /* The node is a sum of its children, the brighter child gives the
+     representative */
+  Node *a = &nodes[left], *b = &nodes[left+1];
+  for(i=0;i<3;i++) {
+    node.min[i] = MIN(a->min[i],b->min[i]);
+    node.max[i] = MAX(a->max[i],b->max[i]);
+    node.colour[i] = a->colour[i]+b->colour[i];
+  }
+  node.intensity = a->intensity+b->intensity;
+  node.falloff = MAX(a->falloff,b->falloff);
+  node.representative = a->intensity >= b->intensity ? a->representative : b->representative;
+  node.first = left;
+  node.count = count;
+  nodes[nodeIndex] = node;
+}
+
+double LightTree::bound(const Node *node,double point[3],double normal[3]) {
+  int i;
+  double distance2=0.0, maxDot=0.0;
+  for(i=0;i<3;i++) {
+    double d = point[i] < node->min[i] ? node->min[i]-point[i] : (point[i] > node->max[i] ? point[i]-node->max[i] : 0.0);
+    distance2 += d*d;
+    /* Largest value of normal . (q - point) over the box */
+    maxDot += normal[i] * ((normal[i] > 0.0 ? node->max[i] : node->min[i]) - point[i]);
+  }
+  /* The whole box is behind the surface */
+  if(maxDot <= 0.0) return 0.0;
+  double distance = sqrt(distance2);
+  double cosine = distance > maxDot ? maxDot/distance : 1.0;
+  double d = distance/node->falloff;
+  return node->intensity * cosine / (1.0+d*d);
+}
+
+double LightTree::estimate(const Node *node,double point[3],double normal[3]) {
+  Light *light = node->representative;
+  Vec3<double> L = Vec3<double>(light->position) - Vec3<double>(point);
+  double distance = L.length();
+  double cosine = L.dot(Vec3<double>(normal))/distance;
+  if(cosine <= 0.0) return 0.0;
+  return node->intensity * cosine * light->getAttenuation(distance);
+}
+
+int LightTree::selectLights(double point[3],double normal[3],LightChoice choices[MAX_LIGHT_CUT]) {
+  int i, k, n=0;
+  /* The cut through the tree, with the error bound (0 for single
+     lights) and the estimate of every node in it */
+  CutNode cut[MAX_LIGHT_CUT];
+  double total=0.0;
+
+  if(nodes.empty()) return 0;
+
+  /* Without a falloff a cluster is hardly ever dim enough compared
+     to the rest to replace its lights, so refining would end up with
+     every light anyway, only slower */
+  if(!anyFalloff && (int) lights.size() <= MAX_LIGHT_CUT) {
+    for(i=0;i<(int) lights.size();i++)
+      if(bound(&nodes[leaves[i]],point,normal) > LIGHT_CULL) cut[n++].node = leaves[i];
+  } else {
+    double rootBound = bound(&nodes[0],point,normal);
+    if(rootBound > LIGHT_CULL) {
+      cut[0].node = 0;
+      cut[0].error = nodes[0].count == 1 ? 0.0 : rootBound;
+      cut[0].estimate = estimate(&nodes[0],point,normal);
+      total = cut[0].estimate;
+      n = 1;
+    }
+
+    /* Refine the node with the largest error until every error is
+       small compared to the total */
+    while(n > 0 && n < MAX_LIGHT_CUT && cut[0].error > LIGHT_CUT_ERROR*total) {
+      int left = nodes[cut[0].node].first;
+      total -= cut[0].estimate;
+      pop_heap(cut,cut+n);
+      n--;
+      for(i=left;i<left+2;i++) {
+	double b = bound(&nodes[i],point,normal);
+	if(b <= LIGHT_CULL) continue;
+	cut[n].node = i;
+	cut[n].error = nodes[i].count == 1 ? 0.0 : b;
+	cut[n].estimate = estimate(&nodes[i],point,normal);
+	total += cut[n].estimate;
+	n++;
+	push_heap(cut,cut+n);
+      }
+    }
+  }
+
+  for(i=0;i<n;i++) {
+    Node *node = &nodes[cut[i].node];
+    LightChoice *choice = &choices[i];
+    choice->light = node->representative;
+    double distance = (Vec3<double>(choice->light->position) - Vec3<double>(point)).length();
+    double attenuation = choice->light->getAttenuation(distance);
+    for(k=0;k<3;k++) choice->colour[k] = node->colour[k]*attenuation;
+    choice->specular = node->count*attenuation;
+  }
+  return n;
+}
+
+Light *LightTree::sampleLight(double point[3],double normal[3],double u,double *probability) {
+  int index=0;
+  *probability = 1.0;
+  if(nodes.empty() || bound(&nodes[0],point,normal) <= 0.0) return NULL;
+  while(nodes[index].count > 1) {
+    int left = nodes[index].first;
+    double a = bound(&nodes[left],point,normal), b = bound(&nodes[left+1],point,normal);
+    if(a+b <= 0.0) return NULL;
+    double p = a/(a+b);
+    /* Reuse the random number for the next level */
+    if(u < p) { u = u/p; index = left; *probability *= p; }
+    else { u = (u-p)/(1.0-p); index = left+1; *probability *= 1.0-p; }
+  }
+  return lights[nodes[index].first];
+}
+
+int LightTree::getLightCount() { return (int) lights.size(); }
+int LightTree::getNodeCount() { return (int) nodes.size(); }
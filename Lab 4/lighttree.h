@@ -0,0 +1,140 @@
+/** \file lighttree.h
+    \brief Declares the LightTree class, a hierarchy over the lights
+    used to pick the lights worth casting shadow feelers towards.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	LIGHTTREE_H_
+# define   	LIGHTTREE_H_
+
+#ifndef LIGHT_H_
+#include "light.h"
+#endif
+
+#include <set>
+#include <vector>
+
+/** Largest number of lights and clusters of lights chosen for one
+    point by LightTree::selectLights */
+#define MAX_LIGHT_CUT 64
+
+/** \brief A light, or a cluster of lights, to shade a point with.
+
+    A cluster is shaded as if all of its lights were at the place of
+    one representative light, whose shadow feelers decide the shadow
+    of the whole cluster. */
+class LightChoice {
+ public:
+  /** The light, or the representative of the cluster */
+  Light *light;
+  /** Colour of the light or the sum of the colours of the cluster,
+      attenuated by the distance to the point */
+  double colour[3];
+  /** Factor for the specular highlight, which does not depend on the
+      colour of the lights. The number of lights of a cluster,
+      attenuated as the colour. */
+  double specular;
+};
+
+/** \brief Binary hierarchy over the lights of a scene, used to find
+    the lights that matter for a point.
+
+    Every node knows the box containing its lights, their total colour
+    and a representative light. This gives an upper bound of how much
+    light the node can give a point with a given normal: the total
+    brightness times the largest possible cosine of the angle to the
+    box times the weakest possible falloff over the distance to the
+    box. Nodes whose bound is negligible are culled along with all
+    their lights, including the lights behind the surface.
+
+    Points are either shaded with a cut through the tree
+    (selectLights, as in the lightcuts algorithm), where distant or
+    dim groups of lights are replaced by their representative as long
+    as the error this can cause is small compared to the total, or
+    with one light picked at random in proportion to these bounds
+    (sampleLight), which is what the path tracer needs.
+
+    Like the BVH the tree must be rebuilt when the lights have
+    changed, and is reentrant once built. */
+class LightTree {
+ public:
+  /** Rebuilds the tree over the given lights. The lights are not
+      referenced, the caller must keep them alive. */
+  void build(std::set<Light*> *lights);
+
+  /** Assigns to choices the lights and clusters of lights to shade
+      the point with the given unit normal, and returns how many
+      there are.
+
+      The cut is refined until the error bound of every cluster is at
+      most LIGHT_CUT_ERROR (2%) times the estimated total light, but
+      it stops at MAX_LIGHT_CUT choices, and that cap wins. So the 2%
+      only holds while the cut fits. Beyond that the errors add up:
+      for 2000 lights with a falloff of 1 over a floor, the light of
+      a point is off by 4.3% on average and by up to 19%.
+
+      Scenes of at most MAX_LIGHT_CUT lights that do not fade, where
+      the cut would end up with every light anyway, skip the tree and
+      get every light in front of the point, which is exact. */
+  int selectLights(double point[3],double normal[3],LightChoice choices[MAX_LIGHT_CUT]);
+
+  /** Picks one light at random, using the uniform random number u in
+      [0,1), with a probability proportional to the bounds of the
+      nodes along the way. Assigns the probability to
+      *probability. Returns NULL if no light can shine on the point. */
+  Light *sampleLight(double point[3],double normal[3],double u,double *probability);
+
+  int getLightCount();
+  int getNodeCount();
+
+ private:
+  /** A node is a leaf for the light lights[first] if count is 1,
+      otherwise the children are found at first and first+1. */
+  typedef struct {
+    double min[3], max[3];
+    /** Total colour of the lights, and its brightness */
+    double colour[3], intensity;
+    /** Largest falloff distance of the lights, MAX_DISTANCE if any of
+	them does not fade */
+    double falloff;
+    Light *representative;
+    int first, count;
+  } Node;
+
+  /** A light and the center of its bounds, only used while building */
+  typedef struct {
+    Light *light;
+    double center[3];
+  } BuildLight;
+
+  void buildNode(int nodeIndex,BuildLight *items,int first,int count);
+  /** Upper bound of the light the node gives the point */
+  double bound(const Node *node,double point[3],double normal[3]);
+  /** Estimate of the light the node gives the point, assuming all of
+      it comes from the representative light */
+  double estimate(const Node *node,double point[3],double normal[3]);
+
+  std::vector<Node> nodes;
+  std::vector<Light*> lights;
+  /** The leaf node of every light */
+  std::vector<int> leaves;
+  /** True if any of the lights fades with the distance */
+  bool anyFalloff;
+};
+
+#endif 	    /* !LIGHTTREE_H_ */
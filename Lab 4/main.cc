@@ -43,7 +43,12 @@
     The
     raytracer uses multiple threads to render a scene with as many
     processors as are available on the local machine as possible. See
-    the variable nThreads to change this manually. 
+    the -threads option to change this manually. 
+
+    Besides the interactive window the program can render a fixed
+    number of frames without opening any window, eg. for measuring
+    performance or on machines without a display. Run with -help to
+    see all options.
 
     To start, see the <a href="annotated.html"> class list </a> or <a
     href="hierarchy.html"> class hierarchy </a>. 
@@ -59,20 +64,124 @@
 #include "noise.h"
 #include "csg.h"
 #include "cone.h"
+#include "trianglemesh.h"
+#include "scene.h"
+#include "image.h"
+#include "tiles.h"
+#include "temporal.h"
+#include "framebuffer.h"
+#include <omp.h>
+
+/** Everything that places the camera and the objects of a frame.
+    Copied from the globals changed by tick and the events when the
+    frame is started, so that the next tick can run while the frame
+    is rendered. */
+typedef struct {
+  double time;
+  double orbit[2];
+  /** Pixel to debug, or -1 */
+  int debugX, debugY;
+} FrameState;
 
 /* Prototype declarations */
-void doRedraw();
+void createScene(int extraLights,const char *modelName,const char *sceneName);
+void runInteractive();
+void runOffline(int nFrames,double timeStep,const char *outputName);
+void getFrameState(FrameState *state);
+void doRedraw(const FrameState *state);
+void updateScene(const FrameState *state);
+void startPipeline();
+void requestFrame(const FrameState *state);
+SDL_Surface *waitForFrame();
+void stopPipeline();
+int renderTiles(int step,int reuse,int interruptible);
 void doKeyboard(int,int,int);
 void tick(double);
 void *renderingThread(void *arg);
 void renderPixels(int offset,int skip);
+/** Memory used by one rendering thread for the tile it renders */
+typedef struct {
+  /** The pixels to trace and their samples */
+  double *x, *y;
+  PixelSample *samples;
+} TileBuffers;
+
+void renderTile(Tile *tile,TileBuffers *buffers,int step,int reuse,RenderContext *context);
+void antialiasTile(Tile *tile,RenderContext *context);
+void pathTraceTile(Tile *tile,RenderContext *context);
 
 /* Important global variables */
 int screenWidth, screenHeight, isRunning;
 double gTime, simulationSpeed=5.0;
 SDL_Surface *screen;
+/** The colours of all pixels of the screen before they are tone
+    mapped. Each tile is resolved to renderSurface when rendered. */
+FrameBuffer frameBuffer;
+/** The surface the frame is rendered into, the screen unless
+    pipelined */
+SDL_Surface *renderSurface;
+
+/** Statistics of all rays traced in the last call to doRedraw */
+RenderContext frameStatistics;
+/** Decides how the screen is divided between the rendering threads */
+TileScheduler tileScheduler;
+
+/** Distance between the traced pixels in the first, coarsest, level
+    of progressive rendering. Each following level halves it. */
+#define COARSEST_STEP 4
+/** If set, frames are refined from a coarse to a fine resolution */
+int progressive=0;
+/** Number of levels of adaptive supersampling, 0 disables
+    anti-aliasing */
+int antialiasDepth=0;
+/** The sample traced for every pixel, used to find the pixels to
+    anti-alias. Only allocated when anti-aliasing. */
+PixelSample *pixelSamples=NULL;
+/** Keeps the pixels that do not change between frames, NULL unless
+    enabled by -temporal */
+TemporalCache *temporalCache=NULL;
+/** Sum of the path traced samples of every pixel, three floats per
+    pixel, since the scene last changed. NULL unless path tracing. */
+float *accumulation=NULL;
+/** Number of samples per pixel summed in accumulation */
+int accumulatedSamples=0;
+/** Number of samples per pixel added by every frame, 0 unless path
+    tracing */
+int samplesPerFrame=0;
+/** gTime and camera orbit of the samples in accumulation */
+double accumulatedTime, accumulatedOrbit[2];
+
+/** If set, frames are rendered by a thread of their own while the
+    main thread shows the previous frame and runs the next tick */
+int pipelined=0;
+/** The surfaces rendered into by turns when pipelined. The front one
+    holds the last finished frame. */
+SDL_Surface *frontSurface, *backSurface;
+SDL_Thread *renderThread;
+/** Posted by the main thread when requestedState is to be rendered,
+    and by the render thread when it is done */
+SDL_sem *frameRequested, *frameDone;
+FrameState requestedState;
+/** Set while the render thread has a frame that waitForFrame has not
+    taken. Only used by the main thread. */
+int framePending;
+/** Cleared to make the render thread exit */
+volatile int pipelineRunning;
+/** Number of threads the render thread renders the tiles with */
+int pipelineThreads;
+/** Seconds spent rendering the last frame */
+double renderTime;
+/** accumulatedSamples after the last frame, written by the render
+    thread before it posts frameDone */
+int renderedSamples;
+/** Samples per pixel of the frame returned by waitForFrame. Only
+    used by the main thread, as accumulatedSamples belongs to the
+    render thread while it renders. */
+int shownSamples;
 
 double cameraOrbit[2]={0.0,0.0};
+/** Point the camera orbits around, and its distance from it */
+double cameraFocus[3]={0.0,0.0,0.0}, cameraDistance=4.0;
 
 Raytracer *raytracer;
 Transform *object1, *object2;
@@ -84,34 +193,173 @@ Transform *object1, *object2;
 int debugPixelX=-1, debugPixelY, debugThisPixel=0;
 int debugIndentation=0;
 
+void printUsage(char *name) {
+  printf("Usage: %s [options]\n",name);
+  printf("  -width <w>       Width of the image in pixels (default 320)\n");
+  printf("  -height <h>      Height of the image in pixels (default 240)\n");
+  printf("  -threads <n>     Number of rendering threads (default all processors)\n");
+  printf("  -headless        Render without opening a window\n");
+  printf("  -frames <n>      Number of frames to render when headless (default 1)\n");
+  printf("  -time <t>        Value of gTime for the first frame (default 0)\n");
+  printf("  -timestep <dt>   Increase of gTime between frames when headless (default 0.1)\n");
+  printf("  -o <file>        Save frames when headless. The name may contain a printf\n");
+  printf("                   style integer for the frame number, eg. frame%%03d.png.\n");
+  printf("                   Files ending with .png are saved as PNG, others as PPM.\n");
+  printf("  -tilesize <n>    Size of the tiles rendered by each thread (default 16)\n");
+  printf("  -tileorder <o>   Order of the tiles: scanline, morton or hilbert (default hilbert)\n");
+  printf("  -progressive     Show each frame at 1/16 and 1/4 of the resolution before the\n");
+  printf("                   full frame. The animation is paused and any input restarts\n");
+  printf("                   the refinement.\n");
+  printf("  -aa <depth>      Anti-alias pixels at edges with up to 4^depth rays, eg. 2 for\n");
+  printf("                   up to 16 rays per pixel (default 0, no anti-aliasing)\n");
+  printf("  -exposure <e>    Multiply the colours by e before tone mapping (default 1)\n");
+  printf("  -tonemap <t>     Curve bringing bright colours into the range of the screen:\n");
+  printf("                   clamp, reinhard or filmic (default clamp)\n");
+  printf("  -srgb            Encode the colours with the sRGB curve instead of linearly\n");
+  printf("  -dither          Add an ordered dither pattern, which hides banding\n");
+  printf("  -pipeline        Render each frame in a thread of its own while the previous\n");
+  printf("                   frame is shown or saved. Not used with -progressive.\n");
+  printf("  -temporal        Keep the pixels that are not affected by the moving objects\n");
+  printf("                   from the previous frame. Not used with -progressive.\n");
+  printf("  -nocompile       Trace the objects through their virtual functions instead of\n");
+  printf("                   compiling the scene into flat arrays\n");
+  printf("  -engine <e>      How the rays are traced: recursive, following each ray to the\n");
+  printf("                   end, or wavefront, tracing all rays of a tile stage by stage\n");
+  printf("                   (default recursive)\n");
+  printf("  -depth <n>       Largest number of reflections of a ray (default 16)\n");
+  printf("  -roulette        End weak reflected rays by Russian roulette instead of cutting\n");
+  printf("                   them off, which is unbiased but noisy\n");
+  printf("  -scene <file>    Load the scene from a scene file, eg. default.scene, instead of\n");
+  printf("                   using the built in scene. A binary cache of the file is kept\n");
+  printf("                   in <file>.cache\n");
+  printf("  -model <file>    Add a model loaded from an AC3D file, eg. ../Lab 3/fighter.ac,\n");
+  printf("                   standing on the floor behind the spheres\n");
+  printf("  -lights <n>      Add n small coloured lights that fade with the distance to the\n");
+  printf("                   scene\n");
+  printf("  -pathtrace <n>   Path trace the scene with global illumination, adding n samples\n");
+  printf("                   per pixel to an accumulation buffer every frame. The buffer\n");
+  printf("                   keeps refining while nothing moves, so the animation is paused.\n");
+  printf("                   When headless, use -timestep 0 to refine over several frames.\n");
+  printf("                   Not used with -progressive, -aa and -temporal.\n");
+}
+
 int main(int argc,char **args) {
-  SDL_Event event;
   int i;
+  int headless=0, nFrames=1, compileScene=1, extraLights=0, maxDepth=MAX_REFLECTION_DEPTH, roulette=0;
+  double timeStep=0.1;
+  const char *outputName=NULL, *engine="recursive", *modelName=NULL, *sceneName=NULL;
 
-  /* Initialize SDL and create window */
-  if(SDL_Init(SDL_INIT_VIDEO) == -1) {
-    printf("Failed to initialize SDL. Error '%s'\n",SDL_GetError());
+  screenWidth=320; screenHeight=240;
+  for(i=1;i<argc;i++) {
+    if(strcmp(args[i],"-headless") == 0) headless=1;
+    else if(strcmp(args[i],"-width") == 0 && i+1<argc) screenWidth=atoi(args[++i]);
+    else if(strcmp(args[i],"-height") == 0 && i+1<argc) screenHeight=atoi(args[++i]);
+    else if(strcmp(args[i],"-threads") == 0 && i+1<argc) omp_set_num_threads(atoi(args[++i]));
+    else if(strcmp(args[i],"-frames") == 0 && i+1<argc) nFrames=atoi(args[++i]);
+    else if(strcmp(args[i],"-time") == 0 && i+1<argc) gTime=atof(args[++i]);
+    else if(strcmp(args[i],"-timestep") == 0 && i+1<argc) timeStep=atof(args[++i]);
+    else if(strcmp(args[i],"-progressive") == 0) progressive=1;
+    else if(strcmp(args[i],"-aa") == 0 && i+1<argc) antialiasDepth=atoi(args[++i]);
+    else if(strcmp(args[i],"-exposure") == 0 && i+1<argc) frameBuffer.setExposure(atof(args[++i]));
+    else if(strcmp(args[i],"-tonemap") == 0 && i+1<argc && frameBuffer.setToneMap(args[i+1])) i++;
+    else if(strcmp(args[i],"-srgb") == 0) frameBuffer.setSRGB(true);
+    else if(strcmp(args[i],"-dither") == 0) frameBuffer.setDither(true);
+    else if(strcmp(args[i],"-temporal") == 0) temporalCache=new TemporalCache();
+    else if(strcmp(args[i],"-pipeline") == 0) pipelined=1;
+    else if(strcmp(args[i],"-nocompile") == 0) compileScene=0;
+    else if(strcmp(args[i],"-engine") == 0 && i+1<argc) engine=args[++i];
+    else if(strcmp(args[i],"-pathtrace") == 0 && i+1<argc) samplesPerFrame=atoi(args[++i]);
+    else if(strcmp(args[i],"-depth") == 0 && i+1<argc) maxDepth=atoi(args[++i]);
+    else if(strcmp(args[i],"-roulette") == 0) roulette=1;
+    else if(strcmp(args[i],"-lights") == 0 && i+1<argc) extraLights=atoi(args[++i]);
+    else if(strcmp(args[i],"-model") == 0 && i+1<argc) modelName=args[++i];
+    else if(strcmp(args[i],"-scene") == 0 && i+1<argc) sceneName=args[++i];
+    else if(strcmp(args[i],"-tilesize") == 0 && i+1<argc) tileScheduler.setTileSize(atoi(args[++i]));
+    else if(strcmp(args[i],"-tileorder") == 0 && i+1<argc && tileScheduler.setOrder(args[i+1])) i++;
+    else if(strcmp(args[i],"-o") == 0 && i+1<argc && strlen(args[i+1]) < 1000) { outputName=args[++i]; headless=1; }
+    else {
+      printUsage(args[0]);
+      exit(strcmp(args[i],"-help") == 0 ? 0 : -1);
+    }
+  }
+  if(screenWidth <= 0 || screenHeight <= 0 || nFrames <= 0 || antialiasDepth < 0 || samplesPerFrame < 0 || maxDepth < 0) {
+    printUsage(args[0]);
     exit(-1);
   }
-  atexit(SDL_Quit);
-  SDL_WM_SetCaption("Datorgrafik","Datorgrafik");
+  if(samplesPerFrame) {
+    accumulation = new float[3*screenWidth*screenHeight];
+    progressive = antialiasDepth = 0;
+    delete temporalCache;
+    temporalCache = NULL;
+  }
+  if(antialiasDepth) pixelSamples = new PixelSample[screenWidth*screenHeight];
+  frameBuffer.resize(screenWidth,screenHeight);
 
-  screenWidth=320; screenHeight=240;
-  screen = SDL_SetVideoMode(screenWidth, screenHeight, 32, SDL_SWSURFACE); /* Add flag SDL_FULLSCREEN if you like, but be carefull! */
-  if(!screen) {
-    printf("Failed to open screen in %dx%dx%dbpp mode\n",screenWidth,screenHeight,32);
-    exit(0);
+  if(headless) {
+    /* Render into a surface in memory instead of a window */
+    screen = SDL_CreateRGBSurface(SDL_SWSURFACE,screenWidth,screenHeight,32,0xff0000,0x00ff00,0x0000ff,0);
+    if(!screen) {
+      printf("Failed to create a %dx%d image\n",screenWidth,screenHeight);
+      exit(-1);
+    }
+  } else {
+    /* Initialize SDL and create window */
+    if(SDL_Init(SDL_INIT_VIDEO) == -1) {
+      printf("Failed to initialize SDL. Error '%s'\n",SDL_GetError());
+      exit(-1);
+    }
+    atexit(SDL_Quit);
+    SDL_WM_SetCaption("Datorgrafik","Datorgrafik");
+
+    screen = SDL_SetVideoMode(screenWidth, screenHeight, 32, SDL_SWSURFACE); /* Add flag SDL_FULLSCREEN if you like, but be carefull! */
+    if(!screen) {
+      printf("Failed to open screen in %dx%dx%dbpp mode\n",screenWidth,screenHeight,32);
+      exit(0);
+    }
   }
 
-  /* Construct the world */
-  initNoise();
-  raytracer=new Raytracer();
-  raytracer->setCamera(new Camera());  
-  
-  /* Add a positional light source */
+  createScene(extraLights,modelName,sceneName);
+  raytracer->setCompileScene(compileScene);
+  raytracer->setMaxDepth(maxDepth);
+  raytracer->setRussianRoulette(roulette != 0);
+  if(!raytracer->setEngine(engine)) {
+    printUsage(args[0]);
+    exit(-1);
+  }
+  if(temporalCache) {
+    /* Progressive frames are already paused and kept on the screen */
+    if(progressive) { delete temporalCache; temporalCache=NULL; }
+    else {
+      /* These are the only objects changed by updateScene */
+      if(object1) temporalCache->addMovingObject(object1);
+      if(object2) temporalCache->addMovingObject(object2);
+    }
+  }
+  /* Progressive frames are refined in place on the screen */
+  if(progressive) pipelined=0;
+  renderSurface = screen;
+  if(pipelined) startPipeline();
+  if(headless) runOffline(nFrames,timeStep,outputName);
+  else runInteractive();
+  if(pipelined) stopPipeline();
+
+  /* Free raytracer, this also removes all objects referenced by it */
+  delete temporalCache;
+  delete [] accumulation;
+  delete raytracer;
+
+  /* Exit */
+  exit(0);
+}
+
+/* Adds the objects and lights of the scene built into the program,
+   the same as default.scene */
+void createDefaultScene() {
+  /* Add a spherical light source, giving soft shadows. Use the Light
+     class instead for a point light with hard shadows. */
   double lightCol[3] = { 1.0, 1.0, 1.0 };
   double lightPos[3] = { 1.0, 3.0, 1.0 };
-  Light *light = new Light(lightPos,lightCol);
+  Light *light = new SphereLight(lightPos,0.3,lightCol);
   raytracer->addLight(light);
 
   /* Setup ambient lighting in the scene */
@@ -185,11 +433,98 @@ int main(int argc,char **args) {
   map->add(0.0,&marble1);
   map->add(0.1,&marble0);
   floor->setMaterial(map);
-  
+}
+
+/* Adds the objects and lights of a scene file, which may name the
+   transforms animated by updateScene object1 and object2 */
+void loadScene(const char *sceneName) {
+  SceneFile scene;
+  double origin[3], focus[3];
+  double startTime = omp_get_wtime();
+  if(!scene.load(sceneName,raytracer,true)) exit(-1);
+  printf("Loaded the scene '%s' %s in %.2f ms\n",sceneName,
+	 scene.loadedFromCache() ? "from its cache" : "and wrote its cache",1e3*(omp_get_wtime()-startTime));
+  object1 = scene.getTransform("object1");
+  object2 = scene.getTransform("object2");
+  if(scene.getCamera(origin,focus)) {
+    /* Orbit around the focus, starting from the origin */
+    Vec3<double> offset = Vec3<double>(origin) - Vec3<double>(focus);
+    assign(focus,cameraFocus);
+    cameraDistance = offset.length();
+    if(cameraDistance > 0.0) {
+      cameraOrbit[0] = atan2(offset.v[0],offset.v[2]);
+      cameraOrbit[1] = asin(offset.v[1]/cameraDistance);
+    }
+  }
+}
+
+/* Creates all objects, lights and the camera of the scene, from the
+   given scene file or the scene built into the program if NULL, with
+   the given number of extra lights scattered over the floor and the
+   model of the given AC3D file if not NULL */
+void createScene(int extraLights,const char *modelName,const char *sceneName) {
+  int i;
+
+  /* Construct the world */
+  initNoise();
+  raytracer=new Raytracer();
+  raytracer->setCamera(new Camera());  
+  if(sceneName) loadScene(sceneName);
+  else createDefaultScene();
+
+  /* Many small lights close to the floor. Since they fade with the
+     distance only the closest ones need shadow feelers, the others are
+     culled or clustered by the light tree of the raytracer. */
+  for(i=0;i<extraLights;i++) {
+    double position[3] = { 8.0*rand()/RAND_MAX-4.0, 0.2+rand()/(double)RAND_MAX, 8.0*rand()/RAND_MAX-4.0 };
+    double colour[3] = { 0.3*rand()/RAND_MAX, 0.3*rand()/RAND_MAX, 0.3*rand()/RAND_MAX };
+    Light *lamp = new Light(position,colour);
+    lamp->setFalloff(0.5);
+    raytracer->addLight(lamp);
+  }
+
+  if(modelName) {
+    /* The model keeps the materials of the file, surfaces without any
+       are grey. It is scaled to 1.6 units and put on the floor. */
+    TriangleMesh *mesh = TriangleMesh::loadAC3D(modelName);
+    if(!mesh) {
+      printf("Failed to load the model '%s'\n",modelName);
+      exit(-1);
+    }
+    LightingProperties grey = {{0.8,0.8,0.8},{0.8,0.8,0.8},{2.0,2.0,2.0}, 10, {0.5, 0.5, 0.5}};
+    mesh->setMaterial(new SimpleMaterial(&grey));
+    mesh->prepare();
+    double min[3], max[3], size=0.0;
+    for(i=0;i<3;i++) { min[i] = -MAX_DISTANCE; max[i] = MAX_DISTANCE; }
+    mesh->getBounds(min,max);
+    for(i=0;i<3;i++) size = MAX(size,max[i]-min[i]);
+    printf("Model '%s': %d triangles, %d vertices, %d nodes\n",modelName,
+	   mesh->getTriangleCount(),mesh->getVertexCount(),mesh->getNodeCount());
+    if(size > 0.0) {
+      Transform *model = new Transform(mesh);
+      double scale = 1.6/size;
+      model->translate(-0.5*(min[0]+max[0]),-min[1],-0.5*(min[2]+max[2]));
+      model->scale(scale,scale,scale);
+      model->rotateY(0.6);
+      model->translate(1.4,-0.5,-1.6);
+      raytracer->addObject(model);
+    }
+  }
+}
+
+/* Renders into the window until the user quits */
+void runInteractive() {
+  SDL_Event event;
 
   /* Main event loop */
   isRunning=1;
   double oldTime, newTime, timeDelta;
+  /* Current level of progressive rendering, the frame is done when
+     all levels have been rendered */
+  int level=0, nLevels=0;
+  while((COARSEST_STEP >> nLevels) > 0) nLevels++;
+  /* Anti-aliasing is done as a last level */
+  if(antialiasDepth) nLevels++;
   oldTime=SDL_GetTicks()/1000.0;
   while(isRunning) {
     /* Yield processor time to other processes, otherwise windows
@@ -201,12 +536,47 @@ int main(int argc,char **args) {
     timeDelta = newTime - oldTime;
     oldTime=newTime;
 
-    /* Update world */
-    tick(timeDelta);
+    if(!progressive) {
+      FrameState state;
+      /* Update world */
+      tick(timeDelta);
+      getFrameState(&state);
+
+      if(pipelined) {
+	/* The previous frame has been rendered while the events were
+	   handled and the tick above ran. It is shown while the next
+	   frame renders, so the screen is at most one frame behind. */
+	SDL_Surface *finished = waitForFrame();
+	requestFrame(&state);
+	SDL_BlitSurface(finished,NULL,screen,NULL);
+      } else
+	/* Draw world */
+	doRedraw(&state);
+      SDL_UpdateRect(screen,0,0,screenWidth,screenHeight);
+    } else {
+      /* Restart the refinement if the camera has moved */
+      double oldOrbit[2] = { cameraOrbit[0], cameraOrbit[1] };
+      tick(timeDelta);
+      if(cameraOrbit[0] != oldOrbit[0] || cameraOrbit[1] != oldOrbit[1]) level=0;
 
-    /* Draw world */
-    doRedraw();
-    SDL_UpdateRect(screen,0,0,screenWidth,screenHeight);
+      if(level < nLevels) {
+	if(level == 0) {
+	  FrameState state;
+	  getFrameState(&state);
+	  updateScene(&state);
+	  frameStatistics.reset();
+	  tileScheduler.beginFrame(screenWidth,screenHeight);
+	}
+	/* Pixels traced by the previous level are kept. If the user
+	   does something before the level is done we start over. */
+	if(renderTiles(COARSEST_STEP >> level,level > 0,1)) level++;
+	else level=0;
+	if(level == nLevels) tileScheduler.endFrame();
+	SDL_UpdateRect(screen,0,0,screenWidth,screenHeight);
+      } else
+	/* Nothing left to refine, wait for input */
+	SDL_Delay(10);
+    }
 
     /* Process any events that have occured */
     while(SDL_PollEvent(&event)) 
@@ -215,8 +585,10 @@ int main(int argc,char **args) {
       case SDL_MOUSEBUTTONDOWN:
 	/* do something here. e->button is mouse button, e->x and e->y is coordinate of mouse */
 	SDL_GetMouseState(&debugPixelX,&debugPixelY);
+	level=0;
 	break;
       case SDL_KEYDOWN:
+	level=0;
 	if(event.key.keysym.sym == SDLK_ESCAPE) {
 	  isRunning=0; break;
 	} else {
@@ -226,12 +598,82 @@ int main(int argc,char **args) {
 	}
       }
   }
+}
 
-  /* Free raytracer, this also removes all objects referenced by it */
-  delete raytracer;
+/* Renders nFrames frames without any window, optionally saving
+   them. Prints the time taken and number of rays traced for each
+   frame. */
+void runOffline(int nFrames,double timeStep,const char *outputName) {
+  int frame;
+  double totalTime=0.0;
+  long totalRays=0;
+  FrameState state;
+  SDL_Surface *image = screen;
 
-  /* Exit */
-  exit(0);
+  printf("Rendering %d frames at %dx%d using %d threads\n",nFrames,screenWidth,screenHeight,omp_get_max_threads());
+  double wallStart = omp_get_wtime();
+  for(frame=0;frame<nFrames;frame++) {
+    double startTime = omp_get_wtime();
+    if(progressive) {
+      /* Render all levels, reporting when each of them would have
+	 been shown */
+      int step;
+      getFrameState(&state);
+      updateScene(&state);
+      frameStatistics.reset();
+      tileScheduler.beginFrame(screenWidth,screenHeight);
+      for(step=COARSEST_STEP;step>0;step/=2) {
+	renderTiles(step,step < COARSEST_STEP,0);
+	printf("  1/%d resolution after %.2f ms\n",step*step,(omp_get_wtime()-startTime)*1e3);
+      }
+      if(antialiasDepth) {
+	renderTiles(0,0,0);
+	printf("  Anti-aliased after %.2f ms\n",(omp_get_wtime()-startTime)*1e3);
+      }
+      tileScheduler.endFrame();
+    } else if(pipelined) {
+      /* Later frames are requested before the previous frame is
+	 saved */
+      if(frame == 0) {
+	getFrameState(&state);
+	requestFrame(&state);
+      }
+      image = waitForFrame();
+    } else {
+      getFrameState(&state);
+      doRedraw(&state);
+    }
+    double frameTime = pipelined ? renderTime : omp_get_wtime() - startTime;
+    long rays = frameStatistics.getRayCount();
+    totalTime += frameTime;
+    totalRays += rays;
+    printf("Frame %d (gTime %.3f): %.2f ms, %ld rays (%ld primary, %ld shadow, %ld reflection), %.3f Mrays/s\n",
+	   frame,gTime,frameTime*1e3,rays,frameStatistics.primaryRays,frameStatistics.shadowRays,
+	   frameStatistics.reflectionRays,rays/frameTime*1e-6);
+    tileScheduler.printStatistics();
+    if(temporalCache)
+      printf("  %d of %d pixels kept from the previous frame\n",temporalCache->getValidCount(),screenWidth*screenHeight);
+    if(accumulation)
+      printf("  %d samples per pixel, %.3f Msamples/s per core\n",pipelined ? shownSamples : accumulatedSamples,
+	     frameStatistics.primaryRays/frameTime/omp_get_max_threads()*1e-6);
+
+    gTime += timeStep;
+    if(pipelined && frame+1 < nFrames) {
+      getFrameState(&state);
+      requestFrame(&state);
+    }
+
+    if(outputName) {
+      char filename[1024];
+      sprintf(filename,outputName,frame);
+      if(!saveImage(filename,image)) {
+	printf("Failed to save image '%s'\n",filename);
+	exit(-1);
+      }
+    }
+  }
+  printf("Average: %.2f ms/frame, %.3f Mrays/s\n",totalTime/nFrames*1e3,totalRays/totalTime*1e-6);
+  printf("  %.2f ms/frame including saving the images\n",(omp_get_wtime()-wallStart)/nFrames*1e3);
 }
 
 /* Handle keyboard. */
@@ -239,14 +681,197 @@ void doKeyboard(int key,int mouseX,int mouseY) {
   if(key == 27) exit(0);
 }
 
-void putPixel(int x,int y,int r,int g,int b) {
-  Uint32 colour;
-  colour = SDL_MapRGB(screen->format,(Uint8) r,(Uint8) g,(Uint8) b);
-  *((Uint32*)screen->pixels+y*screen->pitch/4+x) = colour;
+/* Renders the pixels of the tile whose distance from the corner of
+   the tile is a multiple of step, into the frame buffer. Each of them
+   is used for all pixels of the step x step block it is the corner
+   of. If reuse is set the pixels at multiples of 2*step were rendered
+   by the previous, coarser, level and are kept in the frame buffer.
+   When rendering at full resolution the pixels that can be kept from
+   the previous frame are taken from the temporal cache. The tile is
+   resolved to the screen when done. */
+void renderTile(Tile *tile,TileBuffers *buffers,int step,int reuse,RenderContext *context) {
+  int x, y, j, k, n;
+  TemporalCache *cache = step == 1 && !reuse ? temporalCache : NULL;
+
+  /* Collect the pixels that need to be traced */
+  n=0;
+  for(y=tile->y0;y<tile->y1;y+=step) {
+    int reuseRow = reuse && (y-tile->y0) % (2*step) == 0;
+    for(x=tile->x0;x<tile->x1;x+=step)
+      if(reuseRow && (x-tile->x0) % (2*step) == 0) continue;
+      else if(cache && cache->isValid(x,y)) {
+	double rgb[3];
+	cache->getColour(x,y,rgb);
+	frameBuffer.setPixel(x,y,rgb);
+      } else {
+	buffers->samples[n].path = cache ? cache->getPath(x,y) : NULL;
+	buffers->x[n]=x; buffers->y[n]=y; n++;
+      }
+  }
+
+  /* All of them are traced at once. The recursive engine takes them
+     RAY_PACKET_SIZE at a time, which are neighbours along the rows. */
+  if(n > 0) raytracer->raytrace(n,buffers->x,buffers->y,buffers->samples,context);
+
+  for(k=0;k<n;k++) {
+    double *rgb = buffers->samples[k].rgb;
+    int sx = (int) buffers->x[k], sy = (int) buffers->y[k];
+    if(pixelSamples) pixelSamples[sy*screenWidth+sx] = buffers->samples[k];
+    frameBuffer.setPixel(sx,sy,rgb);
+    if(cache) cache->store(sx,sy,rgb);
+  }
+
+  /* Fill the blocks. The corners are left as they are, so the next
+     level can reuse them. */
+  if(step > 1)
+    for(y=tile->y0;y<tile->y1;y++)
+      for(j=0;j<3;j++) {
+	float *row = frameBuffer.getRow(j,y);
+	float *corners = frameBuffer.getRow(j,y-(y-tile->y0)%step);
+	for(x=tile->x0;x<tile->x1;x++) row[x] = corners[x-(x-tile->x0)%step];
+      }
+
+  /* Note that we do not need to protect the surface since every tile
+     writes to different memory addresses. This would not hold if we
+     where not running in 32bpp mode. */
+  frameBuffer.resolve(renderSurface,tile->x0,tile->y0,tile->x1,tile->y1);
 }
 
-/* Called when the screen needs to be redrawn */
-void doRedraw() {
+/* Supersamples the pixels of the tile whose sample is not similar to
+   the sample of one of the neighbouring pixels. Must be done after
+   the whole screen has been rendered at full resolution. */
+void antialiasTile(Tile *tile,RenderContext *context) {
+  int x, y, i;
+  static const int dx[4] = { -1, 1, 0, 0 }, dy[4] = { 0, 0, -1, 1 };
+  for(y=tile->y0;y<tile->y1;y++)
+    for(x=tile->x0;x<tile->x1;x++) {
+      PixelSample *sample = &pixelSamples[y*screenWidth+x];
+      for(i=0;i<4;i++) {
+	int nx=x+dx[i], ny=y+dy[i];
+	if(nx < 0 || ny < 0 || nx >= screenWidth || ny >= screenHeight) continue;
+	if(!sample->isSimilar(&pixelSamples[ny*screenWidth+nx])) break;
+      }
+      if(i == 4) continue;
+      double rgb[3];
+      raytracer->supersample(x,y,1.0,sample,antialiasDepth,rgb,context);
+      frameBuffer.setPixel(x,y,rgb);
+    }
+  frameBuffer.resolve(renderSurface,tile->x0,tile->y0,tile->x1,tile->y1);
+}
+
+/* Adds samplesPerFrame path traced samples to every pixel of the tile
+   in the accumulation buffer, and shows the average of all samples of
+   the pixel. Every sample has its own seed, so the image does not
+   depend on which thread renders which tile. */
+void pathTraceTile(Tile *tile,RenderContext *context) {
+  int x, y, i, j;
+  for(y=tile->y0;y<tile->y1;y++)
+    for(x=tile->x0;x<tile->x1;x++) {
+      float *sum = &accumulation[3*(y*screenWidth+x)];
+      double rgb[3];
+      for(i=0;i<samplesPerFrame;i++) {
+	context->setSeed((unsigned int)((accumulatedSamples+i)*screenWidth*screenHeight + y*screenWidth+x));
+	/* A random position within the pixel */
+	raytracer->pathtrace(x+context->random()-0.5,y+context->random()-0.5,rgb,context);
+	for(j=0;j<3;j++) sum[j] += (float) rgb[j];
+      }
+      for(j=0;j<3;j++) rgb[j] = sum[j]/(accumulatedSamples+samplesPerFrame);
+      frameBuffer.setPixel(x,y,rgb);
+    }
+  frameBuffer.resolve(renderSurface,tile->x0,tile->y0,tile->x1,tile->y1);
+}
+
+/* Returns true if the user has done something that should interrupt
+   the rendering. May only be called from the main thread. */
+static int inputPending() {
+  SDL_Event event;
+  SDL_PumpEvents();
+  if(SDL_GetMouseState(NULL,NULL)) return 1;
+  return SDL_PeepEvents(&event,1,SDL_PEEKEVENT,SDL_EVENTMASK(SDL_KEYDOWN) |
+			SDL_EVENTMASK(SDL_MOUSEBUTTONDOWN) | SDL_EVENTMASK(SDL_QUIT)) > 0;
+}
+
+/* Renders all tiles of the current frame, see renderTile for the
+   meaning of step and reuse. A step of 0 anti-aliases the tiles
+   instead. If interruptible is set, rendering stops as soon as there
+   is any input from the user and 0 is returned. */
+int renderTiles(int step,int reuse,int interruptible) {
+  int i;
+  int nTiles=tileScheduler.getTileCount();
+  volatile int interrupted=0;
+#pragma omp parallel default(shared) private(i)
+  {
+    /* Each thread counts its rays separately, and adds them to the
+       frame statistics when done */
+    RenderContext context;
+    int tileSize = tileScheduler.getTileSize();
+    TileBuffers buffers;
+    buffers.x = new double[tileSize*tileSize];
+    buffers.y = new double[tileSize*tileSize];
+    buffers.samples = new PixelSample[tileSize*tileSize];
+    /* Tiles are handed out one at a time in the order given by the
+       scheduler, so that neighbouring tiles are rendered at the same
+       time. */
+#pragma omp for schedule(dynamic,1)
+    for(i=0;i<nTiles;i++) {
+#pragma omp flush(interrupted)
+      if(interrupted) continue;
+      Tile *tile = tileScheduler.getTile(i);
+      double startTime = omp_get_wtime();
+      if(accumulation) pathTraceTile(tile,&context);
+      else if(step) renderTile(tile,&buffers,step,reuse,&context);
+      else antialiasTile(tile,&context);
+      tile->cost += omp_get_wtime()-startTime;
+      /* Only the main thread may look at the SDL events */
+      if(interruptible && omp_get_thread_num() == 0 && inputPending()) {
+	interrupted=1;
+#pragma omp flush(interrupted)
+      }
+    }
+#pragma omp critical
+    frameStatistics.add(&context);
+    delete [] buffers.x;
+    delete [] buffers.y;
+    delete [] buffers.samples;
+  }
+  return !interrupted;
+}
+
+/* Copies the state of the next frame from the globals. The pixel to
+   debug is taken, so that it is only debugged once. */
+void getFrameState(FrameState *state) {
+  state->time = gTime;
+  state->orbit[0] = cameraOrbit[0];
+  state->orbit[1] = cameraOrbit[1];
+  state->debugX = debugPixelX;
+  state->debugY = debugPixelY;
+  debugPixelX = -1;
+}
+
+/* Renders the frame given by state into renderSurface */
+void doRedraw(const FrameState *state) {
+  updateScene(state);
+  frameStatistics.reset();
+  if(temporalCache) temporalCache->beginFrame(raytracer->getCamera(),screenWidth,screenHeight);
+  if(accumulation && (accumulatedSamples == 0 || state->time != accumulatedTime ||
+		       state->orbit[0] != accumulatedOrbit[0] || state->orbit[1] != accumulatedOrbit[1])) {
+    /* The scene has changed, start over */
+    memset(accumulation,0,3*screenWidth*screenHeight*sizeof(float));
+    accumulatedSamples = 0;
+    accumulatedTime = state->time;
+    accumulatedOrbit[0] = state->orbit[0];
+    accumulatedOrbit[1] = state->orbit[1];
+  }
+  tileScheduler.beginFrame(screenWidth,screenHeight);
+  renderTiles(1,0,0);
+  if(antialiasDepth) renderTiles(0,0,0);
+  tileScheduler.endFrame();
+  if(accumulation) accumulatedSamples += samplesPerFrame;
+}
+
+/* Moves the camera and the objects to their positions in the frame
+   given by state */
+void updateScene(const FrameState *state) {
   int i;
   double vec[3];
   Camera *camera = raytracer->getCamera();
@@ -254,63 +879,136 @@ void doRedraw() {
   /* Set camera up vector */
   vec[0]=0.0; vec[1]=1.0; vec[2]=0.0; 
   camera->setUp(vec);
-  /* Place camera 4 units away in orbit around origo, let mouse
-     movements rotate camera. */
-  vec[0]=4.0*sin(cameraOrbit[0])*cos(cameraOrbit[1]); vec[1]=4.0*sin(cameraOrbit[1]); vec[2]=4.0*cos(cameraOrbit[0])*cos(cameraOrbit[1]);
+  /* Place camera in orbit around the focus, 4 units away from origo
+     unless the scene file says otherwise, let mouse movements rotate
+     camera. */
+  vec[0]=cameraFocus[0]+cameraDistance*sin(state->orbit[0])*cos(state->orbit[1]);
+  vec[1]=cameraFocus[1]+cameraDistance*sin(state->orbit[1]);
+  vec[2]=cameraFocus[2]+cameraDistance*cos(state->orbit[0])*cos(state->orbit[1]);
   camera->setOrigin(vec);
-  /* Set focus of camera to be in origo */
-  zero(vec);
-  camera->setFocus(vec);
+  camera->setFocus(cameraFocus);
 
   /* Set the position/scale of the first sphere so it appears to be
-     bouncing  (infinitly long). */
-  object1->identity();
-  double ypos = fabs(cos(gTime*M_PI/5.0))-0.2;
-  if(ypos < 0.0)
-    object1->scale(1.0,1.0-(-ypos),1.0);
-  object1->rotateX(gTime);
-  object1->translate(-0.6,ypos,0.0);
+     bouncing  (infinitly long). Scene files need not have it. */
+  if(object1) {
+    object1->identity();
+    double ypos = fabs(cos(state->time*M_PI/5.0))-0.2;
+    if(ypos < 0.0)
+      object1->scale(1.0,1.0-(-ypos),1.0);
+    object1->rotateX(state->time);
+    object1->translate(-0.6,ypos,0.0);
+  }
 
   /* Set the position/scale of the second sphere so it appears to be
      bouncing  (infinitly long). */
-  object2->identity();
-  double ypos2 = 0.8*fabs(cos(gTime*M_PI/4.0))-0.2;
-  if(ypos2 < 0.0)
-    object2->scale(1.0,1.0-(-ypos2),1.0);
-  object2->translate(+0.6,ypos2,0.0);
+  if(object2) {
+    object2->identity();
+    double ypos2 = 0.8*fabs(cos(state->time*M_PI/4.0))-0.2;
+    if(ypos2 < 0.0)
+      object2->scale(1.0,1.0-(-ypos2),1.0);
+    object2->translate(+0.6,ypos2,0.0);
+  }
 
-  if(debugPixelX != -1) {
+  /* Objects have moved, update the acceleration structures */
+  raytracer->prepareFrame();
+
+  if(state->debugX != -1) {
     /* User has clicked on the screen, run all the rendring in
        non-threaded mode and set the debugThisPixel variable to true
        for one of the pixels. */
-    printf("Debugging frame for X=%d, Y=%d\n",debugPixelX,debugPixelY);
+    printf("Debugging frame for X=%d, Y=%d\n",state->debugX,state->debugY);
     double rgb[3];
+    RenderContext context;
     debugThisPixel=1;
 #pragma omp parallel default(shared) private(i)
 #pragma omp for schedule(guided) 
     for(i=0;i<1;i++) // Make a dummy for loop to make sure that OpenMP is used always within the raytracing parts
-      raytracer->raytrace(debugPixelX,debugPixelY,rgb);
+      raytracer->raytrace(state->debugX,state->debugY,rgb,&context);
     printf("SCREEN <- %.3f %.3f %.3f\n",rgb[0],rgb[1],rgb[2]);
     debugThisPixel=0;
-    debugPixelX=-1;
   }
+}
 
-  int pixels=screenWidth*screenHeight;
-#pragma omp parallel default(shared) private(i)
-#pragma omp for schedule(guided) 
-  for(i=0;i<pixels;i++) {
-    int x=i%screenWidth;
-    int y=i/screenWidth;
-    double rgb[3];
-    raytracer->raytrace(x,y,rgb);
-
-    for(int j=0;j<3;j++) if(rgb[j] > 1.0) rgb[j]=1.0; else if(rgb[j] < 0.0) rgb[j]=0.0;
-    /* Note that we do not need to protect the putPixel call with a
-       semaphore since we are guaranteed to write to different memory
-       addresses every time. This would not hold if we where not
-       running in 32bpp mode. */
-    putPixel(x,y,(int)(rgb[0]*255.0),(int)(rgb[1]*255.0),(int)(rgb[2]*255.0));
+/* Body of the render thread. Renders the requested frames until the
+   pipeline is stopped. */
+static int renderFrames(void *arg) {
+  /* The number of threads is set per thread, so the one given to the
+     main thread by -threads is passed on */
+  omp_set_num_threads(pipelineThreads);
+  while(1) {
+    SDL_SemWait(frameRequested);
+    if(!pipelineRunning) break;
+    double startTime = omp_get_wtime();
+    doRedraw(&requestedState);
+    renderTime = omp_get_wtime()-startTime;
+    renderedSamples = accumulatedSamples;
+    SDL_SemPost(frameDone);
   }
+  return 0;
+}
+
+/* Creates the surfaces and starts the render thread used when
+   pipelined */
+void startPipeline() {
+  SDL_PixelFormat *format = screen->format;
+  frontSurface = SDL_CreateRGBSurface(SDL_SWSURFACE,screenWidth,screenHeight,32,
+				      format->Rmask,format->Gmask,format->Bmask,format->Amask);
+  backSurface = SDL_CreateRGBSurface(SDL_SWSURFACE,screenWidth,screenHeight,32,
+				     format->Rmask,format->Gmask,format->Bmask,format->Amask);
+  frameRequested = SDL_CreateSemaphore(0);
+  frameDone = SDL_CreateSemaphore(0);
+  if(!frontSurface || !backSurface || !frameRequested || !frameDone) {
+    printf("Failed to create the buffers of the pipeline\n");
+    exit(-1);
+  }
+  framePending = 0;
+  pipelineRunning = 1;
+  pipelineThreads = omp_get_max_threads();
+  renderThread = SDL_CreateThread(renderFrames,NULL);
+  if(!renderThread) {
+    printf("Failed to create the render thread. Error '%s'\n",SDL_GetError());
+    exit(-1);
+  }
+}
+
+/* Starts rendering the frame given by state into the back surface.
+   Only one frame may be rendered at a time, so waitForFrame must be
+   called between two requests. Nothing changed by tick or by the
+   events is read by the render thread, only its own copy of state. */
+void requestFrame(const FrameState *state) {
+  requestedState = *state;
+  renderSurface = backSurface;
+  framePending = 1;
+  SDL_SemPost(frameRequested);
+}
+
+/* Waits until the requested frame is done, and returns the surface
+   holding it. The surfaces then trade places, so it stays unchanged
+   until the frame after the next is requested. Returns the last
+   finished frame if none is being rendered. */
+SDL_Surface *waitForFrame() {
+  if(framePending) {
+    SDL_SemWait(frameDone);
+    framePending = 0;
+    shownSamples = renderedSamples;
+    SDL_Surface *finished = backSurface;
+    backSurface = frontSurface;
+    frontSurface = finished;
+  }
+  return frontSurface;
+}
+
+/* Waits for the last frame and ends the render thread */
+void stopPipeline() {
+  waitForFrame();
+  pipelineRunning = 0;
+  SDL_SemPost(frameRequested);
+  SDL_WaitThread(renderThread,NULL);
+  SDL_DestroySemaphore(frameRequested);
+  SDL_DestroySemaphore(frameDone);
+  SDL_FreeSurface(frontSurface);
+  SDL_FreeSurface(backSurface);
+  renderSurface = screen;
 }
 
 void printDebugIndentation() { int i; for(i=0;i<debugIndentation;i++) printf(" "); }
@@ -318,13 +1016,19 @@ void tick(double dt) {
   /* This measures the elapsed time in seconds since the start of
      the program. 
   */
-  gTime+=dt;
+  /* The scene stands still while refining progressive or path traced
+     frames */
+  if(!progressive && !accumulation) gTime+=dt;
   
   static double fps=1.0;
   static int cnt=0;
   fps = 0.95*fps + 0.05*1.0/dt;
-  if((++cnt) % 10 == 0) 
+  if((++cnt) % 10 == 0) {
     printf("Average framerate: %3.1ffps\n",fps);
+    if(accumulation)
+      printf("  %d samples per pixel, %.3f Msamples/s per core\n",pipelined ? shownSamples : accumulatedSamples,
+	     (double)screenWidth*screenHeight*samplesPerFrame*fps/omp_get_max_threads()*1e-6);
+  }
 
   /* Some usefull functions you might want to use...
      
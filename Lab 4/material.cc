@@ -44,17 +44,8 @@ void CheckerboardMaterial::getLightingProperties(double point[3],LightingPropert
 
 NoiseMaterial::NoiseMaterial() :Material() {}
 void NoiseMaterial::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
-  double scale=1.0;
-  double amplitude=1.0;
-  double offset[3];
   int i;
-  double v=0.0;
-  zero(offset);
-  for(i=0;i<6;i++) {
-    v+=amplitude*noise(point[0]*scale+offset[0],point[1]*scale+offset[1],point[2]*scale+offset[2]);
-    scale *= 2.0;
-    amplitude *= 0.5;
-  }
+  double v=fbm(point[0],point[1],point[2],6);
   v=0.5+0.3*v;
   
   if(v < 0.0) v = 0.0;
@@ -90,19 +81,10 @@ void MaterialMap::add(double nodePosition,LightingProperties*nodeProperty) {
   nodeProperties[insertionPoint]=*nodeProperty; 
 }
 void MaterialMap::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
-  int i;
   double val;
 
-  double scale=1.0;
-  double amplitude=1.0;
-  double offset[3];
-  val=0.0;
-  zero(offset);
-  for(i=0;i<6;i++) {
-    val+=amplitude*noise(point[0]*scale+offset[0],point[1]*scale+offset[1],point[2]*scale+offset[2]);
-    scale *= 2.0;
-    amplitude *= 0.5;
-  }  
+  if(function == GradientNoise) val=gradientFbm(point[0],point[1],point[2],6);
+  else val=fbm(point[0],point[1],point[2],6);
 
   int highNode;
   int lowNode;
@@ -146,23 +128,9 @@ WoodMaterial::WoodMaterial(LightingProperties *dark, LightingProperties *light)
 
 void WoodMaterial::getLightingProperties(double point[3], LightingProperties *props, double normal[3]) {
 	
-	double rx = noise(point[0])*0.2;
-	double ry = noise(point[1])*0.2;
-
-	double val;
-
-	double scale = 1.0;
-	double amplitude = 1.0;
-	double offset[3];
-	val = 0.0;
-	zero(offset);
-	for (int i = 0; i<6; i++) {
-		val += amplitude*noise(point[0] * scale + offset[0], point[1] * scale + offset[1], point[2] * scale + offset[2]);
-		scale *= 2.0;
-		amplitude *= 0.5;
-	}
-	rx = val*0.2;
-	ry = val*0.2;
+	double val = fbm(point[0], point[1], point[2], 6);
+	double rx = val*0.2;
+	double ry = val*0.2;
 	
 	double r = sqrt(pow(point[0]+rx, 2) + pow(point[1]+ry, 2));
 	//double r = pow(point[0] * point[0] + point[1] * point[1], 0.2);
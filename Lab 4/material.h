@@ -102,7 +102,9 @@ class NoiseMaterial : public Material {
     contribute 100% to the resulting material property. */
 class MaterialMap : public Material {
  public:
-  typedef enum { Noise } Function;
+  /** Noise is the fractal sum of noise(), GradientNoise that of
+      gradientNoise() */
+  typedef enum { Noise, GradientNoise } Function;
   MaterialMap(Function fun);
   void add(double nodePosition,LightingProperties*nodeProperties);
   virtual void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
@@ -32,4 +32,26 @@ double noise(double a,double b);
 double noise(double a,double b,double c);
 double noise(double a,double b,double c,double d);
 
+/** Assigns out[i] = noise(a[i],b[i],c[i]) for the n points given as
+    separate arrays. Uses AVX2 gathers for four points at a time when
+    available. */
+void noise(int n,const double a[],const double b[],const double c[],double out[]);
+
+/** Fractal sum of noise over the given number of octaves, each with
+    twice the frequency and half the amplitude of the previous
+    one. This is what the noise based materials use. */
+double fbm(double a,double b,double c,int octaves);
+/** Assigns out[i] = fbm(a[i],b[i],c[i],octaves) for the n points */
+void fbm(int n,const double a[],const double b[],const double c[],int octaves,double out[]);
+
+/** Gradient noise in 3D, in [-1,1]. Smoother than noise and computed
+    from an integer hash of the lattice points instead of table
+    lookups, which makes it cheaper. Gives different patterns than
+    noise. */
+double gradientNoise(double a,double b,double c);
+/** Batch version of gradientNoise, as the batch version of noise */
+void gradientNoise(int n,const double a[],const double b[],const double c[],double out[]);
+/** Same as fbm, using gradientNoise */
+double gradientFbm(double a,double b,double c,int octaves);
+
 #endif 	    /* !NOISE_H_ */
@@ -37,3 +37,74 @@ void Object::getLightingProperties(double point[3],LightingProperties *props,dou
   if(material)
     material->getLightingProperties(point,props,normal);
 }
+void Object::lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i,j;
+  double origin[3], direction[3];
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    if(!packet->active[i]) continue;
+    for(j=0;j<3;j++) {
+      origin[j] = packet->origin[j][i];
+      direction[j] = packet->direction[j][i];
+    }
+    distance[i] = lineTest(origin,direction,maxDistance[i],hit ? &hit[i] : NULL);
+  }
+}
+bool Object::occluded(double origin[3],double direction[3],double maxDistance) {
+  return lineTest(origin,direction,maxDistance,NULL) < maxDistance;
+}
+void Object::fillHitRecord(HitRecord *hit,double origin[3],double direction[3],double distance) {
+  int i;
+  hit->distance = distance;
+  hit->object = this;
+  hit->material = this;
+  for(i=0;i<3;i++) hit->point[i] = origin[i]+distance*direction[i];
+  getNormal(hit->point,hit->normal);
+}
+void Object::fillHitRecords(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i,j;
+  double origin[3], direction[3];
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    if(!packet->active[i] || distance[i] >= maxDistance[i]) continue;
+    for(j=0;j<3;j++) {
+      origin[j] = packet->origin[j][i];
+      direction[j] = packet->direction[j][i];
+    }
+    fillHitRecord(&hit[i],origin,direction,distance[i]);
+  }
+}
+void Object::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i;
+  double O[3], offset=0.0, enter=-MAX_DISTANCE;
+  HitRecord hit, enterHit;
+  /* Every surface crossed by the ray takes us from the inside to the
+     outside or the other way around. Each new line test starts just
+     beyond the last crossing, which leaves the distances and hit
+     points along the original ray unchanged. */
+  bool inside = isInside(origin);
+  spans->clear(maxDistance,fillHits);
+  assign(origin,O);
+  while(!spans->isTruncated()) {
+    double distance = lineTest(O,direction,maxDistance-offset,fillHits ? &hit : NULL);
+    if(distance >= maxDistance-offset) break;
+    distance += offset;
+    hit.distance = distance;
+    if(inside) spans->add(enter,&enterHit,distance,&hit);
+    else { enter = distance; enterHit = hit; }
+    inside = !inside;
+    offset = distance + 1e-5;
+    for(i=0;i<3;i++) O[i] = origin[i]+offset*direction[i];
+  }
+  if(inside) spans->add(enter,&enterHit,MAX_DISTANCE,NULL);
+}
+void Object::addSpan(SpanList *spans,double enter,double exit,double origin[3],double direction[3],bool fillHits) {
+  HitRecord enterHit, exitHit;
+  if(!fillHits) { spans->add(enter,NULL,exit,NULL); return; }
+  if(enter > 0.0 && enter < spans->maxDistance) fillHitRecord(&enterHit,origin,direction,enter);
+  if(exit > 0.0 && exit < spans->maxDistance) fillHitRecord(&exitHit,origin,direction,exit);
+  spans->add(enter,&enterHit,exit,&exitHit);
+}
+void Object::getBounds(double min[3],double max[3]) {
+  /* Nothing is known about the object, so the whole box may be
+     covered by it. */
+}
+void Object::prepare() {}
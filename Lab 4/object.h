@@ -29,8 +29,20 @@
 #include "material.h"
 #endif
 
+#ifndef PACKET_H_
+#include "packet.h"
+#endif
+
+#ifndef HIT_H_
+#include "hit.h"
+#endif
+
 #define MAX_DISTANCE 1e9
 
+#ifndef SPAN_H_
+#include "span.h"
+#endif
+
 /** \brief Abstract base class for all renderable objects. 
 
     Each concrete instance of this class must contain virtual
@@ -49,8 +61,35 @@ class Object : public Material {
   distance MAX_DISTANCE if no such intersection exists. 
 
   Direction is not neccessarily a vector of unit length, and distances
-  are measured in multiples of this vector. */
-  virtual double lineTest(double origin[3],double direction[3],double maxDistance)=0;
+  are measured in multiples of this vector. 
+
+  If hit is not NULL and the returned distance is smaller than
+  maxDistance, the hit record is filled in with the point and normal
+  of the intersection. Otherwise the record is left unchanged. */
+  virtual double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit)=0;
+
+  /** Packet version of lineTest. For every active ray i of the packet
+  assigns to distance[i] the same value as lineTest would return for
+  that ray and maxDistance[i], and fills in hit[i] if hit is not
+  NULL. Entries of inactive rays are left unchanged. The default
+  implementation calls lineTest once for every active ray, objects can
+  override it to test all rays at once. */
+  virtual void lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+
+  /** Returns true if the ray intersects the object closer than
+  maxDistance, ie. if lineTest would return a distance smaller than
+  maxDistance. Used for shadow feelers where only a yes/no answer is
+  needed, so objects can skip finding the closest point. The default
+  implementation calls lineTest. */
+  virtual bool occluded(double origin[3],double direction[3],double maxDistance);
+
+  /** Assigns to spans all intervals of the ray between 0 and
+  maxDistance that lie inside the object, see SpanList. Used by the
+  CSG objects to combine their children. The hit records of the
+  boundaries are filled in if fillHits is true. The default
+  implementation walks from surface to surface using lineTest, objects
+  should override it when they can find all their intervals at once. */
+  virtual void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
 
   /** Compute the normal of the object at the given point. Result is
       not guaranteed to be of unit length. */
@@ -59,6 +98,22 @@ class Object : public Material {
   /** Tests if a point is inside the object or not. */
   virtual bool isInside(double point[3])=0;
 
+  /** Shrinks the axis aligned box min/max so that it still encloses
+      every part of the object that lies inside the box. The box is
+      given in the same coordinate system as the rays passed to
+      lineTest, start with +/- MAX_DISTANCE to get the bounds of the
+      whole object. Unbounded objects (eg. planes) may leave parts of
+      the box unchanged, which is also the safe default used for
+      objects that do not implement this function. */
+  virtual void getBounds(double min[3],double max[3]);
+
+  /** Called from a single thread before rendering a frame, after the
+      scene may have been changed, so that objects can update data
+      they compute lazily (eg. the inverse matrix of a
+      Transform). Objects containing other objects must pass the call
+      on to them. The default implementation does nothing. */
+  virtual void prepare();
+
   /** Sets up a default material to use for this object. */
   virtual void setMaterial(Material *material);
 
@@ -67,6 +122,17 @@ class Object : public Material {
   virtual void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
 
  protected:
+  /** Fills in the hit record for a hit on the surface of this
+      object, for use by primitives in their lineTest function. */
+  void fillHitRecord(HitRecord *hit,double origin[3],double direction[3],double distance);
+  /** Calls fillHitRecord for every active ray in the packet that hit
+      the object closer than maxDistance. */
+  void fillHitRecords(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  /** Adds the span enter..exit of this object to spans, filling in
+      the hit records of its boundaries if fillHits is true. For use by
+      primitives in their getSpans function. */
+  void addSpan(SpanList *spans,double enter,double exit,double origin[3],double direction[3],bool fillHits);
+
   /** Material used by the default getLightingProperties function. */
   Material *material;
 };
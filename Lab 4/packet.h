@@ -0,0 +1,48 @@
+/** \file packet.h
+    \brief Declares the RayPacket class used to trace multiple coherent
+    rays at the same time.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	PACKET_H_
+# define   	PACKET_H_
+
+/** Number of rays in each packet. Should be a multiple of the number
+    of doubles that fit in a SIMD register (2 for SSE, 4 for AVX and 8
+    for AVX-512), eg. 4, 8 or 16. */
+#ifndef RAY_PACKET_SIZE
+#define RAY_PACKET_SIZE 8
+#endif
+
+/** \brief A packet of rays stored in SoA (structure of arrays) form.
+
+    Each component of the origins and directions are stored in
+    separate arrays, so that loops over all rays in the packet can be
+    vectorized by the compiler. Rays that should not be traced (eg.
+    when there are fewer rays than RAY_PACKET_SIZE, or when only some
+    of the rays hit a bounding box) have active set to zero. Inactive
+    lanes must still hold valid numbers since they are computed along
+    with the others, their results are just ignored. */
+class RayPacket {
+ public:
+  double origin[3][RAY_PACKET_SIZE];
+  double direction[3][RAY_PACKET_SIZE];
+  int active[RAY_PACKET_SIZE];
+};
+
+#endif 	    /* !PACKET_H_ */
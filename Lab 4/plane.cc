@@ -30,19 +30,41 @@ Plane::Plane(double normal[3],double offset) {
 }
 Plane::~Plane() {}
 
-double Plane::lineTest(double O[3],double D[3],double maxDistance) {
-  double alpha = -(dotProduct(normal,O) - offset) / dotProduct(normal,D);
+double Plane::lineTest(double O[3],double D[3],double maxDistance,HitRecord *hit) {
+  double alpha = intersect(normal,offset,O,D,maxDistance);
 
   /*  This is just to illustrate how you can debug your linetest functions */
   if(debugThisPixel) {
     printDebugIndentation(); 
     printf("-> Plane::lineTest (%3.2f,%3.2f,%3.2f)+a(%3.2f,%3.2f,%3.2f)\n",
 	   O[0],O[1],O[2],D[0],D[1],D[2]);
-    printDebugIndentation(); printf("<- Dist %.2f\n",(alpha>0&&alpha<maxDistance)?alpha:MAX_DISTANCE);
+    printDebugIndentation(); printf("<- Dist %.2f\n",alpha);
   }
 
-  if(alpha > 0 && alpha < maxDistance) return alpha;
-  else return MAX_DISTANCE;
+  if(hit && alpha < maxDistance) fillHitRecord(hit,O,D,alpha);
+  return alpha;
+}
+
+void Plane::lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i;
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    double nO = normal[0]*packet->origin[0][i] + normal[1]*packet->origin[1][i] + normal[2]*packet->origin[2][i];
+    double nD = normal[0]*packet->direction[0][i] + normal[1]*packet->direction[1][i] + normal[2]*packet->direction[2][i];
+    double alpha = -(nO - offset) / nD;
+    double result = (alpha > 0 && alpha < maxDistance[i]) ? alpha : MAX_DISTANCE;
+    distance[i] = packet->active[i] ? result : distance[i];
+  }
+  if(hit) fillHitRecords(packet,maxDistance,distance,hit);
+}
+
+void Plane::getSpans(double O[3],double D[3],double maxDistance,SpanList *spans,bool fillHits) {
+  double enter, exit;
+  spans->clear(maxDistance,fillHits);
+  if(span(normal,offset,O,D,&enter,&exit)) addSpan(spans,enter,exit,O,D,fillHits);
+}
+
+bool Plane::occluded(double O[3],double D[3],double maxDistance) {
+  return intersect(normal,offset,O,D,maxDistance) < maxDistance;
 }
 
 void Plane::getNormal(double point[3],double normal[3]) {
@@ -50,6 +72,21 @@ void Plane::getNormal(double point[3],double normal[3]) {
 }
 
 bool Plane::isInside(double point[3]) {
-  return +dotProduct(point,normal) < offset;
+  return inside(normal,offset,point);
+}
+
+void Plane::getBounds(double min[3],double max[3]) {
+  int i, axis=-1;
+  /* The inside of the plane is a halfspace, which can only limit the
+     box if the normal is aligned with one of the axises. */
+  for(i=0;i<3;i++)
+    if(normal[i] != 0.0) {
+      if(axis != -1) return;
+      axis=i;
+    }
+  if(axis == -1) return;
+  double limit = offset / normal[axis];
+  if(normal[axis] > 0.0) max[axis] = MIN(max[axis],limit);
+  else min[axis] = MAX(min[axis],limit);
 }
  
@@ -34,11 +34,41 @@ class Plane : public Object {
   Plane(double normal[3],double offset);
   ~Plane();
 
-  double lineTest(double origin[3],double direction[3],double maxDistance);
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  void lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
   void getNormal(double point[3],double normal[3]);
   bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+
+  /** Line test of a plane with the given normal and offset, without
+      filling in any hit record. Also used by the SceneCompiler
+      kernel. */
+  static double intersect(double normal[3],double offset,double O[3],double D[3],double maxDistance) {
+    double alpha = -(dotProduct(normal,O) - offset) / dotProduct(normal,D);
+    return alpha > 0 && alpha < maxDistance ? alpha : MAX_DISTANCE;
+  }
+  /** Assigns to enter and exit the part of the ray that is inside
+      the plane, ie. on the opposite side of the normal. One of them is
+      -MAX_DISTANCE or MAX_DISTANCE. Returns false if the ray is
+      completely outside. */
+  static bool span(double normal[3],double offset,double O[3],double D[3],double *enter,double *exit) {
+    double nD = dotProduct(normal,D);
+    double alpha = -(dotProduct(normal,O) - offset) / nD;
+    if(nD > 0) { *enter = -MAX_DISTANCE; *exit = alpha; }
+    else if(nD < 0) { *enter = alpha; *exit = MAX_DISTANCE; }
+    else {
+      /* Parallel to the plane, the whole ray is on one side of it */
+      *enter = -MAX_DISTANCE; *exit = MAX_DISTANCE;
+      return inside(normal,offset,O);
+    }
+    return true;
+  }
+  static bool inside(double normal[3],double offset,double point[3]) { return +dotProduct(point,normal) < offset; }
 
  private:
+  friend class SceneCompiler;
   double normal[3], offset;
 };
 
@@ -23,16 +23,110 @@
 
 #include "general.h"
 #include "raytracer.h"
+#include "material.h"
+#include <algorithm>
+#include <functional>
 
 using namespace std;
 
 extern int screenWidth, screenHeight;
 
+void RayPath::clear() { segments.clear(); }
+void RayPath::add(double origin[3],double direction[3],double length) {
+  int i;
+  RaySegment segment;
+  for(i=0;i<3;i++) {
+    segment.origin[i] = (float) origin[i];
+    segment.direction[i] = (float) direction[i];
+  }
+  segment.length = (float) length;
+  segments.push_back(segment);
+}
+bool RayPath::intersects(double min[3],double max[3]) {
+  int i, j;
+  for(i=0;i<(int)segments.size();i++) {
+    RaySegment *segment = &segments[i];
+    /* Clip the ray against the three slabs of the box */
+    double t0=0.0, t1=segment->length;
+    for(j=0;j<3 && t0 <= t1;j++) {
+      double o=segment->origin[j], d=segment->direction[j];
+      if(d == 0.0) {
+	if(o < min[j] || o > max[j]) t0=t1+1.0;
+	continue;
+      }
+      double ta=(min[j]-o)/d, tb=(max[j]-o)/d;
+      if(ta > tb) { double tmp=ta; ta=tb; tb=tmp; }
+      t0 = MAX(t0,ta);
+      t1 = MIN(t1,tb);
+    }
+    if(t0 <= t1) return true;
+  }
+  return false;
+}
+
+RenderContext::RenderContext() { reset(); path=NULL; queues=NULL; setSeed(0); }
+RenderContext::~RenderContext() { delete queues; }
+void RenderContext::reset() { primaryRays = shadowRays = reflectionRays = 0; }
+void RenderContext::add(RenderContext *other) {
+  primaryRays += other->primaryRays;
+  shadowRays += other->shadowRays;
+  reflectionRays += other->reflectionRays;
+}
+long RenderContext::getRayCount() { return primaryRays + shadowRays + reflectionRays; }
+RayQueues *RenderContext::getQueues() {
+  if(!queues) queues = new RayQueues();
+  return queues;
+}
+void RenderContext::setSeed(unsigned int seed) {
+  /* Scramble the seed, so that consecutive seeds give unrelated
+     numbers, and avoid the zero state of xorshift */
+  seed = (seed ^ 61) ^ (seed >> 16);
+  seed *= 9;
+  seed ^= seed >> 4;
+  seed *= 0x27d4eb2d;
+  seed ^= seed >> 15;
+  randomState = seed ? seed : 1;
+}
+double RenderContext::random() {
+  /* 32 bit xorshift */
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState * (1.0/4294967296.0);
+}
+
+/* Limits used by PixelSample::isSimilar. Distances may differ by this
+   fraction, normals by this cosine and colour components by this
+   amount. */
+#define SIMILAR_DISTANCE 0.05
+#define SIMILAR_NORMAL 0.95
+#define SIMILAR_COLOUR 0.1
+
+PixelSample::PixelSample() { path=NULL; }
+bool PixelSample::isSimilar(PixelSample *other) {
+  int i;
+  if(object != other->object) return false;
+  if(object) {
+    if(fabs(distance-other->distance) > SIMILAR_DISTANCE*MIN(distance,other->distance)) return false;
+    if(dotProduct(normal,other->normal) < SIMILAR_NORMAL) return false;
+  }
+  for(i=0;i<3;i++)
+    if(fabs(MIN(rgb[i],1.0)-MIN(other->rgb[i],1.0)) > SIMILAR_COLOUR) return false;
+  return true;
+}
+
 Raytracer::Raytracer() { 
   zero(background);
   zero(ambientLight);
   lights = new set<Light*>();
   objects = new set<Object*>();
+  bvh = new BVH();
+  compiler = new SceneCompiler();
+  lightTree = new LightTree();
+  camera = NULL;
+  engine = Recursive;
+  maxDepth = MAX_REFLECTION_DEPTH;
+  roulette = false;
 }
 Raytracer::~Raytracer() {
   set<Object*>::iterator objIterator;
@@ -47,6 +141,9 @@ Raytracer::~Raytracer() {
       lightIterator != lightIteratorEnd;lightIterator++) {
     (*lightIterator)->dereference();
   }
+  delete bvh;
+  delete compiler;
+  delete lightTree;
 }
 void Raytracer::setBackground(double col[3]) { assign(col,background); }
 void Raytracer::setAmbientLight(double col[3]) { assign(col,ambientLight); }
@@ -61,99 +158,481 @@ void Raytracer::addLight(Light *light) {
 }
 void Raytracer::setCamera(Camera *cam) { camera = cam; }
 Camera *Raytracer::getCamera() { return camera; }
-void Raytracer::raytrace(int x,int y,double rgb[3]) {
-  double origin[3], direction[3];
-  camera->getPixelRay(x/(double)screenWidth,y/(double)screenHeight,origin,direction);
-  raytrace(origin,direction,rgb,1.0);
+void Raytracer::setCompileScene(bool compile) {
+  if(!compile) { delete compiler; compiler=NULL; }
+  else if(!compiler) compiler = new SceneCompiler();
 }
-void Raytracer::raytrace(double origin[3], double direction[3], double rgb[3],double contribution) {
-  int i;
-  double closestDistance, distance;
-  Object *closestObject;
+void Raytracer::setEngine(Engine engine) { this->engine = engine; }
+bool Raytracer::setEngine(const char *name) {
+  if(strcmp(name,"recursive") == 0) setEngine(Recursive);
+  else if(strcmp(name,"wavefront") == 0) setEngine(Wavefront);
+  else return false;
+  return true;
+}
+void Raytracer::setMaxDepth(int depth) { maxDepth = depth; }
+void Raytracer::setRussianRoulette(bool roulette) { this->roulette = roulette; }
+void Raytracer::prepareFrame() {
   set<Object*>::iterator objIterator;
-  set<Object*>::iterator objIteratorEnd;
-  set<Light*>::iterator lightIterator;
-  set<Light*>::iterator lightIteratorEnd;
+  /* The rays are given in pixels of the screen */
+  if(camera) camera->setImageSize(screenWidth,screenHeight);
+  for(objIterator=objects->begin();objIterator != objects->end();objIterator++)
+    (*objIterator)->prepare();
+  if(compiler) {
+    compiler->compile(objects);
+    bvh->build(compiler->getObjects());
+  } else bvh->build(objects);
+  lightTree->build(lights);
+}
+void Raytracer::raytrace(int x,int y,double rgb[3],RenderContext *context) {
+  double origin[3], direction[3], px=x, py=y;
+  camera->getOrigin(origin);
+  camera->getPixelRays(1,&px,&py,&direction[0],&direction[1],&direction[2]);
+  context->primaryRays++;
+  raytrace(origin,direction,rgb,1.0,context);
+}
+void Raytracer::raytrace(int n,double x[],double y[],PixelSample samples[],RenderContext *context) {
+  int i;
+  if(engine == Wavefront) {
+    traceWavefront(n,x,y,samples,context);
+    return;
+  }
+  for(i=0;i<n;i+=RAY_PACKET_SIZE)
+    tracePacket(MIN(n-i,RAY_PACKET_SIZE),x+i,y+i,samples+i,context);
+}
+void Raytracer::tracePacket(int n,double x[],double y[],PixelSample samples[],RenderContext *context) {
+  int i,j;
+  RayPacket packet;
+  double distance[RAY_PACKET_SIZE];
+  Object *hitObject[RAY_PACKET_SIZE];
+  HitRecord hit[RAY_PACKET_SIZE];
 
-  if(debugThisPixel) {
-    printDebugIndentation(); debugIndentation++; printf("-> Raytrace\n");
+  double cameraOrigin[3];
+  camera->getOrigin(cameraOrigin);
+  camera->getPixelRays(n,x,y,packet.direction[0],packet.direction[1],packet.direction[2]);
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    if(i >= n) {
+      /* Unused rays are given a valid direction to avoid any
+	 floating point exceptions */
+      packet.direction[0][i]=packet.direction[1][i]=0.0; packet.direction[2][i]=1.0;
+    }
+    for(j=0;j<3;j++) packet.origin[j][i] = i < n ? cameraOrigin[j] : 0.0;
+    packet.active[i] = i < n;
   }
+  context->primaryRays += n;
 
-  /* Iterate over all objects and find the closest one that
-     intersects this ray. */
-  for(closestDistance=MAX_DISTANCE,closestObject=NULL,
-	objIterator=objects->begin(),objIteratorEnd=objects->end();
-      objIterator != objIteratorEnd;objIterator++) {
-    Object *object = *objIterator;
-    distance = object->lineTest(origin,direction,closestDistance);
-    if(distance < closestDistance && distance > 1e-5) {
-      closestDistance = distance;
-      closestObject = object;
+  bvh->lineTestPacket(&packet,MAX_DISTANCE,distance,hitObject,hit);
+
+  /* Lighting, shadows and reflections are computed one ray at a time */
+  for(i=0;i<n;i++) {
+    double origin[3], direction[3];
+    for(j=0;j<3;j++) {
+      origin[j] = packet.origin[j][i];
+      direction[j] = packet.direction[j][i];
+    }
+    PixelSample *sample = &samples[i];
+    sample->object = hitObject[i] ? hit[i].object : NULL;
+    sample->distance = distance[i];
+    if(hitObject[i]) {
+      assign(hit[i].normal,sample->normal);
+      normalize(sample->normal);
+    } else zero(sample->normal);
+    context->path = sample->path;
+    if(context->path) {
+      context->path->clear();
+      context->path->add(origin,direction,distance[i]);
+    }
+    QueuedRay ray;
+    for(j=0;j<3;j++) {
+      ray.origin[j] = origin[j];
+      ray.direction[j] = direction[j];
+      ray.weight[j] = 1.0;
+    }
+    ray.contribution = 1.0;
+    ray.depth = 0;
+    ray.sample = i;
+    zero(sample->rgb);
+    shade(&ray,distance[i],hitObject[i],&hit[i],sample->rgb,context);
+    traceStack(sample->rgb,context);
+  }
+  context->path = NULL;
+}
+
+/* Orders the hits of a generation by their material, so that hits
+   on the same material are shaded one after the other */
+class MaterialOrder {
+ public:
+  MaterialOrder(HitRecord *hits) : hits(hits) {}
+  bool operator()(int a,int b) const { return less<Material*>()(hits[a].material,hits[b].material); }
+ private:
+  HitRecord *hits;
+};
+
+void Raytracer::traceWavefront(int n,double x[],double y[],PixelSample samples[],RenderContext *context) {
+  int i, j;
+  RayQueues *queues = context->getQueues();
+
+  /* The directions are made a packet at a time, and then spread to
+     the rays */
+  double origin[3], directions[3][RAY_PACKET_SIZE];
+  camera->getOrigin(origin);
+  queues->rays.resize(n);
+  for(i=0;i<n;i++) {
+    QueuedRay *ray = &queues->rays[i];
+    if(i % RAY_PACKET_SIZE == 0)
+      camera->getPixelRays(MIN(n-i,RAY_PACKET_SIZE),x+i,y+i,directions[0],directions[1],directions[2]);
+    for(j=0;j<3;j++) {
+      ray->origin[j] = origin[j];
+      ray->direction[j] = directions[j][i % RAY_PACKET_SIZE];
+    }
+    for(j=0;j<3;j++) ray->weight[j] = 1.0;
+    ray->contribution = 1.0;
+    ray->depth = 0;
+    ray->sample = i;
+    zero(samples[i].rgb);
+    if(samples[i].path) samples[i].path->clear();
+  }
+  context->primaryRays += n;
+
+  /* Every generation of rays is intersected, shaded and has its
+     shadow feelers tested before going on to the reflected rays */
+  bool primary = true;
+  while(!queues->rays.empty()) {
+    queues->nextRays.clear();
+    queues->shadowRays.clear();
+    intersectStage(queues,samples,primary);
+    shadeStage(queues,samples,context);
+    occlusionStage(queues,samples,context);
+    queues->rays.swap(queues->nextRays);
+    primary = false;
+  }
+}
+void Raytracer::intersectStage(RayQueues *queues,PixelSample samples[],bool primary) {
+  int i, j, k;
+  int n = (int) queues->rays.size();
+  RayPacket packet;
+
+  /* The line tests write results for every ray of the last packet */
+  int size = (n+RAY_PACKET_SIZE-1)/RAY_PACKET_SIZE*RAY_PACKET_SIZE;
+  queues->distances.resize(size);
+  queues->hitObjects.resize(size);
+  queues->hits.resize(size);
+  for(i=0;i<n;i+=RAY_PACKET_SIZE) {
+    for(k=0;k<RAY_PACKET_SIZE;k++) {
+      packet.active[k] = i+k < n;
+      /* Unused rays repeat the first one to keep valid numbers */
+      QueuedRay *ray = &queues->rays[packet.active[k] ? i+k : i];
+      for(j=0;j<3;j++) {
+	packet.origin[j][k] = ray->origin[j];
+	packet.direction[j][k] = ray->direction[j];
+      }
+    }
+    bvh->lineTestPacket(&packet,MAX_DISTANCE,&queues->distances[i],&queues->hitObjects[i],&queues->hits[i]);
+  }
+
+  /* Misses see the background, hits are shaded in material order */
+  queues->shadeOrder.clear();
+  for(i=0;i<n;i++) {
+    QueuedRay *ray = &queues->rays[i];
+    PixelSample *sample = &samples[ray->sample];
+    HitRecord *hit = &queues->hits[i];
+    bool isHit = queues->hitObjects[i] != NULL;
+    if(primary) {
+      sample->object = isHit ? hit->object : NULL;
+      sample->distance = queues->distances[i];
+      if(isHit) {
+	assign(hit->normal,sample->normal);
+	normalize(sample->normal);
+      } else zero(sample->normal);
+    }
+    if(sample->path) sample->path->add(ray->origin,ray->direction,queues->distances[i]);
+    if(isHit) queues->shadeOrder.push_back(i);
+    else
+      for(j=0;j<3;j++) sample->rgb[j] += ray->weight[j]*background[j];
+  }
+  sort(queues->shadeOrder.begin(),queues->shadeOrder.end(),MaterialOrder(&queues->hits[0]));
+}
+void Raytracer::shadeStage(RayQueues *queues,PixelSample samples[],RenderContext *context) {
+  int i, k;
+  int c, n = (int) queues->shadeOrder.size();
+  LightChoice choices[MAX_LIGHT_CUT];
+
+  for(k=0;k<n;k++) {
+    int index = queues->shadeOrder[k];
+    QueuedRay *ray = &queues->rays[index];
+    HitRecord *hit = &queues->hits[index];
+    PixelSample *sample = &samples[ray->sample];
+
+    /* Same as shade, except that the light reaching the sample is
+       queued instead of traced */
+    Vec3<double> point = Vec3<double>(ray->origin) + Vec3<double>(ray->direction)*queues->distances[index];
+    Vec3<double> normal(hit->normal);
+    LightingProperties properties;
+    hit->material->getLightingProperties(hit->point,&properties,normal.v);
+    normal = normal.normalized();
+    Vec3<double> E = (-Vec3<double>(ray->direction)).normalized();
+
+    for(i=0;i<3;i++) sample->rgb[i] += ray->weight[i] * properties.ambient[i] * ambientLight[i];
+
+    int nChoices = lightTree->selectLights(point.v,normal.v,choices);
+    for(c=0;c<nChoices;c++) {
+      LightChoice *choice = &choices[c];
+      Light *light = choice->light;
+      Vec3<double> L = Vec3<double>(light->position) - point;
+      double lightDistance=L.length();
+      L = L/lightDistance;
+      double diffusePower = normal.dot(L);
+      /* Lights behind the surface add nothing, so there is no need
+	 to test if they are occluded */
+      if(diffusePower <= 0) continue;
+
+      QueuedShadowRay shadowRay;
+      shadowRay.light = light;
+      Vec3<double> RL = normal*(2.0 * L.dot(normal)) - L;
+      double specDot = RL.dot(E);
+      double specularPower = specDot > 0.0 ? choice->specular * pow(specDot, properties.shininess) : 0.0;
+      for(i=0;i<3;i++) {
+	shadowRay.origin[i] = point[i];
+	shadowRay.rgb[i] = ray->weight[i] * (diffusePower * choice->colour[i] * properties.diffuse[i] +
+					     specularPower * properties.specular[i]);
+      }
+      shadowRay.ignore = queues->hitObjects[index];
+      shadowRay.sample = ray->sample;
+      queues->shadowRays.push_back(shadowRay);
+    }
+
+    QueuedRay reflected;
+    if(continueRay(ray,point.v,properties.reflection,&reflected,context)) {
+      Vec3<double> R = normal*(2.0*E.dot(normal)) - E;
+      for(i=0;i<3;i++) {
+	reflected.origin[i] = point[i];
+	reflected.direction[i] = R[i];
+      }
+      queues->nextRays.push_back(reflected);
+      context->reflectionRays++;
+    }
+  }
+}
+void Raytracer::occlusionStage(RayQueues *queues,PixelSample samples[],RenderContext *context) {
+  int i, k;
+  int n = (int) queues->shadowRays.size();
+  for(k=0;k<n;k++) {
+    QueuedShadowRay *ray = &queues->shadowRays[k];
+    PixelSample *sample = &samples[ray->sample];
+    double visibility = lightVisibility(ray->light,ray->origin,ray->ignore,sample->path,context);
+    if(visibility == 0.0) continue;
+    for(i=0;i<3;i++) sample->rgb[i] += visibility * ray->rgb[i];
+  }
+}
+
+/* Area lights are probed with SHADOW_PROBES x SHADOW_PROBES feelers,
+   and points in the penumbra get SHADOW_SAMPLES x SHADOW_SAMPLES more */
+#define SHADOW_PROBES 2
+#define SHADOW_SAMPLES 8
+
+/* Gives a seed for the random numbers used at a point, so that the
+   same point always gets the same numbers whichever engine, thread or
+   frame computes it */
+static unsigned int pointSeed(double point[3]) {
+  int i;
+  unsigned int seed = 0;
+  for(i=0;i<3;i++) {
+    float coordinate = (float) point[i];
+    unsigned int bits;
+    memcpy(&bits,&coordinate,sizeof(bits));
+    seed = seed*0x9e3779b1 ^ bits;
+  }
+  return seed;
+}
+
+double Raytracer::lightVisibility(Light *light,double point[3],Object *ignore,RayPath *path,RenderContext *context) {
+  if(!light->hasArea()) return castFeelers(light,point,ignore,1,path,context);
+
+  /* The feelers are jittered with random numbers seeded by the point,
+     so that the shadows do not flicker */
+  context->setSeed(pointSeed(point));
+
+  int visible = castFeelers(light,point,ignore,SHADOW_PROBES,path,context);
+  if(visible == 0 || visible == SHADOW_PROBES*SHADOW_PROBES)
+    return visible / (double) (SHADOW_PROBES*SHADOW_PROBES);
+  /* The probes disagree, so we are in the penumbra */
+  visible += castFeelers(light,point,ignore,SHADOW_SAMPLES,path,context);
+  return visible / (double) (SHADOW_PROBES*SHADOW_PROBES + SHADOW_SAMPLES*SHADOW_SAMPLES);
+}
+int Raytracer::castFeelers(Light *light,double point[3],Object *ignore,int n,RayPath *path,RenderContext *context) {
+  int i, j, visible=0;
+  for(i=0;i<n;i++)
+    for(j=0;j<n;j++) {
+      Vec3<double> sample;
+      if(n == 1) light->getSample(point,0.5,0.5,sample.v);
+      else {
+	double u = (i+context->random())/n;
+	light->getSample(point,u,(j+context->random())/n,sample.v);
+      }
+      Vec3<double> L = sample - Vec3<double>(point);
+      double distance = L.length();
+      L = L/distance;
+      context->shadowRays++;
+      if(path) path->add(point,L.v,distance);
+      if(!bvh->occluded(point,L.v,distance,ignore)) visible++;
     }
+  return visible;
+}
+
+void Raytracer::clampColour(double rgb[3]) {
+  int i;
+  for(i=0;i<3;i++) if(rgb[i] > 1.0) rgb[i]=1.0; else if(rgb[i] < 0.0) rgb[i]=0.0;
+}
+void Raytracer::supersample(double x,double y,double size,PixelSample *sample,int depth,double rgb[3],RenderContext *context) {
+  int i,j;
+  double subX[4], subY[4], subRGB[3];
+  PixelSample subSamples[4];
+
+  if(depth <= 0) {
+    assign(sample->rgb,rgb);
+    clampColour(rgb);
+    return;
+  }
+  /* One ray in the middle of every quadrant */
+  for(i=0;i<4;i++) {
+    subX[i] = x + (i&1 ? 0.25 : -0.25)*size;
+    subY[i] = y + (i&2 ? 0.25 : -0.25)*size;
   }
+  raytrace(4,subX,subY,subSamples,context);
+
+  /* Only the quadrants that differ from the sample we already have
+     are refined further */
+  zero(rgb);
+  for(i=0;i<4;i++) {
+    if(subSamples[i].isSimilar(sample)) {
+      assign(subSamples[i].rgb,subRGB);
+      clampColour(subRGB);
+    } else
+      supersample(subX[i],subY[i],size/2.0,&subSamples[i],depth-1,subRGB,context);
+    for(j=0;j<3;j++) rgb[j] += 0.25*subRGB[j];
+  }
+}
+void Raytracer::raytrace(double origin[3], double direction[3], double rgb[3],double contribution,RenderContext *context) {
+  int i;
+  QueuedRay ray;
+
+  for(i=0;i<3;i++) {
+    ray.origin[i] = origin[i];
+    ray.direction[i] = direction[i];
+    ray.weight[i] = 1.0;
+  }
+  ray.contribution = contribution;
+  ray.depth = 0;
+  ray.sample = 0;
+  zero(rgb);
+  context->rayStack.push(ray);
+  traceStack(rgb,context);
+}
+void Raytracer::traceStack(double rgb[3],RenderContext *context) {
+  double closestDistance;
+  Object *closestObject;
+  HitRecord hit;
+  QueuedRay ray;
+
+  while(!context->rayStack.isEmpty()) {
+    context->rayStack.pop(&ray);
+    if(debugThisPixel) {
+      printDebugIndentation(); debugIndentation++; printf("-> Raytrace depth %d\n",ray.depth);
+    }
+
+    /* Find the closest object that intersects this ray. */
+    closestDistance = bvh->lineTest(ray.origin,ray.direction,MAX_DISTANCE,&closestObject,&hit);
+    if(context->path) context->path->add(ray.origin,ray.direction,closestDistance);
+    shade(&ray,closestDistance,closestObject,&hit,rgb,context);
+  }
+}
+
+/* Secondary rays contributing less than this to the pixel are ended,
+   or left to Russian roulette */
+#define MIN_CONTRIBUTION 0.05
+
+bool Raytracer::continueRay(QueuedRay *ray,double point[3],double factor[3],QueuedRay *next,RenderContext *context) {
+  int i;
+  double scale = 1.0;
+
+  if(ray->depth >= maxDepth) return false;
+  double contribution = ray->contribution*(0.4*factor[0]+0.4*factor[1]+0.2*factor[2]);
+  if(contribution <= MIN_CONTRIBUTION) {
+    if(!roulette || contribution <= 0.0) return false;
+    /* Keep the ray with a probability in proportion to its
+       contribution. The decision is seeded by the point, like the
+       shadow feelers, so it does not change between frames. */
+    double probability = contribution/MIN_CONTRIBUTION;
+    context->setSeed(pointSeed(point) + ray->depth);
+    if(context->random() >= probability) return false;
+    scale = 1.0/probability;
+    contribution = MIN_CONTRIBUTION;
+  }
+  for(i=0;i<3;i++) next->weight[i] = ray->weight[i]*factor[i]*scale;
+  next->contribution = contribution;
+  next->depth = ray->depth+1;
+  next->sample = ray->sample;
+  return true;
+}
+
+void Raytracer::shade(QueuedRay *ray,double closestDistance,Object *closestObject,HitRecord *hit,
+		      double rgb[3],RenderContext *context) {
+  int i, c;
+  double colour[3];
+  LightChoice choices[MAX_LIGHT_CUT];
 
   if(closestDistance >= MAX_DISTANCE) {
     /* No objects hit, assign background colour to ray instead. */
-    for(i=0;i<3;i++) rgb[i] = background[i];
+    for(i=0;i<3;i++) rgb[i] += ray->weight[i]*background[i];
     if(debugThisPixel) { debugIndentation--; printDebugIndentation(); printf("<- Miss\n"); }
     return;
   }
    
-  double point[3], normal[3];
-  for(i=0;i<3;i++) point[i] = origin[i]+closestDistance*direction[i];
-  closestObject->getNormal(point,normal);
+  Vec3<double> point = Vec3<double>(ray->origin) + Vec3<double>(ray->direction)*closestDistance;
+  Vec3<double> normal(hit->normal);
 
   /* Get lighting properties for this point */
   LightingProperties properties;
-  closestObject->getLightingProperties(point,&properties,normal);
-  normalize(normal);
+  hit->material->getLightingProperties(hit->point,&properties,normal.v);
+  normal = normal.normalized();
 
-  double E[3]; /* Vector towards eye. */
-  for(i=0;i<3;i++) E[i] = -direction[i];
-  normalize(E);
+  /* Vector towards eye. */
+  Vec3<double> E = (-Vec3<double>(ray->direction)).normalized();
 
   /* Now, compute the colour for this point */
   /* Ambient light first */
-  for(i=0;i<3;i++) rgb[i] = properties.ambient[i] * ambientLight[i];
-
-  /* Iterate over all the lights and add their colours to the rgb
-     colour using the Blinn-Phong shading model. */
-  for(lightIterator=lights->begin(),lightIteratorEnd=lights->end();
-      lightIterator!=lightIteratorEnd;lightIterator++) {
-    Light *light = *lightIterator;
-    double L[3]; /* Light vector */
-    sub(light->position,point,L); 
-    double lightDistance=length(L);
-    for(i=0;i<3;i++) L[i]=L[i]/lightDistance;
-    /* First, cast a shadow feeler */
-    for(objIterator=objects->begin(),objIteratorEnd=objects->end();
-	objIterator != objIteratorEnd;objIterator++) {
-      Object *object = *objIterator;
-      if(object == closestObject) 
-	/* For now, ignore shadows cast on ourselves */
-	continue; 
-      distance = object->lineTest(point,L,lightDistance);
-      if(distance < lightDistance) break;
-    }
-    if(objIterator != objIteratorEnd)
-      /* A shadow was found, so ignore this light */
-      continue; 
+  for(i=0;i<3;i++) colour[i] = properties.ambient[i] * ambientLight[i];
+  /* Iterate over the lights that matter for this point, and the
+     clusters standing in for groups of distant lights, and add their
+     colours to the colour using the Blinn-Phong shading model. */
+  int nChoices = lightTree->selectLights(point.v,normal.v,choices);
+  for(c=0;c<nChoices;c++) {
+    LightChoice *choice = &choices[c];
+    Light *light = choice->light;
+    /* Light vector */
+    Vec3<double> L = Vec3<double>(light->position) - point;
+    double lightDistance=L.length();
+    L = L/lightDistance;
 
     /*printf("L: %3.1f %3.1f %3.1f\n",L[0],L[1],L[2]);*/
-    double diffusePower = dotProduct(normal,L);
+    double diffusePower = normal.dot(L);
     if(diffusePower > 0) {
-      /* Light is shining on the front of the object. */
-      for(i=0;i<3;i++) rgb[i] += diffusePower * light->colour[i] * properties.diffuse[i];
+      /* Light is shining on the front of the object. Cast shadow
+	 feelers to see how much of the light reaches us. For now,
+	 ignore shadows cast on ourselves. */
+      double visibility = lightVisibility(light,point.v,closestObject,context->path,context);
+      if(visibility == 0.0)
+	/* A shadow was found, so ignore this light */
+	continue;
+      for(i=0;i<3;i++) colour[i] += visibility * diffusePower * choice->colour[i] * properties.diffuse[i];
 
-      double RL[3]; /* Reflection of light vector */
-      double LdotN = dotProduct(L,normal);
-      for(i=0;i<3;i++) RL[i] = 2.0 * LdotN * normal[i] - L[i];
+      /* Reflection of light vector */
+      Vec3<double> RL = normal*(2.0 * L.dot(normal)) - L;
 
-      double specDot=dotProduct(RL,E);
+      double specDot=RL.dot(E);
       if(specDot > 0.0) {
-	double specularPower = pow(specDot, properties.shininess);
+	double specularPower = visibility * choice->specular * pow(specDot, properties.shininess);
 	for(i=0;i<3;i++) {
-	  rgb[i] += specularPower * properties.specular[i];
+	  colour[i] += specularPower * properties.specular[i];
 	}
       }     
     } else {
@@ -164,24 +643,133 @@ void Raytracer::raytrace(double origin[3], double direction[3], double rgb[3],do
     }    
   }
 
-  /* Add light that is reflected on object */
-  double reflection = 0.4*properties.reflection[0]+0.4*properties.reflection[1]+0.2*properties.reflection[2];
-  if(contribution*reflection > 0.05) {
-    double rgbTmp[3];   /* Temporary colour for incoming light */
-    double R[3];        /* Reflection vector */
-    double s=2.0*dotProduct(E,normal);
-    double pointR[3];   /* From from where to trace */
+  for(i=0;i<3;i++) rgb[i] += ray->weight[i]*colour[i];
+
+  /* Queue the reflected ray, its colour is added to the pixel when
+     the engine pops it from the stack */
+  QueuedRay reflected;
+  if(continueRay(ray,point.v,properties.reflection,&reflected,context)) {
+    /* Reflection vector */
+    Vec3<double> R = normal*(2.0*E.dot(normal)) - E;
     for(i=0;i<3;i++) {
-      R[i]=s*normal[i] - E[i];
-      pointR[i]=point[i]+R[i]*1e-4;  /* To void numberical instability */
+      reflected.origin[i] = point[i];
+      reflected.direction[i] = R[i];
     }
-    /* Recurse on this ray to get incoming light level */
-    raytrace(point,R,rgbTmp,contribution*reflection);
-    /* Add the incomming light to the colour of this pixel */
-    for(i=0;i<3;i++) rgb[i] += rgbTmp[i]*properties.reflection[i];
+    context->reflectionRays++;
+    context->rayStack.push(reflected);
   }
 
   if(debugThisPixel) { 
-    debugIndentation--; printDebugIndentation(); printf("<- RGB %.1f %.1f %.1f\n",rgb[0],rgb[1],rgb[2]);
+    debugIndentation--; printDebugIndentation(); printf("<- RGB %.1f %.1f %.1f\n",colour[0],colour[1],colour[2]);
+  }
+}
+
+/* Paths are ended by Russian roulette after this many bounces, and
+   always after MAX_PATH_DEPTH bounces. The limit is needed since the
+   materials may reflect more light than they receive. */
+#define ROULETTE_DEPTH 2
+#define MAX_PATH_DEPTH 16
+
+void Raytracer::pathtrace(double x,double y,double rgb[3],RenderContext *context) {
+  int i, depth;
+  double origin[3], direction[3];
+  Vec3<double> throughput(1.0,1.0,1.0);
+
+  camera->getOrigin(origin);
+  camera->getPixelRays(1,&x,&y,&direction[0],&direction[1],&direction[2]);
+  context->primaryRays++;
+  zero(rgb);
+  for(depth=0;depth<MAX_PATH_DEPTH;depth++) {
+    Object *object;
+    HitRecord hit;
+    double distance = bvh->lineTest(origin,direction,MAX_DISTANCE,&object,&hit);
+    if(!object) {
+      for(i=0;i<3;i++) rgb[i] += throughput[i]*background[i];
+      break;
+    }
+
+    Vec3<double> point = Vec3<double>(origin) + Vec3<double>(direction)*distance;
+    Vec3<double> normal(hit.normal);
+    LightingProperties properties;
+    hit.material->getLightingProperties(hit.point,&properties,normal.v);
+    normal = normal.normalized();
+    Vec3<double> E = (-Vec3<double>(direction)).normalized();
+    /* Light is gathered on the side of the surface facing the ray */
+    if(normal.dot(E) < 0.0) normal = -normal;
+
+    /* Next event estimation, as in shade but with a single light
+       picked by the light tree. Its light is divided by the
+       probability of picking it. */
+    double probability;
+    Light *light = lightTree->sampleLight(point.v,normal.v,context->random(),&probability);
+    Vec3<double> L;
+    double lightDistance=0.0, diffusePower=0.0;
+    if(light) {
+      L = Vec3<double>(light->position) - point;
+      lightDistance=L.length();
+      L = L/lightDistance;
+      diffusePower = normal.dot(L);
+    }
+    if(diffusePower > 0) {
+      double attenuation = light->getAttenuation(lightDistance)/probability;
+      bool visible;
+      /* A single feeler towards a random point of area lights, the
+	 average over many paths gives the soft shadow */
+      if(light->hasArea()) {
+	Vec3<double> sample;
+	double u = context->random();
+	light->getSample(point.v,u,context->random(),sample.v);
+	Vec3<double> toSample = sample - point;
+	double sampleDistance = toSample.length();
+	toSample = toSample/sampleDistance;
+	context->shadowRays++;
+	visible = !bvh->occluded(point.v,toSample.v,sampleDistance,object);
+      } else {
+	context->shadowRays++;
+	visible = !bvh->occluded(point.v,L.v,lightDistance,object);
+      }
+      if(visible) {
+	Vec3<double> RL = normal*(2.0 * L.dot(normal)) - L;
+	double specDot = RL.dot(E);
+	double specularPower = specDot > 0.0 ? pow(specDot, properties.shininess) : 0.0;
+	for(i=0;i<3;i++)
+	  rgb[i] += throughput[i] * attenuation * (diffusePower * light->colour[i] * properties.diffuse[i] +
+						   specularPower * properties.specular[i]);
+      }
+    }
+
+    /* Choose the diffuse or the mirror lobe for the next ray. The
+       weights of the lobe are divided by the probability of choosing
+       it, which keeps the estimate unbiased. */
+    double diffuse = (properties.diffuse[0]+properties.diffuse[1]+properties.diffuse[2])/3.0;
+    double mirror = (properties.reflection[0]+properties.reflection[1]+properties.reflection[2])/3.0;
+    if(diffuse+mirror <= 0.0) break;
+    double diffuseProbability = diffuse/(diffuse+mirror);
+    Vec3<double> next;
+    if(context->random() < diffuseProbability) {
+      /* Cosine weighted direction around the normal. The cosine and
+	 the 1/pi of the Lambertian BRDF cancel against the
+	 probability density, leaving the diffuse colour as weight. */
+      Vec3<double> helper = fabs(normal[0]) < 0.5 ? Vec3<double>(1.0,0.0,0.0) : Vec3<double>(0.0,1.0,0.0);
+      Vec3<double> tangent = normal.cross(helper).normalized();
+      Vec3<double> bitangent = normal.cross(tangent);
+      double r = sqrt(context->random()), phi = 2.0*M_PI*context->random();
+      next = tangent*(r*cos(phi)) + bitangent*(r*sin(phi)) + normal*sqrt(MAX(0.0,1.0-r*r));
+      throughput = throughput.mul(Vec3<double>(properties.diffuse))/diffuseProbability;
+    } else {
+      next = normal*(2.0*E.dot(normal)) - E;
+      throughput = throughput.mul(Vec3<double>(properties.reflection))/(1.0-diffuseProbability);
+    }
+
+    /* Russian roulette */
+    if(depth >= ROULETTE_DEPTH) {
+      double survival = MIN(1.0,MAX(throughput[0],MAX(throughput[1],throughput[2])));
+      if(context->random() >= survival) break;
+      throughput = throughput/survival;
+    }
+
+    point.store(origin);
+    next.store(direction);
+    context->reflectionRays++;
   }
 }
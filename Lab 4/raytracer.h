@@ -37,6 +37,126 @@
 #include "light.h"
 #endif
 
+#ifndef BVH_H_
+#include "bvh.h"
+#endif
+
+#ifndef PACKET_H_
+#include "packet.h"
+#endif
+
+#ifndef COMPILER_H_
+#include "compiler.h"
+#endif
+
+#ifndef WAVEFRONT_H_
+#include "wavefront.h"
+#endif
+
+#ifndef LIGHTTREE_H_
+#include "lighttree.h"
+#endif
+
+#include <vector>
+
+/** \brief One straight ray of a RayPath, stored in single precision
+    to save memory. */
+class RaySegment {
+ public:
+  float origin[3], direction[3];
+  /** Distance to where the ray stopped, in multiples of direction */
+  float length;
+};
+
+/** \brief All rays that were traced to compute the colour of a pixel.
+
+    The colour of the pixel can only change if something in the scene
+    changes along one of these rays, which is used to find the pixels
+    that can be kept from the previous frame (see TemporalCache). */
+class RayPath {
+ public:
+  void clear();
+  /** Adds a ray going from origin until the given distance along
+      direction */
+  void add(double origin[3],double direction[3],double length);
+  /** Returns true if any of the rays pass through the axis aligned
+      box min/max */
+  bool intersects(double min[3],double max[3]);
+ private:
+  std::vector<RaySegment> segments;
+};
+
+/** \brief Per-thread state used while raytracing.
+
+    Every thread calling Raytracer::raytrace must pass its own
+    context, which lets the raytracer keep statistics without any
+    locking or thread indexed variables. Contexts of different threads
+    can be summed using RenderContext::add once rendering is done. */
+class RenderContext {
+ public:
+  RenderContext();
+  ~RenderContext();
+  /** Resets all statistics to zero */
+  void reset();
+  /** Adds the statistics from another context to this one */
+  void add(RenderContext *other);
+  /** Gives the total number of rays traced, of all kinds */
+  long getRayCount();
+
+  long primaryRays;
+  long shadowRays;
+  long reflectionRays;
+
+  /** If not NULL every ray traced is added to this path. Set by the
+      raytracer while tracing a PixelSample that has a path. */
+  RayPath *path;
+
+  /** Gives the queues of the wavefront engine, created on first use */
+  RayQueues *getQueues();
+  /** Secondary rays still to be traced by the recursive engine */
+  RayStack rayStack;
+
+  /** Restarts the random numbers given by random. The same seed
+      always gives the same numbers, whichever thread uses them. */
+  void setSeed(unsigned int seed);
+  /** Gives a uniformly distributed random number in [0,1) */
+  double random();
+ private:
+  RayQueues *queues;
+  unsigned int randomState;
+  /* Contexts own their queues and are not copied */
+  RenderContext(const RenderContext &);
+  RenderContext &operator=(const RenderContext &);
+};
+
+/** \brief Result of tracing one primary ray.
+
+    Besides the colour this holds what the ray hit, which is used to
+    find edges and other discontinuities in the image when
+    anti-aliasing. */
+class PixelSample {
+ public:
+  PixelSample();
+  /** Colour of the ray, not clamped */
+  double rgb[3];
+  /** The primitive that was hit, or NULL for the background */
+  Object *object;
+  /** Distance to the hit point */
+  double distance;
+  /** Unit length surface normal at the hit point */
+  double normal[3];
+  /** If not NULL all rays traced for this sample are stored here */
+  RayPath *path;
+
+  /** Returns false if the two samples hit different objects, or hit
+      them at very different distances or with very different normals,
+      or if their colours are too different. */
+  bool isSimilar(PixelSample *other);
+};
+
+/** Default limit of setMaxDepth */
+#define MAX_REFLECTION_DEPTH 16
+
 /** \brief Main class for performing all raytracing operations. 
 
     To use, instantiate this class and give it a scene graph using the
@@ -46,7 +166,8 @@
 
     Once ready to use, the actual raytracing operation can be
     performed by calling the raytracer function for every pixel on the
-    screen. 
+    screen. Before each frame, and after any changes to the objects,
+    prepareFrame must be called.
 
     Note that all objects are asssumed to be reentrant during the
     raytracring (ie. they should not change any internal state
@@ -55,6 +176,9 @@
 */
 class Raytracer {
  public:
+  /** How the rays of many samples are traced, see setEngine */
+  enum Engine { Recursive, Wavefront };
+
   Raytracer();
   ~Raytracer();
 
@@ -75,6 +199,45 @@ class Raytracer {
   /** \brief Gives the camera object currently used. */
   Camera *getCamera();
 
+  /** \brief Selects if the scene is compiled by a SceneCompiler
+      (the default) or traced through the virtual functions of the
+      objects. Takes effect at the next prepareFrame. */
+  void setCompileScene(bool compile);
+
+  /** \brief Selects how raytrace traces the rays of many samples.
+
+      The Recursive engine (the default) traces the samples in packets
+      of primary rays and follows every ray depth first. The Wavefront
+      engine traces all samples together one generation of rays at a
+      time, see RayQueues. Both give the same colours. */
+  void setEngine(Engine engine);
+  /** Parses "recursive" or "wavefront", returns false for unknown
+      names. */
+  bool setEngine(const char *name);
+
+  /** \brief Sets how many times rays may be reflected (default
+      MAX_REFLECTION_DEPTH).
+
+      Reflected rays are also ended when they contribute less than 5%
+      to the pixel. With Russian roulette (off by default) such rays
+      are instead continued at random, with a probability in
+      proportion to their contribution and the weight raised to make
+      up for the rays that were ended. This removes the bias of
+      cutting them off, at the price of some noise. */
+  void setMaxDepth(int depth);
+  void setRussianRoulette(bool roulette);
+
+  /** \brief Prepares the scene for rendering a new frame.
+
+      Lets every object update its lazily computed data (see
+      Object::prepare), compiles the scene and rebuilds the bounding
+      volume hierarchy over all objects and the LightTree over all
+      lights. Must be called after objects
+      have been added or modified (eg. by moving a Transform) and
+      before raytracing the next frame. It may not be
+      called while other threads are raytracing. */
+  void prepareFrame();
+
   /** Basic raytracing routine that computes a colour to assign to a
   ray originating in origin with the given direction. If no
   intersecting objects are found then it assigns the background colour
@@ -83,19 +246,105 @@ class Raytracer {
   
   Contribution is a hint for how much the resuling colours will
   contribute to the screen pixels and can be used to limit recursion. 
+  The context must belong to the calling thread. Reflected rays are
+  traced from the RayStack of the context instead of by recursion.
   */
-  void raytrace(double origin[3],double direction[3],double rgb[3],double contribution);
+  void raytrace(double origin[3],double direction[3],double rgb[3],double contribution,RenderContext *context);
   /** Special case of general raytracing routine for screen pixel
       X,Y. Fetches the origin/direction from the current camera
       settings. */
-  void raytrace(int x, int y,double rgb[3]);
+  void raytrace(int x, int y,double rgb[3],RenderContext *context);
+  /** Raytraces the n screen positions x[i],y[i] and assigns the
+      results to samples[i], using the engine selected by
+      setEngine. The rays of every sample with a path are recorded in
+      it. The positions are given in pixels but need not be
+      integers. The primary rays are traced together as RayPackets
+      which is considerably faster than tracing them one by one,
+      especially if neighbouring positions are close to each other. */
+  void raytrace(int n,double x[],double y[],PixelSample samples[],RenderContext *context);
+
+  /** Adaptive supersampling of the square with the given center and
+      size, in pixels. The square is split into four quadrants with
+      one new ray each. Quadrants whose sample is not similar to the
+      given sample at the center are split again until depth levels
+      have been used. Assigns the average colour,
+      with every sample clamped to [0,1], to rgb. */
+  void supersample(double x,double y,double size,PixelSample *sample,int depth,double rgb[3],RenderContext *context);
+
+  /** Computes one Monte Carlo estimate of the light reaching the
+      camera through the screen position x,y, given in pixels, and
+      assigns it to rgb.
+
+      Unlike raytrace this includes the indirect light bouncing
+      between the objects. At every hit the lights are sampled
+      directly with shadow feelers (next event estimation) using the
+      same light model as raytrace. The path then continues in a
+      cosine distributed direction around the normal or in the
+      mirror direction, chosen randomly in proportion to the diffuse
+      and reflection colours. After the first bounces the path is
+      ended by Russian roulette, with a probability given by how
+      little it can still contribute. The ambient light is not used,
+      the indirect light takes its place.
+
+      The random numbers are taken from the context, which should be
+      seeded for the sample. Averaging many estimates converges to
+      the image, see the -pathtrace option. */
+  void pathtrace(double x,double y,double rgb[3],RenderContext *context);
  private:
+  /** The recursive engine for at most RAY_PACKET_SIZE samples */
+  void tracePacket(int n,double x[],double y[],PixelSample samples[],RenderContext *context);
+  /** The wavefront engine for any number of samples */
+  void traceWavefront(int n,double x[],double y[],PixelSample samples[],RenderContext *context);
+  /* Stages of the wavefront engine, for the current generation */
+  void intersectStage(RayQueues *queues,PixelSample samples[],bool primary);
+  void shadeStage(RayQueues *queues,PixelSample samples[],RenderContext *context);
+  void occlusionStage(RayQueues *queues,PixelSample samples[],RenderContext *context);
+
+  /** Gives the fraction of the light visible from point, which lies
+      on the surface of the object ignore. Point lights need one
+      shadow feeler. Area lights are first probed with
+      SHADOW_PROBES^2 stratified feelers, and only if some but not all
+      of them are occluded, ie. in the penumbra, with SHADOW_SAMPLES^2
+      more. The feelers are recorded in path if not NULL. */
+  double lightVisibility(Light *light,double point[3],Object *ignore,RayPath *path,RenderContext *context);
+  /** Sends n x n stratified feelers towards the light, see
+      lightVisibility, and returns how many were not occluded */
+  int castFeelers(Light *light,double point[3],Object *ignore,int n,RayPath *path,RenderContext *context);
+
+  /** Traces the rays on the RayStack of the context until it is
+      empty, adding their colours to rgb */
+  void traceStack(double rgb[3],RenderContext *context);
+  /** Adds the colour of a ray, times its weight, to rgb given the
+      closest object it hit at the given distance and the hit record
+      filled in by the line test, or the background if object is
+      NULL. The reflected ray is pushed onto the RayStack of the
+      context. */
+  void shade(QueuedRay *ray,double distance,Object *object,HitRecord *hit,
+	     double rgb[3],RenderContext *context);
+  /** Decides if a ray hitting point should go on with a secondary ray
+      whose weight is that of the ray times factor, see setMaxDepth.
+      If so fills in the weight, contribution, depth and sample of
+      next and returns true. */
+  bool continueRay(QueuedRay *ray,double point[3],double factor[3],QueuedRay *next,RenderContext *context);
+  /** Clamps every component of rgb to [0,1] */
+  static void clampColour(double rgb[3]);
+
   Camera *camera;
   double background[3];
   double ambientLight[3];
 
   class std::set<Light*> *lights;
   class std::set<Object*> *objects;
+
+  /** Acceleration structure over all objects, updated by prepareFrame */
+  BVH *bvh;
+  /** Flattened version of the objects, or NULL if not compiling */
+  SceneCompiler *compiler;
+  /** Hierarchy over all lights, updated by prepareFrame */
+  LightTree *lightTree;
+  Engine engine;
+  int maxDepth;
+  bool roulette;
 };
 
 #endif 	    /* !RAYTRACER_H_ */
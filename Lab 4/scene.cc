@@ -0,0 +1,973 @@
+/** \file scene.cc
+    \brief Implements the parser, the cache and the builder of scene
+    files.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "scene.h"
+#include "raytracer.h"
+#include "camera.h"
+#include "light.h"
+#include "material.h"
+#include "sphere.h"
+#include "plane.h"
+#include "cone.h"
+#include "csg.h"
+#include "transform.h"
+#include "trianglemesh.h"
+#include <sys/stat.h>
+#if defined(LINUX) || defined(DARWIN)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#define SCENE_CACHE_MAGIC "RTSCENE"
+#define SCENE_BYTE_ORDER 0x01020304
+/* Doubles of the LightingProperties: ambient, diffuse, specular,
+   shininess and reflection */
+#define SCENE_PROPERTY_VALUES 13
+
+/* Number of arguments of every command, -1 if it varies */
+static const int commandArgs[] = {
+  9, 3, 3,
+  7, 8, 13,
+  SCENE_PROPERTY_VALUES,
+  1, 3, 0,
+  2, -1,
+  1, 4, 0, 1,
+  0, 0, 0,
+  0, 0, 0,
+  3, 3, 1, 1, 1,
+  1, 0
+};
+
+SceneFile::SceneFile() {
+  mapped=NULL;
+  mappedSize=0;
+  fileHandle=NULL;
+  mappingHandle=NULL;
+  hasCamera=false;
+  fromCache=false;
+  clear();
+}
+SceneFile::~SceneFile() { unmapCache(); }
+
+void SceneFile::clear() {
+  commands=NULL; args=NULL; strings=NULL; dependencies=NULL;
+  nCommands=nArgs=stringBytes=nDependencies=0;
+  commandList.clear(); argList.clear(); stringList.clear(); dependencyList.clear();
+  meshes.clear();
+  tokens.clear();
+  position=0;
+  propertyNames.clear();
+  materialNames.clear();
+}
+
+bool SceneFile::loadedFromCache() { return fromCache; }
+Transform *SceneFile::getTransform(const char *name) {
+  map<string,Transform*>::iterator it = transforms.find(name);
+  return it == transforms.end() ? NULL : it->second;
+}
+bool SceneFile::getCamera(double origin[3],double focus[3]) {
+  if(!hasCamera) return false;
+  assign(cameraOrigin,origin);
+  assign(cameraFocus,focus);
+  return true;
+}
+
+bool SceneFile::load(const char *filename,Raytracer *raytracer,bool useCache) {
+  string cacheName = string(filename) + ".cache";
+  bool ok;
+  int i;
+
+  unmapCache();
+  clear();
+  transforms.clear();
+  hasCamera=false;
+  fromCache=false;
+  sourceName=filename;
+  if(useCache && readCache(cacheName.c_str())) fromCache=true;
+  else {
+    /* Meshes read before the cache turned out to be stale */
+    for(i=0;i<(int)meshes.size();i++) delete meshes[i];
+    unmapCache();
+    clear();
+    if(!parse(filename)) return false;
+    if(useCache && !writeCache(cacheName.c_str()))
+      printf("Warning - could not write the scene cache '%s'\n",cacheName.c_str());
+  }
+  ok = build(raytracer);
+  unmapCache();
+  clear();
+  return ok;
+}
+
+/*                         Parsing of the text                        */
+
+bool SceneFile::parse(const char *filename) {
+  int i;
+
+  /* Meshes are found relative to the directory of the scene */
+  directory = filename;
+  for(i=directory.size()-1;i>=0;i--)
+    if(directory[i] == '/' || directory[i] == '\\') break;
+  directory = directory.substr(0,i+1);
+
+  if(!addDependency(filename) || !tokenize(filename)) return false;
+  while(position < (int)tokens.size())
+    if(!parseStatement()) return false;
+  commands = commandList.empty() ? NULL : &commandList[0];
+  args = argList.empty() ? NULL : &argList[0];
+  strings = stringList.empty() ? NULL : &stringList[0];
+  dependencies = &dependencyList[0];
+  nCommands = commandList.size();
+  nArgs = argList.size();
+  stringBytes = stringList.size();
+  nDependencies = dependencyList.size();
+  return true;
+}
+
+bool SceneFile::tokenize(const char *filename) {
+  FILE *fp = fopen(filename,"rb");
+  if(!fp) {
+    printf("Error - could not open the scene '%s'\n",filename);
+    return false;
+  }
+  vector<char> text;
+  char buffer[4096];
+  size_t n;
+  while((n = fread(buffer,1,sizeof(buffer),fp)) > 0) text.insert(text.end(),buffer,buffer+n);
+  fclose(fp);
+
+  int line=1;
+  size_t i=0;
+  while(i < text.size()) {
+    char c = text[i];
+    if(c == '\n') { line++; i++; }
+    else if(isspace((unsigned char) c)) i++;
+    else if(c == '#') { while(i < text.size() && text[i] != '\n') i++; }
+    else {
+      Token token;
+      token.line = line;
+      token.quoted = c == '"';
+      if(token.quoted) {
+	for(i++;i < text.size() && text[i] != '"';i++) {
+	  if(text[i] == '\n') break;
+	  token.text += text[i];
+	}
+	if(i >= text.size() || text[i] != '"') {
+	  printf("%s:%d: Missing \" at the end of the line\n",filename,line);
+	  return false;
+	}
+	i++;
+      } else if(c == '{' || c == '}') {
+	token.text = c;
+	i++;
+      } else {
+	while(i < text.size() && !isspace((unsigned char) text[i]) && text[i] != '{' && text[i] != '}' && text[i] != '#')
+	  token.text += text[i++];
+      }
+      tokens.push_back(token);
+    }
+  }
+  return true;
+}
+
+bool SceneFile::error(const char *message) {
+  int line = tokens.empty() ? 0 : tokens[MIN(position,(int)tokens.size()-1)].line;
+  printf("%s:%d: %s\n",sourceName.c_str(),line,message);
+  return false;
+}
+
+bool SceneFile::peek(const char *word) {
+  if(position >= (int)tokens.size() || tokens[position].quoted || tokens[position].text != word) return false;
+  position++;
+  return true;
+}
+bool SceneFile::expect(const char *word) {
+  if(peek(word)) return true;
+  return error((string("Expected '") + word + "'").c_str());
+}
+bool SceneFile::readWord(string *word) {
+  if(position >= (int)tokens.size()) return error("Unexpected end of the file");
+  const Token &token = tokens[position];
+  if(!token.quoted && (token.text == "{" || token.text == "}"))
+    return error((string("Unexpected '") + token.text + "'").c_str());
+  *word = token.text;
+  position++;
+  return true;
+}
+bool SceneFile::readNumber(double *value) {
+  char *end;
+  if(position >= (int)tokens.size()) return error("Expected a number at the end of the file");
+  const Token &token = tokens[position];
+  *value = strtod(token.text.c_str(),&end);
+  if(token.quoted || token.text.empty() || *end != 0)
+    return error((string("Expected a number instead of '") + token.text + "'").c_str());
+  /* strtod also reads nan and inf, which no object can be built from.
+     Both give NaN here. */
+  if(*value - *value != 0.0)
+    return error((string("Expected a finite number instead of '") + token.text + "'").c_str());
+  position++;
+  return true;
+}
+bool SceneFile::readNumbers(int n) {
+  int i;
+  double value;
+  for(i=0;i<n;i++) {
+    if(!readNumber(&value)) return false;
+    argList.push_back(value);
+  }
+  return true;
+}
+bool SceneFile::readName(map<string,int> *names,const char *kind,double *index) {
+  string name;
+  if(!readWord(&name)) return false;
+  map<string,int>::iterator it = names->find(name);
+  if(it == names->end()) {
+    position--;
+    return error((string("Unknown ") + kind + " '" + name + "'").c_str());
+  }
+  *index = it->second;
+  return true;
+}
+
+void SceneFile::addCommand(int op,int nArgs,int name) {
+  Command command;
+  command.op = op;
+  command.firstArg = argList.size()-nArgs;
+  command.nArgs = nArgs;
+  command.name = name;
+  commandList.push_back(command);
+}
+int SceneFile::addString(const char *text) {
+  int offset = stringList.size();
+  stringList.insert(stringList.end(),text,text+strlen(text)+1);
+  return offset;
+}
+bool SceneFile::addDependency(const char *filename) {
+  struct stat info;
+  if(stat(filename,&info) != 0) {
+    printf("Error - could not find '%s'\n",filename);
+    return false;
+  }
+  Dependency dependency;
+  dependency.size = info.st_size;
+  dependency.modified = info.st_mtime;
+  dependency.name = addString(filename);
+  dependency.pad = 0;
+  dependencyList.push_back(dependency);
+  return true;
+}
+
+static bool isObject(const string &word) {
+  return word == "sphere" || word == "plane" || word == "cone" || word == "mesh" || word == "transform" ||
+    word == "intersection" || word == "union" || word == "difference" || word == "inverse";
+}
+
+bool SceneFile::parseStatement() {
+  int i;
+  const Token &token = tokens[position];
+  if(!token.quoted && isObject(token.text)) return parseObject();
+  position++;
+  if(token.quoted) return error((string("Unexpected \"") + token.text + "\"").c_str());
+  if(token.text == "camera") {
+    double values[9] = { 0.0, 0.0, 4.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0 };
+    while(1) {
+      double *v;
+      if(peek("origin")) v = values;
+      else if(peek("focus")) v = values+3;
+      else if(peek("up")) v = values+6;
+      else break;
+      for(i=0;i<3;i++) if(!readNumber(&v[i])) return false;
+    }
+    for(i=0;i<9;i++) argList.push_back(values[i]);
+    addCommand(SCENE_CAMERA,9,-1);
+    return true;
+  }
+  if(token.text == "ambient" || token.text == "background") {
+    if(!readNumbers(3)) return false;
+    addCommand(token.text == "ambient" ? SCENE_AMBIENT : SCENE_BACKGROUND,3,-1);
+    return true;
+  }
+  if(token.text == "light") return parseLight();
+  if(token.text == "properties") return parseProperties();
+  if(token.text == "material") return parseMaterial();
+  position--;
+  return error((string("Unknown statement '") + token.text + "'").c_str());
+}
+
+bool SceneFile::parseLight() {
+  int i;
+  string kind;
+  double position[3], colour[3], edge1[3], edge2[3], radius=-1.0, falloff=0.0;
+  bool hasPosition=false, hasColour=false, hasEdges=false;
+
+  if(!readWord(&kind)) return false;
+  if(kind != "point" && kind != "sphere" && kind != "rectangle") {
+    this->position--;
+    return error((string("Unknown kind of light '") + kind + "'").c_str());
+  }
+  while(1) {
+    if(peek("position")) { for(i=0;i<3;i++) if(!readNumber(&position[i])) return false; hasPosition=true; }
+    else if(peek("colour")) { for(i=0;i<3;i++) if(!readNumber(&colour[i])) return false; hasColour=true; }
+    else if(peek("radius")) { if(!readNumber(&radius)) return false; }
+    else if(peek("falloff")) { if(!readNumber(&falloff)) return false; }
+    else if(peek("edge1")) { for(i=0;i<3;i++) if(!readNumber(&edge1[i])) return false; hasEdges=true; }
+    else if(peek("edge2")) { for(i=0;i<3;i++) if(!readNumber(&edge2[i])) return false; hasEdges=true; }
+    else break;
+  }
+  if(!hasPosition || !hasColour) return error("A light needs a position and a colour");
+  for(i=0;i<3;i++) argList.push_back(position[i]);
+  if(kind == "sphere") {
+    if(radius <= 0.0) return error("A sphere light needs a positive radius");
+    argList.push_back(radius);
+  } else if(kind == "rectangle") {
+    if(!hasEdges) return error("A rectangle light needs edge1 and edge2");
+    for(i=0;i<3;i++) argList.push_back(edge1[i]);
+    for(i=0;i<3;i++) argList.push_back(edge2[i]);
+  }
+  for(i=0;i<3;i++) argList.push_back(colour[i]);
+  argList.push_back(falloff);
+  if(kind == "point") addCommand(SCENE_POINT_LIGHT,7,-1);
+  else if(kind == "sphere") addCommand(SCENE_SPHERE_LIGHT,8,-1);
+  else addCommand(SCENE_RECTANGLE_LIGHT,13,-1);
+  return true;
+}
+
+bool SceneFile::parseProperties() {
+  int i;
+  string name;
+  double values[SCENE_PROPERTY_VALUES];
+
+  if(!readWord(&name)) return false;
+  if(propertyNames.find(name) != propertyNames.end()) {
+    position--;
+    return error((string("The properties '") + name + "' are already defined").c_str());
+  }
+  for(i=0;i<SCENE_PROPERTY_VALUES;i++) values[i]=0.0;
+  while(1) {
+    int first, count=3;
+    if(peek("ambient")) first=0;
+    else if(peek("diffuse")) first=3;
+    else if(peek("specular")) first=6;
+    else if(peek("shininess")) { first=9; count=1; }
+    else if(peek("reflection")) first=10;
+    else break;
+    for(i=0;i<count;i++) if(!readNumber(&values[first+i])) return false;
+  }
+  int index = propertyNames.size();
+  propertyNames[name] = index;
+  for(i=0;i<SCENE_PROPERTY_VALUES;i++) argList.push_back(values[i]);
+  addCommand(SCENE_PROPERTIES,SCENE_PROPERTY_VALUES,-1);
+  return true;
+}
+
+bool SceneFile::parseMaterial() {
+  string name, kind;
+  double value;
+
+  if(!readWord(&name)) return false;
+  if(materialNames.find(name) != materialNames.end()) {
+    position--;
+    return error((string("The material '") + name + "' is already defined").c_str());
+  }
+  if(!readWord(&kind)) return false;
+  if(kind == "simple") {
+    if(!readName(&propertyNames,"properties",&value)) return false;
+    argList.push_back(value);
+    addCommand(SCENE_SIMPLE_MATERIAL,1,-1);
+  } else if(kind == "checkerboard") {
+    if(!readNumbers(1)) return false;
+    if(!readName(&propertyNames,"properties",&value)) return false;
+    argList.push_back(value);
+    if(!readName(&propertyNames,"properties",&value)) return false;
+    argList.push_back(value);
+    addCommand(SCENE_CHECKERBOARD_MATERIAL,3,-1);
+  } else if(kind == "noise") {
+    addCommand(SCENE_NOISE_MATERIAL,0,-1);
+  } else if(kind == "wood") {
+    if(!readName(&propertyNames,"properties",&value)) return false;
+    argList.push_back(value);
+    if(!readName(&propertyNames,"properties",&value)) return false;
+    argList.push_back(value);
+    addCommand(SCENE_WOOD_MATERIAL,2,-1);
+  } else if(kind == "map") {
+    int nNodes=0;
+    if(peek("noise")) argList.push_back(MaterialMap::Noise);
+    else if(peek("gradient")) argList.push_back(MaterialMap::GradientNoise);
+    else return error("Expected the function of the map, noise or gradient");
+    if(!expect("{")) return false;
+    while(!peek("}")) {
+      if(++nNodes > MAX_MATERIAL_MAP_NODES) return error("Too many nodes in the map");
+      if(!readNumbers(1)) return false;
+      if(!readName(&propertyNames,"properties",&value)) return false;
+      argList.push_back(value);
+    }
+    addCommand(SCENE_MATERIAL_MAP,1+2*nNodes,-1);
+  } else {
+    position--;
+    return error((string("Unknown kind of material '") + kind + "'").c_str());
+  }
+  int index = materialNames.size();
+  materialNames[name] = index;
+  return true;
+}
+
+bool SceneFile::parseObject() {
+  string kind = tokens[position++].text;
+
+  if(kind == "sphere") {
+    if(!readNumbers(1)) return false;
+    if(argList.back() <= 0.0) {
+      position--;
+      return error("A sphere needs a positive radius");
+    }
+    addCommand(SCENE_SPHERE,1,-1);
+    return parseModifiers(true);
+  }
+  if(kind == "plane") {
+    if(!readNumbers(4)) return false;
+    addCommand(SCENE_PLANE,4,-1);
+    return parseModifiers(true);
+  }
+  if(kind == "cone") {
+    addCommand(SCENE_CONE,0,-1);
+    return parseModifiers(true);
+  }
+  if(kind == "mesh") {
+    string name;
+    if(!readWord(&name)) return false;
+    bool absolute = name[0] == '/' || name[0] == '\\' || (name.size() > 1 && name[1] == ':');
+    if(!absolute) name = directory + name;
+    if(!addDependency(name.c_str())) { position--; return error("Could not load the mesh"); }
+    TriangleMesh *mesh = TriangleMesh::loadAC3D(name.c_str());
+    if(!mesh) { position--; return error("Could not load the mesh"); }
+    mesh->prepare();
+    argList.push_back(meshes.size());
+    meshes.push_back(mesh);
+    addCommand(SCENE_MESH,1,-1);
+    return parseModifiers(true);
+  }
+
+  /* The groups */
+  int op, nObjects=0;
+  if(kind == "transform") op = SCENE_BEGIN_TRANSFORM;
+  else if(kind == "intersection") op = SCENE_BEGIN_INTERSECTION;
+  else if(kind == "union") op = SCENE_BEGIN_UNION;
+  else if(kind == "difference") op = SCENE_BEGIN_DIFFERENCE;
+  else op = SCENE_BEGIN_INVERSE;
+  if(!expect("{")) return false;
+  addCommand(op,0,-1);
+  while(!peek("}")) {
+    if(position >= (int)tokens.size()) return error((string("Missing '}' at the end of the ") + kind).c_str());
+    const Token &token = tokens[position];
+    if(op == SCENE_BEGIN_TRANSFORM && !token.quoted) {
+      int transformOp = -1, n = 3;
+      if(token.text == "translate") transformOp = SCENE_TRANSLATE;
+      else if(token.text == "scale") transformOp = SCENE_SCALE;
+      else if(token.text == "rotatex") { transformOp = SCENE_ROTATE_X; n = 1; }
+      else if(token.text == "rotatey") { transformOp = SCENE_ROTATE_Y; n = 1; }
+      else if(token.text == "rotatez") { transformOp = SCENE_ROTATE_Z; n = 1; }
+      if(transformOp != -1) {
+	position++;
+	if(!readNumbers(n)) return false;
+	addCommand(transformOp,n,-1);
+	continue;
+      }
+    }
+    if(token.quoted || !isObject(token.text))
+      return error((string("Expected an object in the ") + kind + " instead of '" + token.text + "'").c_str());
+    if(!parseObject()) return false;
+    nObjects++;
+  }
+  if(nObjects == 0 || (op == SCENE_BEGIN_INVERSE && nObjects != 1)) {
+    position--;
+    return error(op == SCENE_BEGIN_INVERSE ? "An inverse needs exactly one object" :
+		 (string("The ") + kind + " has no objects").c_str());
+  }
+  addCommand(SCENE_END,0,-1);
+  return parseModifiers(false);
+}
+
+bool SceneFile::parseModifiers(bool primitive) {
+  double value;
+  string name;
+  while(1) {
+    if(peek("material")) {
+      if(!primitive) {
+	position--;
+	return error("Only spheres, planes, cones and meshes can be given a material");
+      }
+      if(!readName(&materialNames,"material",&value)) return false;
+      argList.push_back(value);
+      addCommand(SCENE_SET_MATERIAL,1,-1);
+    } else if(peek("name")) {
+      if(!readWord(&name)) return false;
+      addCommand(SCENE_NAME,0,addString(name.c_str()));
+    } else return true;
+  }
+}
+
+/*                              The cache                             */
+
+#if defined(LINUX) || defined(DARWIN)
+static const char *mapFile(const char *filename,long long *size,void **fileHandle,void **mappingHandle) {
+  int fd = open(filename,O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat info;
+  void *data = NULL;
+  if(fstat(fd,&info) == 0 && info.st_size > 0) {
+    data = mmap(NULL,info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(data == MAP_FAILED) data = NULL;
+    *size = info.st_size;
+  }
+  /* The mapping stays valid after the file is closed */
+  close(fd);
+  *fileHandle = *mappingHandle = NULL;
+  return (const char*) data;
+}
+static void unmapFile(const char *data,long long size,void *fileHandle,void *mappingHandle) {
+  munmap((void*) data,size);
+}
+#else
+static const char *mapFile(const char *filename,long long *size,void **fileHandle,void **mappingHandle) {
+  HANDLE file = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if(file == INVALID_HANDLE_VALUE) return NULL;
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = NULL;
+  void *data = NULL;
+  if(GetFileSizeEx(file,&fileSize) && fileSize.QuadPart > 0) {
+    mapping = CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+    if(mapping) data = MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+    *size = fileSize.QuadPart;
+  }
+  if(!data) {
+    if(mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return NULL;
+  }
+  *fileHandle = file;
+  *mappingHandle = mapping;
+  return (const char*) data;
+}
+static void unmapFile(const char *data,long long size,void *fileHandle,void *mappingHandle) {
+  UnmapViewOfFile(data);
+  CloseHandle((HANDLE) mappingHandle);
+  CloseHandle((HANDLE) fileHandle);
+}
+#endif
+
+void SceneFile::unmapCache() {
+  if(mapped) unmapFile(mapped,mappedSize,fileHandle,mappingHandle);
+  mapped=NULL;
+  mappedSize=0;
+}
+
+/* True if count items of the given size at offset fit in a file of
+   the given size */
+static bool inFile(long long offset,long long count,long long itemSize,long long fileSize) {
+  return offset >= (long long) sizeof(long long) && offset % 8 == 0 && count >= 0 && offset + count*itemSize <= fileSize;
+}
+
+bool SceneFile::readCache(const char *cacheName) {
+  int i;
+  mapped = mapFile(cacheName,&mappedSize,&fileHandle,&mappingHandle);
+  if(!mapped) return false;
+  if(mappedSize < (long long) sizeof(CacheHeader)) return false;
+  const CacheHeader *header = (const CacheHeader*) mapped;
+  if(memcmp(header->magic,SCENE_CACHE_MAGIC,8) != 0 || header->version != SCENE_CACHE_VERSION ||
+     header->byteOrder != SCENE_BYTE_ORDER || header->end != mappedSize) return false;
+  if(!inFile(header->dependencies,header->nDependencies,sizeof(Dependency),mappedSize) ||
+     !inFile(header->commands,header->nCommands,sizeof(Command),mappedSize) ||
+     !inFile(header->args,header->nArgs,sizeof(double),mappedSize) ||
+     !inFile(header->strings,header->stringBytes,1,mappedSize) ||
+     !inFile(header->meshes,header->nMeshes,sizeof(CacheMesh),mappedSize)) return false;
+
+  dependencies = (const Dependency*) (mapped + header->dependencies);
+  commands = (const Command*) (mapped + header->commands);
+  args = (const double*) (mapped + header->args);
+  strings = mapped + header->strings;
+  nDependencies = header->nDependencies;
+  nCommands = header->nCommands;
+  nArgs = header->nArgs;
+  stringBytes = header->stringBytes;
+  if(stringBytes > 0 && strings[stringBytes-1] != 0) return false;
+  for(i=0;i<nDependencies;i++)
+    if(dependencies[i].name < 0 || dependencies[i].name >= stringBytes) return false;
+  if(nDependencies == 0 || dependenciesChanged()) return false;
+
+  const CacheMesh *cacheMeshes = (const CacheMesh*) (mapped + header->meshes);
+  for(i=0;i<header->nMeshes;i++)
+    if(!readCacheMesh(&cacheMeshes[i])) return false;
+  return true;
+}
+
+bool SceneFile::dependenciesChanged() {
+  int i;
+  struct stat info;
+  for(i=0;i<nDependencies;i++) {
+    if(stat(strings+dependencies[i].name,&info) != 0 ||
+       info.st_size != dependencies[i].size || info.st_mtime != dependencies[i].modified) return true;
+  }
+  return false;
+}
+
+bool SceneFile::readCacheMesh(const CacheMesh *cached) {
+  int i, k;
+  if(cached->nVertices < 0 || cached->nTriangles < 0 || cached->nMaterials < 0 || cached->nNodes < 0 ||
+     !inFile(cached->vertices,3*cached->nVertices,sizeof(float),mappedSize) ||
+     !inFile(cached->indices,3*cached->nTriangles,sizeof(int),mappedSize) ||
+     !inFile(cached->triangleMaterials,cached->nTriangles,sizeof(int),mappedSize) ||
+     !inFile(cached->materials,cached->nMaterials,(SCENE_PROPERTY_VALUES+1)*sizeof(double),mappedSize) ||
+     !inFile(cached->nodes,cached->nNodes,sizeof(TriangleMesh::Node),mappedSize)) return false;
+
+  const float *vertices = (const float*) (mapped + cached->vertices);
+  const int *indices = (const int*) (mapped + cached->indices);
+  const int *triangleMaterials = (const int*) (mapped + cached->triangleMaterials);
+  const double *materials = (const double*) (mapped + cached->materials);
+  const TriangleMesh::Node *nodes = (const TriangleMesh::Node*) (mapped + cached->nodes);
+
+  /* Check all indices, so a damaged cache can not crash the tracing */
+  for(i=0;i<3*cached->nTriangles;i++)
+    if(indices[i] < 0 || indices[i] >= cached->nVertices) return false;
+  for(i=0;i<cached->nTriangles;i++)
+    if(triangleMaterials[i] < 0 || triangleMaterials[i] >= cached->nMaterials) return false;
+  for(i=0;i<cached->nNodes;i++) {
+    if(nodes[i].count > 0 ? nodes[i].first < 0 || nodes[i].first+nodes[i].count > cached->nTriangles :
+       nodes[i].first <= i || nodes[i].first+1 >= cached->nNodes) return false;
+  }
+
+  TriangleMesh *mesh = new TriangleMesh();
+  mesh->vertices.assign(vertices,vertices+3*cached->nVertices);
+  mesh->indices.assign(indices,indices+3*cached->nTriangles);
+  mesh->triangleMaterials.assign(triangleMaterials,triangleMaterials+cached->nTriangles);
+  mesh->nodes.assign(nodes,nodes+cached->nNodes);
+  for(i=0;i<cached->nMaterials;i++) {
+    const double *values = materials + i*(SCENE_PROPERTY_VALUES+1);
+    Material *material = NULL;
+    if(values[0] != 0.0) {
+      LightingProperties properties;
+      for(k=0;k<3;k++) {
+	properties.ambient[k] = values[1+k];
+	properties.diffuse[k] = values[4+k];
+	properties.specular[k] = values[7+k];
+	properties.reflection[k] = values[11+k];
+      }
+      properties.shininess = values[10];
+      material = new SimpleMaterial(&properties);
+      material->reference();
+    }
+    mesh->materials.push_back(material);
+  }
+  mesh->dirty = false;
+  meshes.push_back(mesh);
+  return true;
+}
+
+/* Pads the file to a multiple of 8 bytes and returns the offset */
+static long long alignFile(FILE *fp) {
+  long long offset = ftell(fp);
+  while(offset % 8) { fputc(0,fp); offset++; }
+  return offset;
+}
+
+bool SceneFile::writeCache(const char *cacheName) {
+  int i, k;
+  FILE *fp = fopen(cacheName,"wb");
+  if(!fp) return false;
+
+  CacheHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,SCENE_CACHE_MAGIC,8);
+  header.version = SCENE_CACHE_VERSION;
+  header.byteOrder = SCENE_BYTE_ORDER;
+  header.nDependencies = nDependencies;
+  header.nCommands = nCommands;
+  header.nArgs = nArgs;
+  header.stringBytes = stringBytes;
+  header.nMeshes = meshes.size();
+  /* Written again when the offsets are known */
+  fwrite(&header,sizeof(header),1,fp);
+
+  header.dependencies = alignFile(fp);
+  fwrite(dependencies,sizeof(Dependency),nDependencies,fp);
+  header.commands = alignFile(fp);
+  fwrite(commands,sizeof(Command),nCommands,fp);
+  header.args = alignFile(fp);
+  fwrite(args,sizeof(double),nArgs,fp);
+  header.strings = alignFile(fp);
+  fwrite(strings,1,stringBytes,fp);
+
+  vector<CacheMesh> cacheMeshes(meshes.size());
+  for(i=0;i<(int)meshes.size();i++) {
+    TriangleMesh *mesh = meshes[i];
+    CacheMesh *cached = &cacheMeshes[i];
+    cached->nVertices = mesh->vertices.size()/3;
+    cached->nTriangles = mesh->indices.size()/3;
+    cached->nMaterials = mesh->materials.size();
+    cached->nNodes = mesh->nodes.size();
+    cached->vertices = alignFile(fp);
+    if(!mesh->vertices.empty()) fwrite(&mesh->vertices[0],sizeof(float),mesh->vertices.size(),fp);
+    cached->indices = alignFile(fp);
+    if(!mesh->indices.empty()) fwrite(&mesh->indices[0],sizeof(int),mesh->indices.size(),fp);
+    cached->triangleMaterials = alignFile(fp);
+    if(!mesh->triangleMaterials.empty()) fwrite(&mesh->triangleMaterials[0],sizeof(int),mesh->triangleMaterials.size(),fp);
+    cached->materials = alignFile(fp);
+    for(k=0;k<cached->nMaterials;k++) {
+      /* The materials of AC3D files are SimpleMaterials, whose
+	 properties are the same everywhere */
+      double values[SCENE_PROPERTY_VALUES+1], point[3]={0.0,0.0,0.0}, normal[3]={0.0,1.0,0.0};
+      LightingProperties properties;
+      memset(values,0,sizeof(values));
+      if(mesh->materials[k]) {
+	mesh->materials[k]->getLightingProperties(point,&properties,normal);
+	values[0] = 1.0;
+	memcpy(values+1,properties.ambient,3*sizeof(double));
+	memcpy(values+4,properties.diffuse,3*sizeof(double));
+	memcpy(values+7,properties.specular,3*sizeof(double));
+	values[10] = properties.shininess;
+	memcpy(values+11,properties.reflection,3*sizeof(double));
+      }
+      fwrite(values,sizeof(double),SCENE_PROPERTY_VALUES+1,fp);
+    }
+    cached->nodes = alignFile(fp);
+    if(!mesh->nodes.empty()) fwrite(&mesh->nodes[0],sizeof(TriangleMesh::Node),mesh->nodes.size(),fp);
+  }
+  header.meshes = alignFile(fp);
+  if(!cacheMeshes.empty()) fwrite(&cacheMeshes[0],sizeof(CacheMesh),cacheMeshes.size(),fp);
+  header.end = ftell(fp);
+  fseek(fp,0,SEEK_SET);
+  fwrite(&header,sizeof(header),1,fp);
+  bool ok = !ferror(fp);
+  if(fclose(fp) != 0) ok = false;
+  if(!ok) remove(cacheName);
+  return ok;
+}
+
+/*                         Building the scene                         */
+
+bool SceneFile::build(Raytracer *raytracer) {
+  int i, k;
+  vector<LightingProperties> properties;
+  vector<Material*> materials;
+  /* The groups being built, with the objects they contain so far. The
+     first holds the objects of the scene. */
+  typedef struct {
+    int command;
+    vector<Object*> objects;
+  } Group;
+  vector<Group> groups(1);
+  groups[0].command = -1;
+  /* The object that the modifiers apply to */
+  Object *last = NULL;
+  Transform *lastTransform = NULL;
+
+  for(i=0;i<nCommands;i++) {
+    const Command *command = &commands[i];
+    if(command->op < 0 || command->op > SCENE_NAME || command->firstArg < 0 || command->nArgs < 0 ||
+       command->firstArg+command->nArgs > nArgs || command->name >= stringBytes ||
+       (commandArgs[command->op] >= 0 && command->nArgs != commandArgs[command->op])) break;
+    const double *a = args + command->firstArg;
+    Object *object = NULL;
+    Transform *transform = NULL;
+    Light *light = NULL;
+    Material *material = NULL;
+
+    switch(command->op) {
+    case SCENE_CAMERA: {
+      Camera *camera = raytracer->getCamera();
+      if(!camera) {
+	camera = new Camera();
+	raytracer->setCamera(camera);
+      }
+      double origin[3] = { a[0], a[1], a[2] }, focus[3] = { a[3], a[4], a[5] }, up[3] = { a[6], a[7], a[8] };
+      camera->setUp(up);
+      camera->setOrigin(origin);
+      camera->setFocus(focus);
+      assign(origin,cameraOrigin);
+      assign(focus,cameraFocus);
+      hasCamera = true;
+      break;
+    }
+    case SCENE_AMBIENT:
+    case SCENE_BACKGROUND: {
+      double colour[3] = { a[0], a[1], a[2] };
+      if(command->op == SCENE_AMBIENT) raytracer->setAmbientLight(colour);
+      else raytracer->setBackground(colour);
+      break;
+    }
+    case SCENE_POINT_LIGHT: {
+      double position[3] = { a[0], a[1], a[2] }, colour[3] = { a[3], a[4], a[5] };
+      light = new Light(position,colour);
+      break;
+    }
+    case SCENE_SPHERE_LIGHT: {
+      double position[3] = { a[0], a[1], a[2] }, colour[3] = { a[4], a[5], a[6] };
+      light = new SphereLight(position,a[3],colour);
+      break;
+    }
+    case SCENE_RECTANGLE_LIGHT: {
+      double position[3] = { a[0], a[1], a[2] }, edge1[3] = { a[3], a[4], a[5] };
+      double edge2[3] = { a[6], a[7], a[8] }, colour[3] = { a[9], a[10], a[11] };
+      light = new RectangleLight(position,edge1,edge2,colour);
+      break;
+    }
+    case SCENE_PROPERTIES: {
+      LightingProperties p;
+      for(k=0;k<3;k++) {
+	p.ambient[k] = a[k];
+	p.diffuse[k] = a[3+k];
+	p.specular[k] = a[6+k];
+	p.reflection[k] = a[10+k];
+      }
+      p.shininess = a[9];
+      properties.push_back(p);
+      break;
+    }
+    case SCENE_SIMPLE_MATERIAL:
+    case SCENE_CHECKERBOARD_MATERIAL:
+    case SCENE_WOOD_MATERIAL:
+    case SCENE_MATERIAL_MAP: {
+      /* All the other arguments refer to properties */
+      int first = command->op == SCENE_SIMPLE_MATERIAL || command->op == SCENE_WOOD_MATERIAL ? 0 : 1;
+      int step = command->op == SCENE_MATERIAL_MAP ? 2 : 1;
+      if(command->op == SCENE_MATERIAL_MAP && (command->nArgs % 2 != 1 || command->nArgs > 1+2*MAX_MATERIAL_MAP_NODES)) break;
+      for(k=first+step-1;k<command->nArgs;k+=step)
+	if(a[k] < 0 || a[k] >= properties.size()) break;
+      if(k < command->nArgs) break;
+      if(command->op == SCENE_SIMPLE_MATERIAL) material = new SimpleMaterial(&properties[(int) a[0]]);
+      else if(command->op == SCENE_CHECKERBOARD_MATERIAL)
+	material = new CheckerboardMaterial(a[0],&properties[(int) a[1]],&properties[(int) a[2]]);
+      else if(command->op == SCENE_WOOD_MATERIAL)
+	material = new WoodMaterial(&properties[(int) a[0]],&properties[(int) a[1]]);
+      else {
+	MaterialMap *map = new MaterialMap(a[0] == MaterialMap::GradientNoise ? MaterialMap::GradientNoise : MaterialMap::Noise);
+	for(k=1;k<command->nArgs;k+=2) map->add(a[k],&properties[(int) a[k+1]]);
+	material = map;
+      }
+      break;
+    }
+    case SCENE_NOISE_MATERIAL:
+      material = new NoiseMaterial();
+      break;
+    case SCENE_SPHERE:
+      object = new Sphere(a[0]);
+      break;
+    case SCENE_PLANE: {
+      double normal[3] = { a[0], a[1], a[2] };
+      object = new Plane(normal,a[3]);
+      break;
+    }
+    case SCENE_CONE:
+      object = new Cone();
+      break;
+    case SCENE_MESH:
+      if(a[0] >= 0 && a[0] < meshes.size()) object = meshes[(int) a[0]];
+      break;
+    case SCENE_BEGIN_TRANSFORM:
+    case SCENE_BEGIN_INTERSECTION:
+    case SCENE_BEGIN_UNION:
+    case SCENE_BEGIN_DIFFERENCE:
+    case SCENE_BEGIN_INVERSE:
+      groups.push_back(Group());
+      groups.back().command = i;
+      last = NULL;
+      lastTransform = NULL;
+      continue;
+    case SCENE_END: {
+      if(groups.size() < 2) break;
+      Group *group = &groups.back();
+      int op = commands[group->command].op;
+      if(group->objects.empty() || (op == SCENE_BEGIN_INVERSE && group->objects.size() != 1)) break;
+      if(op == SCENE_BEGIN_TRANSFORM) {
+	Object *child = group->objects[0];
+	if(group->objects.size() > 1) {
+	  Union *all = new Union();
+	  for(k=0;k<(int)group->objects.size();k++) all->addObject(group->objects[k]);
+	  child = all;
+	}
+	transform = new Transform(child);
+	/* The transformations are the commands between the begin and
+	   the end of the group that are not inside other groups */
+	int depth = 0;
+	for(k=group->command+1;k<i;k++) {
+	  const Command *c = &commands[k];
+	  const double *ca = args + c->firstArg;
+	  if(c->op >= SCENE_BEGIN_TRANSFORM && c->op <= SCENE_BEGIN_INVERSE) depth++;
+	  else if(c->op == SCENE_END) depth--;
+	  else if(depth > 0) continue;
+	  else if(c->op == SCENE_TRANSLATE) transform->translate(ca[0],ca[1],ca[2]);
+	  else if(c->op == SCENE_SCALE) transform->scale(ca[0],ca[1],ca[2]);
+	  else if(c->op == SCENE_ROTATE_X) transform->rotateX(ca[0]);
+	  else if(c->op == SCENE_ROTATE_Y) transform->rotateY(ca[0]);
+	  else if(c->op == SCENE_ROTATE_Z) transform->rotateZ(ca[0]);
+	}
+	object = transform;
+      } else if(op == SCENE_BEGIN_INVERSE) object = new Inverse(group->objects[0]);
+      else {
+	CSG *csg;
+	if(op == SCENE_BEGIN_INTERSECTION) csg = new Intersection();
+	else if(op == SCENE_BEGIN_UNION) csg = new Union();
+	else csg = new Difference();
+	for(k=0;k<(int)group->objects.size();k++) csg->addObject(group->objects[k]);
+	object = csg;
+      }
+      groups.pop_back();
+      break;
+    }
+    case SCENE_TRANSLATE:
+    case SCENE_SCALE:
+    case SCENE_ROTATE_X:
+    case SCENE_ROTATE_Y:
+    case SCENE_ROTATE_Z:
+      /* Applied at the end of the transform */
+      if(groups.size() < 2 || commands[groups.back().command].op != SCENE_BEGIN_TRANSFORM) break;
+      continue;
+    case SCENE_SET_MATERIAL:
+      if(!last || a[0] < 0 || a[0] >= materials.size()) break;
+      last->setMaterial(materials[(int) a[0]]);
+      continue;
+    case SCENE_NAME:
+      if(!last || command->name < 0) break;
+      if(lastTransform) transforms[strings+command->name] = lastTransform;
+      continue;
+    }
+
+    if(light) {
+      light->setFalloff(a[command->nArgs-1]);
+      raytracer->addLight(light);
+    } else if(material) materials.push_back(material);
+    else if(object) {
+      groups.back().objects.push_back(object);
+      last = object;
+      lastTransform = transform;
+    } else if(command->op != SCENE_CAMERA && command->op != SCENE_AMBIENT &&
+	      command->op != SCENE_BACKGROUND && command->op != SCENE_PROPERTIES) break;
+  }
+  if(i < nCommands || groups.size() != 1) {
+    printf("Error - the scene '%s' is damaged, it could not be built\n",sourceName.c_str());
+    return false;
+  }
+  for(i=0;i<(int)groups[0].objects.size();i++) raytracer->addObject(groups[0].objects[i]);
+  return true;
+}
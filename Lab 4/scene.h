@@ -0,0 +1,238 @@
+/** \file scene.h
+    \brief Declares the SceneFile class, which builds scenes from text
+    files and keeps them in a binary cache.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	SCENE_H_
+# define   	SCENE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Raytracer;
+class Transform;
+class TriangleMesh;
+
+/** Increased whenever the layout of the cache files changes, so old
+    caches are parsed again instead of being misread */
+#define SCENE_CACHE_VERSION 1
+
+/** \brief Loads a scene described by a text file into a Raytracer.
+
+    A scene file is a list of statements separated by white space.
+    Everything after a # on a line is a comment, and names of files
+    containing spaces are given within double quotes. For example:
+
+    \verbatim
+    camera origin 0 0 4 focus 0 0 0
+    ambient 0.2 0.2 0.2
+    light sphere position 1 3 1 radius 0.3 colour 1 1 1
+
+    properties grey ambient 0.8 0.8 0.8 diffuse 0.8 0.8 0.8
+      specular 2 2 2 shininess 10 reflection 0.5 0.5 0.5
+    material shiny simple grey
+
+    plane 0 1 0 -0.5 material shiny
+    transform {
+      rotatey 0.6
+      translate 1.4 -0.5 -1.6
+      mesh "fighter.ac"
+    } name fighter
+    \endverbatim
+
+    The statements are:
+    - camera [origin x y z] [focus x y z] [up x y z]
+    - ambient r g b, background r g b
+    - light point|sphere|rectangle position x y z [radius r]
+      [edge1 x y z edge2 x y z] colour r g b [falloff d], where
+      spheres need the radius and rectangles the edges
+    - properties <name> followed by any of ambient, diffuse, specular
+      and reflection with three values each, and shininess with one.
+      Defines LightingProperties, which default to black.
+    - material <name> simple <properties>, checkerboard <size>
+      <properties> <properties>, noise, wood <dark> <light>, or
+      map noise|gradient { <value> <properties> ... }
+    - sphere <radius>, plane <nx> <ny> <nz> <offset>, cone, and mesh
+      <AC3D file>, which may be followed by material <name>
+    - transform, intersection, union, difference and inverse, followed
+      by the objects they contain within braces. Transforms also
+      contain translate x y z, scale x y z and rotatex|rotatey|rotatez
+      <radians>, applied in the order given. A transform of several
+      objects transforms their union.
+    - Any object may be followed by name <name>, which lets the
+      program find transforms by getTransform.
+
+    Relative names of AC3D files are relative to the directory of the
+    scene file.
+
+    The statements are compiled to a flat list of commands with their
+    numeric arguments, and the meshes are loaded and get their
+    hierarchies. All of this is saved to a cache file next to the
+    scene, with the extension .cache, which later loads memory map
+    instead of parsing anything. The cache is only used if it has the
+    current SCENE_CACHE_VERSION and the scene file and all AC3D files
+    still have the sizes and modification times they had when it was
+    written. */
+class SceneFile {
+ public:
+  SceneFile();
+  ~SceneFile();
+
+  /** Adds the lights and objects of the scene to the raytracer, and
+      sets up its camera, ambient light and background if the scene
+      gives them. Uses or writes the cache if useCache is true. Prints
+      the reason and returns false if the scene could not be loaded,
+      in which case some of the scene may have been added. */
+  bool load(const char *filename,Raytracer *raytracer,bool useCache);
+
+  /** True if the last load used the cache */
+  bool loadedFromCache();
+  /** Returns the transform given the name, or NULL */
+  Transform *getTransform(const char *name);
+  /** Assigns the origin and focus of the camera and returns true if
+      the scene gave them */
+  bool getCamera(double origin[3],double focus[3]);
+
+ private:
+  /** The commands that the statements compile to. Objects are given
+      in prefix order, where the groups (transforms and CSG) end with
+      SCENE_END. */
+  typedef enum {
+    SCENE_CAMERA, SCENE_AMBIENT, SCENE_BACKGROUND,
+    SCENE_POINT_LIGHT, SCENE_SPHERE_LIGHT, SCENE_RECTANGLE_LIGHT,
+    SCENE_PROPERTIES,
+    SCENE_SIMPLE_MATERIAL, SCENE_CHECKERBOARD_MATERIAL, SCENE_NOISE_MATERIAL,
+    SCENE_WOOD_MATERIAL, SCENE_MATERIAL_MAP,
+    SCENE_SPHERE, SCENE_PLANE, SCENE_CONE, SCENE_MESH,
+    SCENE_BEGIN_TRANSFORM, SCENE_BEGIN_INTERSECTION, SCENE_BEGIN_UNION,
+    SCENE_BEGIN_DIFFERENCE, SCENE_BEGIN_INVERSE, SCENE_END,
+    SCENE_TRANSLATE, SCENE_SCALE, SCENE_ROTATE_X, SCENE_ROTATE_Y, SCENE_ROTATE_Z,
+    SCENE_SET_MATERIAL, SCENE_NAME
+  } Op;
+
+  /** A command and its arguments args[firstArg .. firstArg+nArgs-1].
+      Properties, materials and meshes are referred to by the index
+      of their definition. name is an offset into the strings, or -1. */
+  typedef struct {
+    int op;
+    int firstArg, nArgs;
+    int name;
+  } Command;
+
+  /** A file the scene was built from */
+  typedef struct {
+    long long size, modified;
+    int name, pad;
+  } Dependency;
+
+  /** Layout of the cache file: the header is followed by the sections
+      at the given offsets, each aligned to 8 bytes. Everything is
+      stored in the byte order of the machine that wrote it, given by
+      byteOrder. */
+  typedef struct {
+    char magic[8];
+    int version, byteOrder;
+    int nDependencies, nCommands, nArgs, stringBytes, nMeshes, pad;
+    long long dependencies, commands, args, strings, meshes, end;
+  } CacheHeader;
+
+  /** A mesh in the cache, with the offsets of its arrays. materials
+      holds 14 doubles per material, a flag telling if the triangles
+      use the material of the mesh followed by the LightingProperties
+      of a SimpleMaterial. */
+  typedef struct {
+    int nVertices, nTriangles, nMaterials, nNodes;
+    long long vertices, indices, triangleMaterials, materials, nodes;
+  } CacheMesh;
+
+  /** A token of the text, with the line it starts on */
+  typedef struct {
+    std::string text;
+    bool quoted;
+    int line;
+  } Token;
+
+  void clear();
+
+  /* Parsing of the text, see scene.cc */
+  bool parse(const char *filename);
+  bool tokenize(const char *filename);
+  bool parseStatement();
+  bool parseObject();
+  bool parseModifiers(bool primitive);
+  bool parseLight();
+  bool parseProperties();
+  bool parseMaterial();
+  /** Appends a command, whose arguments are the last nArgs values
+      added to args */
+  void addCommand(int op,int nArgs,int name);
+  int addString(const char *text);
+  bool addDependency(const char *filename);
+  bool peek(const char *word);
+  bool expect(const char *word);
+  bool readNumber(double *value);
+  bool readNumbers(int n);
+  bool readWord(std::string *word);
+  bool readName(std::map<std::string,int> *names,const char *kind,double *index);
+  bool error(const char *message);
+
+  /* The cache */
+  bool readCache(const char *cacheName);
+  bool readCacheMesh(const CacheMesh *mesh);
+  bool writeCache(const char *cacheName);
+  bool dependenciesChanged();
+  void unmapCache();
+
+  /** Creates the lights, materials and objects of the commands */
+  bool build(Raytracer *raytracer);
+
+  /** The compiled scene. Either filled in by the parser, or pointing
+      into the mapped cache file. */
+  const Command *commands;
+  const double *args;
+  const char *strings;
+  const Dependency *dependencies;
+  int nCommands, nArgs, stringBytes, nDependencies;
+  /** Storage of the above while parsing */
+  std::vector<Command> commandList;
+  std::vector<double> argList;
+  std::vector<char> stringList;
+  std::vector<Dependency> dependencyList;
+  std::vector<TriangleMesh*> meshes;
+
+  /* State of the parser */
+  std::string directory;
+  std::vector<Token> tokens;
+  int position;
+  std::string sourceName;
+  std::map<std::string,int> propertyNames, materialNames;
+
+  /** The mapped cache file, NULL if none */
+  const char *mapped;
+  long long mappedSize;
+  /** Handles of the file and mapping on Windows */
+  void *fileHandle, *mappingHandle;
+
+  std::map<std::string,Transform*> transforms;
+  double cameraOrigin[3], cameraFocus[3];
+  bool hasCamera, fromCache;
+};
+
+#endif 	    /* !SCENE_H_ */
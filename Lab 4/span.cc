@@ -0,0 +1,144 @@
+/** \file span.cc
+    \brief Implements the SpanList class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "object.h"
+
+void SpanList::add(double enter,const HitRecord *enterHit,double exit,const HitRecord *exitHit) {
+  if(exit <= 0.0 || enter >= limit || exit <= enter) return;
+  if(enter <= 0.0) enter = -MAX_DISTANCE;
+  if(exit >= maxDistance) exit = MAX_DISTANCE;
+  if(count > 0 && enter <= spans[count-1].exit) {
+    Span *last = &spans[count-1];
+    if(exit > last->exit) {
+      last->exit = exit;
+      if(hasHits && exit != MAX_DISTANCE) last->exitHit = *exitHit;
+    }
+    return;
+  }
+  if(count == MAX_SPANS) {
+    /* No room left: keep what we have and give up on the rest of the
+       ray, starting between the last span and this one so that no
+       surface lies right at the limit */
+    limit = 0.5*(spans[count-1].exit+enter);
+    return;
+  }
+  Span *span = &spans[count++];
+  span->enter = enter;
+  span->exit = exit;
+  if(!hasHits) return;
+  if(enter != -MAX_DISTANCE) span->enterHit = *enterHit;
+  if(exit != MAX_DISTANCE) span->exitHit = *exitHit;
+}
+
+double SpanList::first(HitRecord *hit) const {
+  if(count == 0) return MAX_DISTANCE;
+  if(spans[0].enter != -MAX_DISTANCE) {
+    if(hit) *hit = spans[0].enterHit;
+    return spans[0].enter;
+  }
+  if(spans[0].exit != MAX_DISTANCE) {
+    if(hit) *hit = spans[0].exitHit;
+    return spans[0].exit;
+  }
+  return MAX_DISTANCE;
+}
+
+/* Copies the spans of from to to, to is assumed to be cleared */
+static void copySpans(const SpanList *from,SpanList *to) {
+  int i;
+  to->count = from->count;
+  to->maxDistance = from->maxDistance;
+  to->limit = from->limit;
+  to->hasHits = from->hasHits;
+  if(from->hasHits)
+    for(i=0;i<from->count;i++) to->spans[i] = from->spans[i];
+  else
+    for(i=0;i<from->count;i++) {
+      to->spans[i].enter = from->spans[i].enter;
+      to->spans[i].exit = from->spans[i].exit;
+    }
+}
+
+void SpanList::combine(const SpanList *a,const SpanList *b,bool unite,SpanList *out) {
+  int i=0, j=0, nA=2*a->count, nB=2*b->count;
+  bool inA=false, inB=false, inside=false;
+  double start=0.0;
+  const HitRecord *startHit=NULL;
+  SpanList result;
+
+  /* Walk through the boundaries of both lists in order, keeping track
+     of whether we are inside a and b. Every boundary where the result
+     changes becomes a boundary of the result. */
+  result.clear(MIN(a->maxDistance,b->maxDistance),a->hasHits && b->hasHits);
+  result.limit = MIN(a->limit,b->limit);
+  while(i < nA || j < nB) {
+    double t;
+    const HitRecord *hit;
+    const Span *span;
+    if(j >= nB || (i < nA && (i&1 ? a->spans[i/2].exit : a->spans[i/2].enter) <=
+		   (j&1 ? b->spans[j/2].exit : b->spans[j/2].enter))) {
+      span = &a->spans[i/2];
+      t = i&1 ? span->exit : span->enter;
+      hit = i&1 ? &span->exitHit : &span->enterHit;
+      inA = !inA;
+      i++;
+    } else {
+      span = &b->spans[j/2];
+      t = j&1 ? span->exit : span->enter;
+      hit = j&1 ? &span->exitHit : &span->enterHit;
+      inB = !inB;
+      j++;
+    }
+    /* Nothing is known from the limit on. This also stops at the
+       unbounded exits, which are closed after the loop. */
+    if(t >= result.limit) break;
+    bool nowInside = unite ? (inA || inB) : (inA && inB);
+    if(nowInside && !inside) { start = t; startHit = hit; }
+    else if(!nowInside && inside) result.add(start,startHit,t,hit);
+    inside = nowInside;
+  }
+  if(inside) result.add(start,startHit,MAX_DISTANCE,NULL);
+  copySpans(&result,out);
+}
+
+void SpanList::complement(const SpanList *a,SpanList *out) {
+  int i, k;
+  double start = -MAX_DISTANCE;
+  const HitRecord *startHit = NULL;
+  SpanList result;
+
+  result.clear(a->maxDistance,a->hasHits);
+  result.limit = a->limit;
+  for(i=0;i<a->count;i++) {
+    result.add(start,startHit,a->spans[i].enter,&a->spans[i].enterHit);
+    start = a->spans[i].exit;
+    startHit = &a->spans[i].exitHit;
+  }
+  result.add(start,startHit,MAX_DISTANCE,NULL);
+  /* Leaving a is entering the complement, and the other way around */
+  if(result.hasHits)
+    for(i=0;i<result.count;i++)
+      for(k=0;k<3;k++) {
+	result.spans[i].enterHit.normal[k] = -result.spans[i].enterHit.normal[k];
+	result.spans[i].exitHit.normal[k] = -result.spans[i].exitHit.normal[k];
+      }
+  copySpans(&result,out);
+}
@@ -0,0 +1,98 @@
+/** \file span.h
+    \brief Declares the SpanList class, the intervals along a ray that
+    lie inside an object, used for constructive solid geometry.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	SPAN_H_
+# define   	SPAN_H_
+
+#ifndef HIT_H_
+#include "hit.h"
+#endif
+
+/** Largest number of spans kept for one ray. When a ray crosses more
+    spans than this, the list stops short of the extra ones and records
+    up to which distance it is exact, see SpanList::limit. */
+#define MAX_SPANS 16
+
+/** \brief An interval [enter,exit] of distances along a ray that lies
+    inside an object.
+
+    A ray that starts inside the object has enter = -MAX_DISTANCE, and
+    one that is still inside at the end of the interval of interest has
+    exit = MAX_DISTANCE. The hit records are only valid for the other
+    boundaries, and only if they were asked for. */
+class Span {
+ public:
+  double enter, exit;
+  HitRecord enterHit, exitHit;
+};
+
+/** \brief Sorted, non-overlapping spans of a ray.
+
+    Only the part of the ray between 0 and maxDistance is of interest:
+    boundaries at or before 0 become -MAX_DISTANCE and boundaries at or
+    beyond maxDistance become MAX_DISTANCE. So every finite boundary is
+    a point where the ray crosses the surface of the object, and the
+    first one is the result of its line test.
+
+    A list holds at most MAX_SPANS spans. Adding one more lowers limit
+    to halfway between the last span and the new one, and everything
+    from limit on is unknown rather than outside: combine and
+    complement drop the boundaries there, and a span still open at
+    limit gets exit = MAX_DISTANCE. If first finds no boundary before
+    limit, the line test has to be repeated from limit on. */
+class SpanList {
+ public:
+  int count;
+  double maxDistance;
+  /** The spans are only known before this distance, which is
+      maxDistance unless spans had to be dropped */
+  double limit;
+  /** True if the hit records of the spans are filled in */
+  bool hasHits;
+  Span spans[MAX_SPANS];
+
+  /** Removes all spans and sets the interval of interest */
+  void clear(double maxDistance,bool hasHits) { count=0; this->maxDistance=limit=maxDistance; this->hasHits=hasHits; }
+  /** True if spans were dropped, so that the part of the ray from
+      limit on is unknown */
+  bool isTruncated() const { return limit < maxDistance; }
+  /** Adds the span enter..exit, which may not start before any span
+      already in the list. Spans touching the last span are merged
+      with it. The hit records are copied if the list has hits, and
+      may be NULL for unbounded ends. Spans starting at or beyond
+      limit are ignored. */
+  void add(double enter,const HitRecord *enterHit,double exit,const HitRecord *exitHit);
+
+  /** Gives the first boundary, and copies its hit record to hit if not
+      NULL. Returns MAX_DISTANCE if there is none, in which case the
+      ray must be followed further from limit if the list is
+      truncated. */
+  double first(HitRecord *hit) const;
+
+  /** Assigns to out the union (if unite is true) or the intersection
+      of a and b. out may be the same list as a or b. */
+  static void combine(const SpanList *a,const SpanList *b,bool unite,SpanList *out);
+  /** Assigns to out the parts of the ray outside of a, with the
+      normals turned around. out may be the same list as a. */
+  static void complement(const SpanList *a,SpanList *out);
+};
+
+#endif 	    /* !SPAN_H_ */
@@ -29,21 +29,42 @@ Sphere::Sphere(double radius) {
 }
 Sphere::~Sphere() {}
 
-double Sphere::lineTest(double O[3],double dir[3],double maxDistance) {
-  /* Solving this lineIntersection test is equal to solving the second
-     degree formula "a X^2 + b X + C = 0" for a, b, c given below. */
+double Sphere::lineTest(double O[3],double dir[3],double maxDistance,HitRecord *hit) {
   //printf("ray: (%3.2f %3.2f %3.2f) + alpha * (%3.2f %3.2f %3.2f)\n",O[0],O[1],O[2],dir[0],dir[1],dir[2]);
-  double a = dotProduct(dir,dir);
-  double b = 2 * dotProduct(O,dir);
-  double c = dotProduct(O,O) - radius*radius;
-  double s = b * b - 4*a*c;
-  if(s < 0) { return MAX_DISTANCE; }  
-  s = sqrt(s);
-  double sol1 = (-b - s)/(2*a);
-  if(sol1 > 0) return sol1;
-  double sol2 = (-b + s)/(2*a);
-  if(sol2 > 0)  return sol2;
-  return MAX_DISTANCE;
+  double result = intersect(radius,O,dir);
+  if(hit && result < maxDistance) fillHitRecord(hit,O,dir,result);
+  return result;
+}
+
+void Sphere::lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i;
+  /* Same computations as in lineTest, but done without branches so
+     that all rays can be handled by SIMD instructions in parallel. */
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    double Ox=packet->origin[0][i], Oy=packet->origin[1][i], Oz=packet->origin[2][i];
+    double Dx=packet->direction[0][i], Dy=packet->direction[1][i], Dz=packet->direction[2][i];
+    double a = Dx*Dx + Dy*Dy + Dz*Dz;
+    double b = 2 * (Ox*Dx + Oy*Dy + Oz*Dz);
+    double c = (Ox*Ox + Oy*Oy + Oz*Oz) - radius*radius;
+    double s = b * b - 4*a*c;
+    double root = sqrt(s < 0 ? 0.0 : s);
+    double sol1 = (-b - root)/(2*a);
+    double sol2 = (-b + root)/(2*a);
+    double result = sol1 > 0 ? sol1 : (sol2 > 0 ? sol2 : MAX_DISTANCE);
+    if(s < 0) result = MAX_DISTANCE;
+    distance[i] = packet->active[i] ? result : distance[i];
+  }
+  if(hit) fillHitRecords(packet,maxDistance,distance,hit);
+}
+
+bool Sphere::occluded(double O[3],double dir[3],double maxDistance) {
+  return occludes(radius,O,dir,maxDistance);
+}
+
+void Sphere::getSpans(double O[3],double dir[3],double maxDistance,SpanList *spans,bool fillHits) {
+  double enter, exit;
+  spans->clear(maxDistance,fillHits);
+  if(span(radius,O,dir,&enter,&exit)) addSpan(spans,enter,exit,O,dir,fillHits);
 }
 
 void Sphere::getNormal(double point[3],double normal[3]) {
@@ -51,5 +72,13 @@ void Sphere::getNormal(double point[3],double normal[3]) {
 }
 
 bool Sphere::isInside(double point[3]) {
-  return dotProduct(point,point) < radius*radius;
+  return inside(radius,point);
+}
+
+void Sphere::getBounds(double min[3],double max[3]) {
+  int i;
+  for(i=0;i<3;i++) {
+    min[i] = MAX(min[i],-radius);
+    max[i] = MIN(max[i],radius);
+  }
 }
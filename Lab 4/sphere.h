@@ -35,11 +35,62 @@ class Sphere : public Object {
   Sphere(double radius);
   ~Sphere();
 
-  double lineTest(double origin[3],double direction[3],double maxDistance);
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  void lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
   void getNormal(double point[3],double normal[3]);
   bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+
+  /** Line test of a sphere with the given radius, without filling in
+      any hit record. Also used by the SceneCompiler kernel. */
+  static double intersect(double radius,double O[3],double dir[3]) {
+    /* Solving this lineIntersection test is equal to solving the second
+       degree formula "a X^2 + b X + C = 0" for a, b, c given below. */
+    double a = dotProduct(dir,dir);
+    double b = 2 * dotProduct(O,dir);
+    double c = dotProduct(O,O) - radius*radius;
+    double s = b * b - 4*a*c;
+    if(s < 0) { return MAX_DISTANCE; }
+    s = sqrt(s);
+    double sol1 = (-b - s)/(2*a);
+    double sol2 = (-b + s)/(2*a);
+    return sol1 > 0 ? sol1 : (sol2 > 0 ? sol2 : MAX_DISTANCE);
+  }
+  /** Occlusion test of a sphere with the given radius */
+  static bool occludes(double radius,double O[3],double dir[3],double maxDistance) {
+    double a = dotProduct(dir,dir);
+    double b = 2 * dotProduct(O,dir);
+    double c = dotProduct(O,O) - radius*radius;
+    /* Starting outside and moving away from the sphere can never hit it */
+    if(c > 0 && b > 0) return false;
+    double s = b * b - 4*a*c;
+    if(s < 0) return false;
+    s = sqrt(s);
+    double sol1 = (-b - s)/(2*a);
+    if(sol1 > 0) return sol1 < maxDistance;
+    double sol2 = (-b + s)/(2*a);
+    return sol2 > 0 && sol2 < maxDistance;
+  }
+  /** Assigns to enter and exit the distances where the ray enters and
+      leaves a sphere with the given radius. Returns false if it
+      misses the sphere. */
+  static bool span(double radius,double O[3],double dir[3],double *enter,double *exit) {
+    double a = dotProduct(dir,dir);
+    double b = 2 * dotProduct(O,dir);
+    double c = dotProduct(O,O) - radius*radius;
+    double s = b * b - 4*a*c;
+    if(s < 0) return false;
+    s = sqrt(s);
+    *enter = (-b - s)/(2*a);
+    *exit = (-b + s)/(2*a);
+    return true;
+  }
+  static bool inside(double radius,double point[3]) { return dotProduct(point,point) < radius*radius; }
 
  private:
+  friend class SceneCompiler;
   double radius;
 };
 
@@ -0,0 +1,133 @@
+/** \file temporal.cc
+    \brief Implements the TemporalCache class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "temporal.h"
+
+using namespace std;
+
+/* The bounds of the moving objects are grown by this much, to cover
+   the rays being stored in single precision and rays starting very
+   close to the surface of a moving object. */
+#define BOUNDS_MARGIN 1e-3
+
+TemporalCache::TemporalCache() {
+  width=height=0;
+  validCount=0;
+  valid=NULL;
+  colours=NULL;
+  paths=NULL;
+}
+TemporalCache::~TemporalCache() {
+  set<Object*>::iterator objIterator;
+  for(objIterator=movingObjects.begin();objIterator != movingObjects.end();objIterator++)
+    (*objIterator)->dereference();
+  delete [] valid;
+  delete [] colours;
+  delete [] paths;
+}
+
+void TemporalCache::addMovingObject(Object *object) {
+  object->reference();
+  movingObjects.insert(object);
+}
+
+void TemporalCache::getMovingBounds(vector<double> *bounds) {
+  int i;
+  set<Object*>::iterator objIterator;
+  bounds->clear();
+  for(objIterator=movingObjects.begin();objIterator != movingObjects.end();objIterator++) {
+    double min[3], max[3];
+    for(i=0;i<3;i++) { min[i]=-MAX_DISTANCE; max[i]=MAX_DISTANCE; }
+    (*objIterator)->getBounds(min,max);
+    for(i=0;i<3;i++) bounds->push_back(min[i]-BOUNDS_MARGIN);
+    for(i=0;i<3;i++) bounds->push_back(max[i]+BOUNDS_MARGIN);
+  }
+}
+
+void TemporalCache::beginFrame(Camera *camera,int width,int height) {
+  int i, j, k;
+  /* Set if no pixel can be kept */
+  bool cameraMoved=false;
+
+  if(width != this->width || height != this->height) {
+    this->width=width;
+    this->height=height;
+    delete [] valid;
+    delete [] colours;
+    delete [] paths;
+    valid = new bool[width*height];
+    colours = new float[3*width*height];
+    paths = new RayPath[width*height];
+    cameraMoved=true;
+  }
+  for(i=0;i<3;i++) {
+    double origin[3], direction[3];
+    camera->getPixelRay(i == 1 ? 1.0 : 0.0,i == 2 ? 1.0 : 0.0,origin,direction);
+    for(j=0;j<3;j++) {
+      if(origin[j] != cameraRays[i][0][j] || direction[j] != cameraRays[i][1][j]) cameraMoved=true;
+      cameraRays[i][0][j] = origin[j];
+      cameraRays[i][1][j] = direction[j];
+    }
+  }
+
+  vector<double> newBounds;
+  getMovingBounds(&newBounds);
+  if(newBounds.size() != oldBounds.size()) cameraMoved=true;
+
+  /* A pixel may have been affected by where the moving objects were,
+     or by where they are now. Only rays passing through the box
+     enclosing all of these bounds need to be tested further. */
+  vector<double> bounds;
+  double all[6];
+  for(j=0;j<3;j++) { all[j]=MAX_DISTANCE; all[j+3]=-MAX_DISTANCE; }
+  for(k=0;k<(int)newBounds.size() && !cameraMoved;k++) {
+    j=k%6;
+    bounds.push_back(j < 3 ? MIN(oldBounds[k],newBounds[k]) : MAX(oldBounds[k],newBounds[k]));
+    all[j] = j < 3 ? MIN(all[j],bounds[k]) : MAX(all[j],bounds[k]);
+  }
+  oldBounds=newBounds;
+
+  validCount=0;
+  if(cameraMoved)
+    for(i=0;i<width*height;i++) valid[i]=false;
+  else
+#pragma omp parallel for default(shared) private(i,k) reduction(+:validCount) schedule(static)
+    for(i=0;i<width*height;i++) {
+      if(!valid[i]) continue;
+      if(paths[i].intersects(&all[0],&all[3]))
+	for(k=0;k<(int)bounds.size() && valid[i];k+=6)
+	  if(paths[i].intersects(&bounds[k],&bounds[k+3])) valid[i]=false;
+      if(valid[i]) validCount++;
+    }
+}
+
+bool TemporalCache::isValid(int x,int y) { return valid[y*width+x]; }
+void TemporalCache::getColour(int x,int y,double rgb[3]) {
+  float *colour = &colours[3*(y*width+x)];
+  rgb[0]=colour[0]; rgb[1]=colour[1]; rgb[2]=colour[2];
+}
+RayPath *TemporalCache::getPath(int x,int y) { return &paths[y*width+x]; }
+void TemporalCache::store(int x,int y,const double rgb[3]) {
+  float *colour = &colours[3*(y*width+x)];
+  colour[0]=(float)rgb[0]; colour[1]=(float)rgb[1]; colour[2]=(float)rgb[2];
+  valid[y*width+x]=true;
+}
+int TemporalCache::getValidCount() { return validCount; }
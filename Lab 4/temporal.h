@@ -0,0 +1,93 @@
+/** \file temporal.h
+    \brief Declares the TemporalCache class used to keep the pixels
+    that did not change since the previous frame.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	TEMPORAL_H_
+# define   	TEMPORAL_H_
+
+#ifndef RAYTRACER_H_
+#include "raytracer.h"
+#endif
+
+/** \brief Remembers the colour of every pixel, and all rays traced
+    for it, between frames.
+
+    Usually only a few objects of the scene move between two frames
+    while the rest of the scene and the camera stand still. A pixel
+    whose primary, shadow and reflected rays pass neither through the
+    old nor the new bounds of any of the moving objects gets exactly
+    the same colour as in the previous frame and is not traced again.
+
+    All materials have specular highlights and reflections that
+    depend on the direction from which they are seen, so a pixel can
+    not be reused at another place on the screen when the camera
+    moves. Every pixel is traced again after any change of the
+    camera.
+*/
+class TemporalCache {
+ public:
+  TemporalCache();
+  ~TemporalCache();
+
+  /** Adds an object that may be moved or changed between frames. All
+      other objects must stay the same. */
+  void addMovingObject(Object *object);
+
+  /** Decides which pixels can be kept from the previous frame. Must
+      be called after the objects and the camera have been updated for
+      the new frame. */
+  void beginFrame(Camera *camera,int width,int height);
+
+  /** Returns true if the pixel can be kept, in which case its colour
+      is given by getColour. */
+  bool isValid(int x,int y);
+  void getColour(int x,int y,double rgb[3]);
+  /** Gives the path in which the rays traced for the pixel should be
+      recorded when it is not valid. */
+  RayPath *getPath(int x,int y);
+  /** Stores the colour of a pixel once its rays have been traced into
+      its path. The pixel may be kept in the next frame. */
+  void store(int x,int y,const double rgb[3]);
+
+  /** Number of pixels kept from the previous frame in the last call
+      to beginFrame */
+  int getValidCount();
+
+ private:
+  /** Assigns the bounds of all moving objects to bounds */
+  void getMovingBounds(std::vector<double> *bounds);
+
+  int width, height;
+  int validCount;
+  /** Rays through the corners of the screen, used to notice when the
+      camera has changed */
+  double cameraRays[3][2][3];
+  std::set<Object*> movingObjects;
+  /** The min and max corners of the bounds of every moving object in
+      the previous frame */
+  std::vector<double> oldBounds;
+
+  bool *valid;
+  /** Three floats per pixel, not clamped */
+  float *colours;
+  RayPath *paths;
+};
+
+#endif 	    /* !TEMPORAL_H_ */
@@ -0,0 +1,173 @@
+/** \file tiles.cc
+    \brief Implements the TileScheduler class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "tiles.h"
+
+using namespace std;
+
+/* Base tiles costing more than this many times the average are split */
+#define HOT_TILE_FACTOR 4.0
+/* Each split level divides a tile into four, never split more than this */
+#define MAX_SPLIT_LEVELS 3
+/* Tiles are never split into parts smaller than this */
+#define MIN_TILE_SIZE 4
+
+/* Converts a distance d along the Hilbert curve covering an n*n grid,
+   where n is a power of two, into grid coordinates. */
+static void hilbertToXY(int n,int d,int *x,int *y) {
+  int s, rx, ry, t=d;
+  *x=*y=0;
+  for(s=1;s<n;s*=2) {
+    rx = 1 & (t/2);
+    ry = 1 & (t ^ rx);
+    if(ry == 0) {
+      if(rx == 1) { *x = s-1-*x; *y = s-1-*y; }
+      int tmp=*x; *x=*y; *y=tmp;
+    }
+    *x += s*rx;
+    *y += s*ry;
+    t /= 4;
+  }
+}
+
+/* Converts a Morton (Z-order) index into grid coordinates by taking
+   every other bit of d as the x and y coordinate. */
+static void mortonToXY(int d,int *x,int *y) {
+  int bit;
+  *x=*y=0;
+  for(bit=0;bit<15;bit++) {
+    *x |= ((d >> (2*bit)) & 1) << bit;
+    *y |= ((d >> (2*bit+1)) & 1) << bit;
+  }
+}
+
+TileScheduler::TileScheduler() {
+  tileSize=16;
+  order=Hilbert;
+  width=height=0;
+}
+
+void TileScheduler::setTileSize(int size) {
+  if(size < MIN_TILE_SIZE) size=MIN_TILE_SIZE;
+  if(size != tileSize) { tileSize=size; baseTiles.clear(); }
+}
+int TileScheduler::getTileSize() { return tileSize; }
+void TileScheduler::setOrder(Order order) {
+  if(order != this->order) { this->order=order; baseTiles.clear(); }
+}
+bool TileScheduler::setOrder(const char *name) {
+  if(strcmp(name,"scanline") == 0) setOrder(Scanline);
+  else if(strcmp(name,"morton") == 0) setOrder(Morton);
+  else if(strcmp(name,"hilbert") == 0) setOrder(Hilbert);
+  else return false;
+  return true;
+}
+
+void TileScheduler::createBaseTiles() {
+  int tilesX = (width+tileSize-1)/tileSize;
+  int tilesY = (height+tileSize-1)/tileSize;
+  int n, d, x, y;
+
+  /* The curves cover a square grid with a power of two side, tiles
+     outside of the screen are skipped. */
+  for(n=1;n<tilesX || n<tilesY;n*=2) ;
+  baseTiles.clear();
+  for(d=0;d<(order == Scanline ? tilesX*tilesY : n*n);d++) {
+    if(order == Scanline) { x=d%tilesX; y=d/tilesX; }
+    else if(order == Morton) mortonToXY(d,&x,&y);
+    else hilbertToXY(n,d,&x,&y);
+    if(x >= tilesX || y >= tilesY) continue;
+    Tile tile;
+    tile.x0 = x*tileSize;
+    tile.y0 = y*tileSize;
+    tile.x1 = MIN(width,tile.x0+tileSize);
+    tile.y1 = MIN(height,tile.y0+tileSize);
+    tile.base = (int) baseTiles.size();
+    tile.cost = 0.0;
+    baseTiles.push_back(tile);
+  }
+}
+
+/* Splits the tile into four quadrants, recursively, and adds them to
+   the list of tiles in Z-order. */
+void TileScheduler::split(Tile *tile,int levels) {
+  int w = tile->x1-tile->x0, h = tile->y1-tile->y0;
+  if(levels == 0 || w < 2*MIN_TILE_SIZE || h < 2*MIN_TILE_SIZE) {
+    tiles.push_back(*tile);
+    tiles.back().cost=0.0;
+    return;
+  }
+  int i, midX = tile->x0+w/2, midY = tile->y0+h/2;
+  for(i=0;i<4;i++) {
+    Tile part = *tile;
+    if(i&1) part.x0=midX; else part.x1=midX;
+    if(i&2) part.y0=midY; else part.y1=midY;
+    split(&part,levels-1);
+  }
+}
+
+void TileScheduler::beginFrame(int width,int height) {
+  int i;
+  if(width != this->width || height != this->height) {
+    this->width=width;
+    this->height=height;
+    baseTiles.clear();
+  }
+  if(baseTiles.empty()) createBaseTiles();
+
+  double totalCost=0.0;
+  for(i=0;i<(int)baseTiles.size();i++) totalCost += baseTiles[i].cost;
+  double averageCost = totalCost/baseTiles.size();
+
+  /* Split the hot tiles into enough parts that each of them costs
+     about as much as an average base tile */
+  tiles.clear();
+  for(i=0;i<(int)baseTiles.size();i++) {
+    int levels=0;
+    double cost=baseTiles[i].cost;
+    if(averageCost > 0.0 && cost > HOT_TILE_FACTOR*averageCost)
+      while(cost > averageCost && levels < MAX_SPLIT_LEVELS) { cost /= 4.0; levels++; }
+    split(&baseTiles[i],levels);
+  }
+}
+
+void TileScheduler::endFrame() {
+  int i;
+  for(i=0;i<(int)baseTiles.size();i++) baseTiles[i].cost=0.0;
+  for(i=0;i<(int)tiles.size();i++) baseTiles[tiles[i].base].cost += tiles[i].cost;
+}
+
+int TileScheduler::getTileCount() { return (int) tiles.size(); }
+Tile *TileScheduler::getTile(int i) { return &tiles[i]; }
+
+void TileScheduler::printStatistics() {
+  int i, hottest=0;
+  double totalCost=0.0;
+  if(baseTiles.empty()) return;
+  for(i=0;i<(int)baseTiles.size();i++) {
+    totalCost += baseTiles[i].cost;
+    if(baseTiles[i].cost > baseTiles[hottest].cost) hottest=i;
+  }
+  Tile *hot=&baseTiles[hottest];
+  printf("  %d tiles (%d base tiles of %dx%d), average %.3f ms, hottest %.3f ms at (%d,%d)-(%d,%d)\n",
+	 (int)tiles.size(),(int)baseTiles.size(),tileSize,tileSize,totalCost/baseTiles.size()*1e3,
+	 hot->cost*1e3,hot->x0,hot->y0,hot->x1,hot->y1);
+}
@@ -0,0 +1,95 @@
+/** \file tiles.h
+    \brief Declares the TileScheduler class used to split the screen
+    into tiles that are rendered by different threads.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	TILES_H_
+# define   	TILES_H_
+
+#include <vector>
+
+/** \brief A rectangular part of the screen, covering the pixels
+    x0 <= x < x1 and y0 <= y < y1. */
+class Tile {
+ public:
+  int x0, y0, x1, y1;
+  /** Index of the base tile that this tile was split from */
+  int base;
+  /** Seconds spent rendering this tile, set by the renderer */
+  double cost;
+};
+
+/** \brief Splits the screen into tiles and decides in which order
+    they are rendered.
+
+    The screen is divided into square base tiles of a configurable
+    size. These are handed out along a space filling curve (Morton or
+    Hilbert order) so that the tiles rendered at the same time, by the
+    same or by different threads, are close to each other on the
+    screen and see mostly the same objects.
+
+    The renderer stores the time spent on every tile in Tile::cost.
+    Base tiles that were much more expensive than the average in the
+    previous frame are split into smaller tiles for the next frame, so
+    that a few hot tiles at the end of the frame do not leave the other
+    threads idle.
+*/
+class TileScheduler {
+ public:
+  /** Order in which the base tiles are rendered */
+  enum Order { Scanline, Morton, Hilbert };
+
+  TileScheduler();
+
+  /** Sets the width and height of the base tiles in pixels */
+  void setTileSize(int size);
+  int getTileSize();
+  void setOrder(Order order);
+  /** Parses "scanline", "morton" or "hilbert", returns false for
+      unknown names. */
+  bool setOrder(const char *name);
+
+  /** Creates the tiles for the next frame of the given size, using
+      the costs of the previous frame to split hot tiles. */
+  void beginFrame(int width,int height);
+  /** Collects the costs of all tiles rendered since beginFrame. */
+  void endFrame();
+
+  int getTileCount();
+  Tile *getTile(int i);
+
+  /** Prints the number of tiles and the cost of the average and the
+      most expensive base tile of the last frame. */
+  void printStatistics();
+
+ private:
+  void createBaseTiles();
+  void split(Tile *tile,int levels);
+
+  int tileSize;
+  Order order;
+  int width, height;
+  /** Tiles of the screen before splitting, with the costs of the last
+      frame */
+  std::vector<Tile> baseTiles;
+  /** Tiles to render in the current frame */
+  std::vector<Tile> tiles;
+};
+
+#endif 	    /* !TILES_H_ */
@@ -26,147 +26,199 @@
 
 Transform::Transform(Object *child) :Object() { 
   child->reference();
-  identityMatrix(forward); 
-  identityMatrix(inverse);  
+  forward.setIdentity();
+  inverse.setIdentity();
+  inverseDirty=false;
+  isIdentity=true;
   this->child=child;
 }
 Transform::~Transform() {
   child->dereference();
 }
-double Transform::lineTest(double origin[3],double direction[3],double maxDistance) {
-  double newOrigin[4], newDirection[4];
-  /* Use inverse transformation matrix on origin with H=1 */
+double Transform::lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  /* Use inverse transformation matrix on origin with H=1 and on
+     direction with H=0 */
   /* Note, we are ignoring generated homogeneous coordinate after
      transformation so the multiplication is not done to save speed. */
-  newOrigin[0]=inverse[0][0]*origin[0]+inverse[0][1]*origin[1]+inverse[0][2]*origin[2]+inverse[0][3];
-  newOrigin[1]=inverse[1][0]*origin[0]+inverse[1][1]*origin[1]+inverse[1][2]*origin[2]+inverse[1][3];
-  newOrigin[2]=inverse[2][0]*origin[0]+inverse[2][1]*origin[1]+inverse[2][2]*origin[2]+inverse[2][3];
-
-  /* Use inverse transformation matrix on direction with H=0 */
-  newDirection[0]=inverse[0][0]*direction[0]+inverse[0][1]*direction[1]+inverse[0][2]*direction[2];
-  newDirection[1]=inverse[1][0]*direction[0]+inverse[1][1]*direction[1]+inverse[1][2]*direction[2];
-  newDirection[2]=inverse[2][0]*direction[0]+inverse[2][1]*direction[1]+inverse[2][2]*direction[2];
-  
+  const Mat4<double> &toChild = getInverse();
+  /* A material of the transform must still replace the one of the hit */
+  if(isIdentity && !material) return child->lineTest(origin,direction,maxDistance,hit);
+  Vec3<double> newOrigin = toChild.transformPoint(Vec3<double>(origin));
+  Vec3<double> newDirection = toChild.transformVector(Vec3<double>(direction));
+
   /* The correct way of doing it: */
   //double distanceScale = length(newDirection);
   //return child->lineTest(newOrigin,newDirection,maxDistance/distanceScale) / distanceScale;
 
   /* Slightly more efficient way of doing it */
-  return child->lineTest(newOrigin,newDirection,maxDistance);  
+  double distance = child->lineTest(newOrigin.v,newDirection.v,maxDistance,hit);
+  if(hit && distance < maxDistance) transformHit(hit,newOrigin.v,newDirection.v,distance);
+  return distance;
+}
+void Transform::transformHit(HitRecord *hit,double newOrigin[3],double newDirection[3],double distance) {
+  int i;
+  /* Bring the normal back using forward matrix and H=0 */
+  forward.transformVector(Vec3<double>(hit->normal)).store(hit->normal);
+  /* A material given to the transform overrides the materials of the
+     children, and is evaluated in the coordinate system of the child */
+  if(material) {
+    hit->material = material;
+    for(i=0;i<3;i++) hit->point[i] = newOrigin[i]+distance*newDirection[i];
+  }
+}
+void Transform::lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]) {
+  int i,j;
+  RayPacket newPacket;
+  const Mat4<double> &toChild = getInverse();
+  if(isIdentity && !material) { child->lineTestPacket(packet,maxDistance,distance,hit); return; }
+  /* Transform all origins (H=1) and directions (H=0) at once */
+  toChild.transform(RAY_PACKET_SIZE,packet->origin[0],packet->origin[1],packet->origin[2],1.0,
+		    newPacket.origin[0],newPacket.origin[1],newPacket.origin[2]);
+  toChild.transform(RAY_PACKET_SIZE,packet->direction[0],packet->direction[1],packet->direction[2],0.0,
+		    newPacket.direction[0],newPacket.direction[1],newPacket.direction[2]);
+  for(i=0;i<RAY_PACKET_SIZE;i++) newPacket.active[i]=packet->active[i];
+  child->lineTestPacket(&newPacket,maxDistance,distance,hit);
+  if(!hit) return;
+  for(i=0;i<RAY_PACKET_SIZE;i++) {
+    if(!newPacket.active[i] || distance[i] >= maxDistance[i]) continue;
+    double newOrigin[3], newDirection[3];
+    for(j=0;j<3;j++) {
+      newOrigin[j] = newPacket.origin[j][i];
+      newDirection[j] = newPacket.direction[j][i];
+    }
+    transformHit(&hit[i],newOrigin,newDirection,distance[i]);
+  }
+}
+bool Transform::occluded(double origin[3],double direction[3],double maxDistance) {
+  const Mat4<double> &toChild = getInverse();
+  if(isIdentity) return child->occluded(origin,direction,maxDistance);
+  Vec3<double> newOrigin = toChild.transformPoint(Vec3<double>(origin));
+  Vec3<double> newDirection = toChild.transformVector(Vec3<double>(direction));
+  /* Same distance scaling as in lineTest */
+  return child->occluded(newOrigin.v,newDirection.v,maxDistance);
+}
+void Transform::getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits) {
+  int i;
+  const Mat4<double> &toChild = getInverse();
+  if(isIdentity && !material) { child->getSpans(origin,direction,maxDistance,spans,fillHits); return; }
+  Vec3<double> newOrigin = toChild.transformPoint(Vec3<double>(origin));
+  Vec3<double> newDirection = toChild.transformVector(Vec3<double>(direction));
+  /* Distances are the same as in lineTest, only the hit records of
+     the boundaries need to be brought back */
+  child->getSpans(newOrigin.v,newDirection.v,maxDistance,spans,fillHits);
+  if(!fillHits) return;
+  for(i=0;i<spans->count;i++) {
+    Span *span = &spans->spans[i];
+    if(span->enter != -MAX_DISTANCE) transformHit(&span->enterHit,newOrigin.v,newDirection.v,span->enter);
+    if(span->exit != MAX_DISTANCE) transformHit(&span->exitHit,newOrigin.v,newDirection.v,span->exit);
+  }
 }
 void Transform::getNormal(double point[3],double normal[3]) {
-  double newPoint[3], newNormal[3];
   /* Compute target point using inverse matrix and H=1 */
-  newPoint[0]=inverse[0][0]*point[0]+inverse[0][1]*point[1]+inverse[0][2]*point[2]+inverse[0][3];
-  newPoint[1]=inverse[1][0]*point[0]+inverse[1][1]*point[1]+inverse[1][2]*point[2]+inverse[1][3];
-  newPoint[2]=inverse[2][0]*point[0]+inverse[2][1]*point[1]+inverse[2][2]*point[2]+inverse[2][3];
+  Vec3<double> newPoint = getInverse().transformPoint(Vec3<double>(point));
   /* Get child normal */
-  child->getNormal(newPoint,normal);
+  child->getNormal(newPoint.v,normal);
   /* Translate normal back using forward matrix and H=0 */
-  newNormal[0]=forward[0][0]*normal[0]+forward[0][1]*normal[1]+forward[0][2]*normal[2];
-  newNormal[1]=forward[1][0]*normal[0]+forward[1][1]*normal[1]+forward[1][2]*normal[2];
-  newNormal[2]=forward[2][0]*normal[0]+forward[2][1]*normal[1]+forward[2][2]*normal[2];
-  assign(newNormal,normal);
+  forward.transformVector(Vec3<double>(normal)).store(normal);
 }
 bool Transform::isInside(double point[3]) {
-  double newPoint[3];
   /* Compute target point using inverse matrix and H=1 */
-  newPoint[0]=inverse[0][0]*point[0]+inverse[0][1]*point[1]+inverse[0][2]*point[2]+inverse[0][3];
-  newPoint[1]=inverse[1][0]*point[0]+inverse[1][1]*point[1]+inverse[1][2]*point[2]+inverse[1][3];
-  newPoint[2]=inverse[2][0]*point[0]+inverse[2][1]*point[1]+inverse[2][2]*point[2]+inverse[2][3];
+  Vec3<double> newPoint = getInverse().transformPoint(Vec3<double>(point));
   /* Ask child if inside */
-  return child->isInside(newPoint);
+  return child->isInside(newPoint.v);
+}
+
+void Transform::transformBox(const Mat4<double> &M,double min[3],double max[3],double outMin[3],double outMax[3]) {
+  int i,j;
+  /* Transforming the box one axis at a time gives the same result as
+     transforming all eight corners. */
+  for(i=0;i<3;i++) {
+    outMin[i] = outMax[i] = M.m[i][3];
+    for(j=0;j<3;j++) {
+      double a = M.m[i][j]*min[j], b = M.m[i][j]*max[j];
+      outMin[i] += MIN(a,b);
+      outMax[i] += MAX(a,b);
+    }
+  }
+}
+void Transform::getBounds(double min[3],double max[3]) {
+  int i;
+  double childMin[3], childMax[3], newMin[3], newMax[3];
+  /* Bring the box into the coordinate system of the child, let it
+     shrink it and bring the result back again. */
+  transformBox(getInverse(),min,max,childMin,childMax);
+  child->getBounds(childMin,childMax);
+  for(i=0;i<3;i++)
+    if(childMin[i] > childMax[i]) {
+      /* Nothing of the child is inside the box, keep it empty */
+      max[i] = min[i] - 1.0;
+      return;
+    }
+  transformBox(forward,childMin,childMax,newMin,newMax);
+  for(i=0;i<3;i++) {
+    min[i] = MAX(min[i],newMin[i]);
+    max[i] = MIN(max[i],newMax[i]);
+  }
+}
+
+void Transform::prepare() {
+  if(inverseDirty) computeInverseTransform();
+  child->prepare();
 }
 
 void Transform::identity() {
-  identityMatrix(forward); 
-  identityMatrix(inverse);  
+  forward.setIdentity();
+  inverse.setIdentity();
+  inverseDirty=false;
+  isIdentity=true;
 }
 
+/* Translating and scaling only touch one column or the rows of the
+   forward matrix, so they are done directly instead of multiplying
+   by a whole matrix */
 void Transform::translate(double dx,double dy,double dz) {
-  Matrix4d M,M2;
-  identityMatrix(M);
-  M[0][3]=dx;
-  M[1][3]=dy;
-  M[2][3]=dz;
-  matrixMult(M,forward,M2);
-  assign(M2,forward); 
-  computeInverseTransform();
+  forward.m[0][3]+=dx;
+  forward.m[1][3]+=dy;
+  forward.m[2][3]+=dz;
+  inverseDirty=true;
 }
 
 void Transform::scale(double sx,double sy,double sz) {
-  Matrix4d M,M2;
-  identityMatrix(M);
-  M[0][0]=sx;
-  M[1][1]=sy;
-  M[2][2]=sz;
-  matrixMult(M,forward,M2);
-  assign(M2,forward);
-  computeInverseTransform();
+  int j;
+  for(j=0;j<4;j++) {
+    forward.m[0][j]*=sx;
+    forward.m[1][j]*=sy;
+    forward.m[2][j]*=sz;
+  }
+  inverseDirty=true;
 }
 void Transform::rotateX(double rad) {
-  rotateMatrixX(rad,forward);
-  computeInverseTransform();  
+  rotateMatrixX(rad,forward.m);
+  inverseDirty=true;
 }
 void Transform::rotateY(double rad) {
-  rotateMatrixY(rad,forward);
-  computeInverseTransform();  
+  rotateMatrixY(rad,forward.m);
+  inverseDirty=true;
 }
 void Transform::rotateZ(double rad) {
-  rotateMatrixZ(rad,forward);
-  computeInverseTransform();  
+  rotateMatrixZ(rad,forward.m);
+  inverseDirty=true;
 }
 
-//#define DEBUG_INVERSE
 void Transform::computeInverseTransform() {
-  /* Use gauss-jordan's algorithm to invert the forward matrix to create the inverse matrix */      
-  int i,j,k;
-  double M[4][8]; /* Will hold the composite [ forward | identity ]
-		     and be solved */
-
-  for(i=0;i<4;i++)
-    for(j=0;j<4;j++) {
-      M[i][j]=forward[i][j];
-      M[i][j+4] = (i==j?1.0:0.0);
-    }
-  /* TODO - add pivot operations to yield better nummerical stability */
-  /* Step 1: eliminate M[i][i] from M[i+1][..] and down */
-  for(i=0;i<3;i++) {
-    for(j=i+1;j<4;j++) {
-      for(k=i+1;k<8;k++)
-	M[j][k] -= M[j][i]/M[i][i] * M[i][k];      
-      M[j][i]=0.0;
-    }
-  }
-  /* Step 2: substitute upwards */
-  for(i=3;i>=0;i--) {
-    for(k=i+1;k<8;k++) 
-      M[i][k] /= M[i][i];
-    M[i][i] = 1.0;
-    for(j=0;j<i;j++) {
-      for(k=i+1;k<8;k++)
-	M[j][k] -= M[i][k] * M[j][i];
-      M[j][i] = 0.0;
-    }
-  }
-  /* The result is now in M[4..7][0..3] */
-  for(i=0;i<4;i++)
-    for(j=0;j<4;j++) {
-      inverse[i][j] = M[i][j+4];
-    }
+  /* All the transformations are affine, which has a closed form
+     inverse */
+  inverse = forward.affineInverse();
+  isIdentity = forward.isIdentity();
+  inverseDirty=false;
 }
 
 void Transform::getLightingProperties(double point[3],LightingProperties *props,double normal[3]) {
-  double newPoint[3];
   /* Use inverse transformation matrix on point with H=1 */
-  /* Note, we are ignoring generated homogeneous coordinate after
-     transformation so the multiplication is not done to save speed. */
-  newPoint[0]=inverse[0][0]*point[0]+inverse[0][1]*point[1]+inverse[0][2]*point[2]+inverse[0][3];
-  newPoint[1]=inverse[1][0]*point[0]+inverse[1][1]*point[1]+inverse[1][2]*point[2]+inverse[1][3];
-  newPoint[2]=inverse[2][0]*point[0]+inverse[2][1]*point[1]+inverse[2][2]*point[2]+inverse[2][3];
+  Vec3<double> newPoint = getInverse().transformPoint(Vec3<double>(point));
 
   if(material)
-    material->getLightingProperties(newPoint,props,normal);
+    material->getLightingProperties(newPoint.v,props,normal);
   else
-    child->getLightingProperties(newPoint,props,normal);
+    child->getLightingProperties(newPoint.v,props,normal);
 }
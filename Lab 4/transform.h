@@ -31,15 +31,25 @@
 /** \brief Represents generic affine transformations. 
     
     Can contain a single child object and performs a transformation
-    on it's position and shape. */
+    on it's position and shape.
+
+    The functions changing the transformation only update the forward
+    matrix. The inverse matrix is computed when first needed, at the
+    latest by prepare, so a transform changed several times between
+    two frames is only inverted once. */
 class Transform : public Object {
  public:
   Transform(Object *child);
   ~Transform();
 
-  double lineTest(double origin[3],double direction[3],double maxDistance);
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  void lineTestPacket(RayPacket *packet,double maxDistance[],double distance[],HitRecord hit[]);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  void getSpans(double origin[3],double direction[3],double maxDistance,SpanList *spans,bool fillHits);
   void getNormal(double point[3],double normal[3]);
   bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+  void prepare();
   
   /** Resets the transform to the identity matrix */
   void identity();
@@ -61,10 +71,29 @@ class Transform : public Object {
 
   virtual void getLightingProperties(double point[3],LightingProperties *props,double normal[3]);
  private:
+  /** Gives the inverse matrix, computing it first if the forward
+      matrix has changed. Only safe to call from several threads at
+      once after prepare. */
+  const Mat4<double> &getInverse() { if(inverseDirty) computeInverseTransform(); return inverse; }
   void computeInverseTransform();
-
-  Matrix4d forward;
-  Matrix4d inverse;
+  /** Brings a hit record filled in by the child, for a hit at the
+      given distance along the transformed ray, back to the coordinate
+      system of this object. */
+  void transformHit(HitRecord *hit,double newOrigin[3],double newDirection[3],double distance);
+  /** Assigns to the box outMin/outMax the bounds of the box min/max
+      after transformation by M */
+  static void transformBox(const Mat4<double> &M,double min[3],double max[3],double outMin[3],double outMax[3]);
+
+  friend class SceneCompiler;
+
+  Mat4<double> forward;
+  Mat4<double> inverse;
+  /** True when inverse is out of date */
+  bool inverseDirty;
+  /** True when the transformation is the identity, so that rays can
+      be passed to the child unchanged unless the transform has a
+      material for its hits. Valid when inverse is. */
+  bool isIdentity;
   Object *child;
 };
 
@@ -0,0 +1,364 @@
+/** \file trianglemesh.cc
+    \brief Implements the TriangleMesh class.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include "general.h"
+#include "trianglemesh.h"
+#include "ac3d.h"
+
+using namespace std;
+
+/* The nodes are split by splitBuildItems like those of the BVH of the
+   scene, so the tree is as deep and needs the same stack, see bvh.cc */
+#define MESH_STACK_SIZE 128
+/* Hits closer than this are ignored */
+#define MESH_EPSILON 1e-5
+
+TriangleMesh::TriangleMesh() :Object() { dirty=false; }
+TriangleMesh::~TriangleMesh() {
+  int i;
+  for(i=0;i<(int)materials.size();i++)
+    if(materials[i]) materials[i]->dereference();
+}
+
+int TriangleMesh::getVertexCount() { return vertices.size()/3; }
+int TriangleMesh::getTriangleCount() { return indices.size()/3; }
+int TriangleMesh::getNodeCount() { return nodes.size(); }
+
+int TriangleMesh::addVertex(double point[3]) {
+  int i;
+  for(i=0;i<3;i++) vertices.push_back((float) point[i]);
+  return vertices.size()/3-1;
+}
+void TriangleMesh::addTriangle(int a,int b,int c,Material *material) {
+  int i;
+  /* Meshes use few materials, usually for many triangles in a row */
+  for(i=materials.size()-1;i>=0;i--)
+    if(materials[i] == material) break;
+  if(i < 0) {
+    if(material) material->reference();
+    materials.push_back(material);
+    i = materials.size()-1;
+  }
+  indices.push_back(a);
+  indices.push_back(b);
+  indices.push_back(c);
+  triangleMaterials.push_back(i);
+  dirty = true;
+}
+void TriangleMesh::getTriangle(int i,double a[3],double b[3],double c[3]) {
+  int k;
+  for(k=0;k<3;k++) {
+    a[k] = vertices[3*indices[3*i]+k];
+    b[k] = vertices[3*indices[3*i+1]+k];
+    c[k] = vertices[3*indices[3*i+2]+k];
+  }
+}
+
+TriangleMesh *TriangleMesh::loadAC3D(const char *filename) {
+  AC3DObjectFactory factory;
+  AC3DObject *root = factory.loadAC3D(filename);
+  if(!root) return NULL;
+  TriangleMesh *mesh = new TriangleMesh();
+  Mat4<double> identity;
+  identity.setIdentity();
+  mesh->addAC3D(root,&factory,identity);
+  delete root;
+  return mesh;
+}
+void TriangleMesh::addAC3D(AC3DObject *object,AC3DObjectFactory *factory,const Mat4<double> &toMesh) {
+  /* The materials of the file are created when first used */
+  vector<Material*> fileMaterials(factory->getMaterialCount(),(Material*)NULL);
+  addAC3DObject(object,factory,&fileMaterials,toMesh);
+  int i;
+  for(i=0;i<(int)fileMaterials.size();i++)
+    if(fileMaterials[i]) fileMaterials[i]->dereference();
+}
+void TriangleMesh::addAC3DObject(AC3DObject *object,AC3DObjectFactory *factory,vector<Material*> *fileMaterials,
+				 const Mat4<double> &toParent) {
+  int i, j;
+  Mat4<double> toMesh = toParent * object->mat;
+
+  int firstVertex = getVertexCount();
+  for(i=0;i<object->nVertices;i++) {
+    double point[3];
+    for(j=0;j<3;j++) point[j] = object->vertices[3*i+j];
+    toMesh.transformPoint(Vec3<double>(point)).store(point);
+    addVertex(point);
+  }
+  for(i=0;i<object->nSurfaces;i++) {
+    AC3DSurface *surface = &object->surfaces[i];
+    if((surface->flags & AC3D_SURFACE_TYPE) != AC3D_SURFACE_POLYGON) continue;
+    Material *material = NULL;
+    if(surface->material >= 0 && surface->material < (int)fileMaterials->size()) {
+      material = (*fileMaterials)[surface->material];
+      if(!material) {
+	/* AC3D has no reflections, and the transparency is not used */
+	AC3DMaterial *ac3d = factory->getMaterial(surface->material);
+	LightingProperties properties;
+	for(j=0;j<3;j++) {
+	  properties.ambient[j] = ac3d->amb[j]*ac3d->rgb[j];
+	  properties.diffuse[j] = ac3d->rgb[j];
+	  properties.specular[j] = ac3d->spec[j];
+	  properties.reflection[j] = 0.0;
+	}
+	properties.shininess = ac3d->shi;
+	material = new SimpleMaterial(&properties);
+	material->reference();
+	(*fileMaterials)[surface->material] = material;
+      }
+    }
+    for(j=2;j<surface->nVertices;j++)
+      addTriangle(firstVertex+surface->vert[0].index,firstVertex+surface->vert[j-1].index,
+		  firstVertex+surface->vert[j].index,material);
+  }
+  for(i=0;i<object->nChildren;i++)
+    addAC3DObject(object->children[i],factory,fileMaterials,toMesh);
+}
+
+void TriangleMesh::prepare() {
+  if(dirty) build();
+}
+void TriangleMesh::build() {
+  int i, j, k;
+  int nTriangles = getTriangleCount();
+  vector<BuildItem> items;
+
+  dirty = false;
+  nodes.clear();
+  for(i=0;i<nTriangles;i++) {
+    BuildItem item;
+    double corners[3][3];
+    item.index = i;
+    getTriangle(i,corners[0],corners[1],corners[2]);
+    for(k=0;k<3;k++) {
+      item.min[k] = MIN(corners[0][k],MIN(corners[1][k],corners[2][k]));
+      item.max[k] = MAX(corners[0][k],MAX(corners[1][k],corners[2][k]));
+      item.centroid[k] = 0.5*(item.min[k]+item.max[k]);
+    }
+    items.push_back(item);
+  }
+  if(items.empty()) return;
+  nodes.reserve(2*nTriangles);
+  nodes.resize(1);
+  buildNode(0,&items[0],0,nTriangles,0);
+
+  /* Store the triangles in the order of the leaves */
+  vector<int> sortedIndices(indices.size());
+  vector<int> sortedMaterials(nTriangles);
+  for(i=0;i<nTriangles;i++) {
+    for(j=0;j<3;j++) sortedIndices[3*i+j] = indices[3*items[i].index+j];
+    sortedMaterials[i] = triangleMaterials[items[i].index];
+  }
+  indices.swap(sortedIndices);
+  triangleMaterials.swap(sortedMaterials);
+}
+
+void TriangleMesh::buildNode(int nodeIndex,BuildItem *items,int first,int count,int depth) {
+  int i;
+  double nodeMin[3], nodeMax[3];
+  Node node;
+  int middle = splitBuildItems(items,first,count,depth,nodeMin,nodeMax);
+
+  /* Round the bounds outwards, so that no triangle sticks out of the
+     float box of its node */
+  for(i=0;i<3;i++) {
+    double pad = 1e-6*(1.0+fabs(nodeMin[i])+fabs(nodeMax[i]));
+    node.min[i] = (float) (nodeMin[i]-pad);
+    node.max[i] = (float) (nodeMax[i]+pad);
+  }
+
+  if(middle == first || middle == first+count) {
+    node.first = first;
+    node.count = count;
+    nodes[nodeIndex] = node;
+    return;
+  }
+
+  /* nodes may be reallocated by the recursion */
+  int left = nodes.size();
+  node.first = left;
+  node.count = 0;
+  nodes[nodeIndex] = node;
+  nodes.resize(left+2);
+  buildNode(left,items,first,middle-first,depth+1);
+  buildNode(left+1,items,middle,first+count-middle,depth+1);
+}
+
+/* Slab test of a node, see BVH::boxTest */
+static inline bool boxTest(const float min[3],const float max[3],const double origin[3],const double invDirection[3],
+			   double maxDistance,double *entry) {
+  int i;
+  double tEnter=0.0, tExit=maxDistance;
+  for(i=0;i<3;i++) {
+    double t1 = (min[i]-origin[i])*invDirection[i];
+    double t2 = (max[i]-origin[i])*invDirection[i];
+    if(t1 > t2) { double tmp=t1; t1=t2; t2=tmp; }
+    if(t1 > tEnter) tEnter=t1;
+    if(t2 < tExit) tExit=t2;
+  }
+  *entry = tEnter;
+  return tEnter <= tExit;
+}
+
+double TriangleMesh::intersect(int i,const double origin[3],const double direction[3]) {
+  const float *a = &vertices[3*indices[3*i]];
+  const float *b = &vertices[3*indices[3*i+1]];
+  const float *c = &vertices[3*indices[3*i+2]];
+  Vec3<double> A(a[0],a[1],a[2]);
+  Vec3<double> E1 = Vec3<double>(b[0],b[1],b[2]) - A;
+  Vec3<double> E2 = Vec3<double>(c[0],c[1],c[2]) - A;
+  Vec3<double> D(direction);
+  Vec3<double> P = D.cross(E2);
+  double det = E1.dot(P);
+  /* The ray is parallel to the triangle, or the triangle has no area */
+  if(det == 0.0) return MAX_DISTANCE;
+  double invDet = 1.0/det;
+  Vec3<double> S = Vec3<double>(origin) - A;
+  double u = S.dot(P)*invDet;
+  if(u < 0.0 || u > 1.0) return MAX_DISTANCE;
+  Vec3<double> Q = S.cross(E1);
+  double v = D.dot(Q)*invDet;
+  if(v < 0.0 || u+v > 1.0) return MAX_DISTANCE;
+  double t = E2.dot(Q)*invDet;
+  return t > MESH_EPSILON ? t : MAX_DISTANCE;
+}
+
+int TriangleMesh::closestTriangle(double origin[3],double direction[3],double maxDistance,bool any,double *distance) {
+  int i, closest=-1;
+  double closestDistance=maxDistance, invDirection[3], entry;
+  int stack[MESH_STACK_SIZE];
+  double stackEntry[MESH_STACK_SIZE];
+  int stackSize=0;
+
+  if(nodes.empty()) return -1;
+  for(i=0;i<3;i++)
+    invDirection[i] = 1.0 / (direction[i] != 0.0 ? direction[i] : 1e-30);
+  if(boxTest(nodes[0].min,nodes[0].max,origin,invDirection,closestDistance,&entry)) {
+    stack[0] = 0; stackEntry[0] = entry; stackSize = 1;
+  }
+  while(stackSize) {
+    stackSize--;
+    if(stackEntry[stackSize] > closestDistance) continue;
+    const Node *node = &nodes[stack[stackSize]];
+    if(node->count) {
+      for(i=node->first;i<node->first+node->count;i++) {
+	double t = intersect(i,origin,direction);
+	if(t < closestDistance) {
+	  closestDistance = t;
+	  closest = i;
+	  if(any) { *distance = t; return i; }
+	}
+      }
+      continue;
+    }
+    /* Visit the closest child first, see BVH::lineTest */
+    double entryLeft, entryRight;
+    const Node *left = &nodes[node->first], *right = &nodes[node->first+1];
+    bool hitLeft = boxTest(left->min,left->max,origin,invDirection,closestDistance,&entryLeft);
+    bool hitRight = boxTest(right->min,right->max,origin,invDirection,closestDistance,&entryRight);
+    if(hitLeft && hitRight) {
+      int nearChild = entryLeft <= entryRight ? node->first : node->first+1;
+      stack[stackSize] = 2*node->first+1-nearChild;
+      stackEntry[stackSize++] = MAX(entryLeft,entryRight);
+      stack[stackSize] = nearChild;
+      stackEntry[stackSize++] = MIN(entryLeft,entryRight);
+    } else if(hitLeft) {
+      stack[stackSize] = node->first; stackEntry[stackSize++] = entryLeft;
+    } else if(hitRight) {
+      stack[stackSize] = node->first+1; stackEntry[stackSize++] = entryRight;
+    }
+  }
+  *distance = closestDistance;
+  return closest;
+}
+
+void TriangleMesh::triangleNormal(int i,double normal[3]) {
+  double a[3], b[3], c[3];
+  getTriangle(i,a,b,c);
+  (Vec3<double>(b)-Vec3<double>(a)).cross(Vec3<double>(c)-Vec3<double>(a)).store(normal);
+}
+
+double TriangleMesh::lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit) {
+  int i;
+  double distance;
+  int triangle = closestTriangle(origin,direction,maxDistance,false,&distance);
+  if(triangle < 0) return MAX_DISTANCE;
+  if(hit) {
+    hit->distance = distance;
+    hit->object = this;
+    Material *material = materials[triangleMaterials[triangle]];
+    hit->material = material ? material : this;
+    for(i=0;i<3;i++) hit->point[i] = origin[i]+distance*direction[i];
+    triangleNormal(triangle,hit->normal);
+    if(dotProduct(hit->normal,direction) > 0.0)
+      for(i=0;i<3;i++) hit->normal[i] = -hit->normal[i];
+  }
+  return distance;
+}
+bool TriangleMesh::occluded(double origin[3],double direction[3],double maxDistance) {
+  double distance;
+  return closestTriangle(origin,direction,maxDistance,true,&distance) >= 0;
+}
+
+void TriangleMesh::getNormal(double point[3],double normal[3]) {
+  int i, best=-1;
+  double bestDistance = MAX_DISTANCE;
+  /* The point does not tell which triangle it lies on, so take the
+     one whose plane is closest */
+  for(i=0;i<getTriangleCount();i++) {
+    double n[3];
+    triangleNormal(i,n);
+    double area = length(n);
+    if(area == 0.0) continue;
+    const float *a = &vertices[3*indices[3*i]];
+    Vec3<double> d = Vec3<double>(point) - Vec3<double>(a[0],a[1],a[2]);
+    double planeDistance = fabs(d.dot(Vec3<double>(n)))/area;
+    if(planeDistance < bestDistance) { bestDistance = planeDistance; best = i; }
+  }
+  if(best >= 0) triangleNormal(best,normal);
+  else { normal[0]=normal[2]=0.0; normal[1]=1.0; }
+}
+
+bool TriangleMesh::isInside(double point[3]) {
+  /* Count the crossings along a ray in a direction that is unlikely
+     to graze any edges */
+  int i, crossings = 0;
+  double origin[3], direction[3] = { 0.5773, 0.5774, 0.5775 };
+  double distance;
+  assign(point,origin);
+  while(closestTriangle(origin,direction,MAX_DISTANCE,false,&distance) >= 0) {
+    crossings++;
+    for(i=0;i<3;i++) origin[i] += distance*direction[i];
+  }
+  return crossings & 1;
+}
+
+void TriangleMesh::getBounds(double min[3],double max[3]) {
+  int i;
+  if(nodes.empty()) {
+    /* Nothing can be hit, give an empty box */
+    for(i=0;i<3;i++) { min[i] = MAX_DISTANCE; max[i] = -MAX_DISTANCE; }
+    return;
+  }
+  for(i=0;i<3;i++) {
+    min[i] = MAX(min[i],(double) nodes[0].min[i]);
+    max[i] = MIN(max[i],(double) nodes[0].max[i]);
+  }
+}
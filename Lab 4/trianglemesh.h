@@ -0,0 +1,137 @@
+/** \file trianglemesh.h
+    \brief Declares the TriangleMesh class, a primitive made of
+    triangles that can be loaded from AC3D files.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	TRIANGLEMESH_H_
+# define   	TRIANGLEMESH_H_
+
+#ifndef OBJECT_H_
+#include "object.h"
+#endif
+#ifndef BVH_H_
+#include "bvh.h"
+#endif
+
+#include <vector>
+
+class AC3DObject;
+class AC3DObjectFactory;
+
+/** \brief A surface made of triangles, eg. a model loaded from an
+    AC3D file.
+
+    The vertices are stored once as floats and the triangles as three
+    indices each, together with the index of their material. Ray
+    tests use a bounding volume hierarchy over the triangles of the
+    mesh, built by the surface area heuristic like the BVH of the
+    scene, and test the triangles of the leaves with the
+    Moller-Trumbore algorithm. The triangles are reordered to follow
+    the leaves of the hierarchy.
+
+    Triangles are treated as two sided: the normal of a hit always
+    faces the ray. Intersections closer than 1e-5 are ignored, as
+    done by the BVH of the scene, so rays leaving the surface of the
+    mesh do not hit the triangle they start on. isInside counts the
+    triangles crossed by a ray, which only makes sense for closed
+    meshes.
+
+    The hierarchy is built by prepare after triangles have been
+    added, so the mesh must be added to the scene before its first
+    frame or prepared by hand. */
+class TriangleMesh : public Object {
+ public:
+  TriangleMesh();
+  ~TriangleMesh();
+
+  double lineTest(double origin[3],double direction[3],double maxDistance,HitRecord *hit);
+  bool occluded(double origin[3],double direction[3],double maxDistance);
+  /** Gives the normal of the triangle whose plane is closest to the
+      point, following its winding. Slow, hits fill in their normal
+      directly. */
+  void getNormal(double point[3],double normal[3]);
+  bool isInside(double point[3]);
+  void getBounds(double min[3],double max[3]);
+  void prepare();
+
+  /** Adds a vertex and returns its index */
+  int addVertex(double point[3]);
+  /** Adds the triangle between the vertices with the given indices,
+      whose corners are counter clockwise when seen from the front.
+      The triangle is shaded by material, which is referenced, or by
+      the material of the mesh (see setMaterial) if NULL. */
+  void addTriangle(int a,int b,int c,Material *material);
+
+  /** Adds the surfaces of an AC3D object and its children, with their
+      vertices brought into the coordinate system of the mesh by the
+      given matrix and the matrices of the objects. Polygons are
+      triangulated as fans and shaded by a SimpleMaterial for each of
+      the materials of the factory that parsed the object. Lines are
+      skipped. */
+  void addAC3D(AC3DObject *object,AC3DObjectFactory *factory,const Mat4<double> &toMesh);
+  /** Creates a mesh from all objects of an AC3D file, or returns NULL
+      if the file could not be loaded */
+  static TriangleMesh *loadAC3D(const char *filename);
+
+  int getVertexCount();
+  int getTriangleCount();
+  /** Number of nodes in the hierarchy, valid after prepare */
+  int getNodeCount();
+  /** Assigns the corners of triangle i to a, b and c */
+  void getTriangle(int i,double a[3],double b[3],double c[3]);
+
+ private:
+  friend class SceneFile;
+
+  /** A node is a leaf if count > 0, in which case it holds the
+      triangles first .. first+count-1. Otherwise the children are
+      found at first and first+1. Floats keep the nodes at 32 bytes. */
+  typedef struct {
+    float min[3], max[3];
+    int first, count;
+  } Node;
+
+  void addAC3DObject(AC3DObject *object,AC3DObjectFactory *factory,std::vector<Material*> *fileMaterials,
+		     const Mat4<double> &toParent);
+  void build();
+  void buildNode(int nodeIndex,BuildItem *items,int first,int count,int depth);
+  /** Moller-Trumbore test of triangle i, returns MAX_DISTANCE on a
+      miss or for hits closer than 1e-5 */
+  double intersect(int i,const double origin[3],const double direction[3]);
+  /** Finds the closest triangle hit closer than maxDistance, and
+      returns its index or -1. Assigns the distance to *distance. If
+      any is true stops at the first triangle hit instead. */
+  int closestTriangle(double origin[3],double direction[3],double maxDistance,bool any,double *distance);
+  /** Unnormalized normal of triangle i, following its winding */
+  void triangleNormal(int i,double normal[3]);
+
+  /** Three floats per vertex */
+  std::vector<float> vertices;
+  /** Three vertex indices per triangle */
+  std::vector<int> indices;
+  /** Index into materials for every triangle */
+  std::vector<int> triangleMaterials;
+  /** The materials of the triangles, NULL for the material of the mesh */
+  std::vector<Material*> materials;
+  std::vector<Node> nodes;
+  /** True if triangles have been added since the hierarchy was built */
+  bool dirty;
+};
+
+#endif 	    /* !TRIANGLEMESH_H_ */
@@ -0,0 +1,245 @@
+/** \file vecmath.h
+    \brief Declares the Vec3 and Mat4 templates, small vector and
+    matrix classes that are completely inlined by the compiler.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef   	VECMATH_H_
+# define   	VECMATH_H_
+
+#include <math.h>
+
+/* Use the widest SIMD instructions the compiler has been allowed to
+   use, see CFLAGS in the Makefile. MSVC defines __AVX__ with /arch:AVX
+   and always has SSE2 on x64. */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VECMATH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VECMATH_SSE2
+#endif
+
+/** \brief A 3D vector.
+
+    Has the same memory layout as an array T[3], so the free functions
+    of vector.h operating on arrays can use it directly and v can be
+    passed to functions expecting an array. Three components are too
+    few to gain anything from SIMD instructions, the point of this
+    class is that everything is inlined. */
+template<class T> class Vec3 {
+ public:
+  T v[3];
+
+  Vec3() {}
+  Vec3(T x,T y,T z) { v[0]=x; v[1]=y; v[2]=z; }
+  /** Copies the array a */
+  explicit Vec3(const T a[3]) { v[0]=a[0]; v[1]=a[1]; v[2]=a[2]; }
+  /** Copies the vector to the array a */
+  void store(T a[3]) const { a[0]=v[0]; a[1]=v[1]; a[2]=v[2]; }
+
+  T &operator[](int i) { return v[i]; }
+  T operator[](int i) const { return v[i]; }
+
+  Vec3 operator+(const Vec3 &o) const { return Vec3(v[0]+o.v[0],v[1]+o.v[1],v[2]+o.v[2]); }
+  Vec3 operator-(const Vec3 &o) const { return Vec3(v[0]-o.v[0],v[1]-o.v[1],v[2]-o.v[2]); }
+  Vec3 operator-() const { return Vec3(-v[0],-v[1],-v[2]); }
+  Vec3 operator*(T s) const { return Vec3(v[0]*s,v[1]*s,v[2]*s); }
+  Vec3 operator/(T s) const { return Vec3(v[0]/s,v[1]/s,v[2]/s); }
+  /** Componentwise product */
+  Vec3 mul(const Vec3 &o) const { return Vec3(v[0]*o.v[0],v[1]*o.v[1],v[2]*o.v[2]); }
+
+  T dot(const Vec3 &o) const { return v[0]*o.v[0] + v[1]*o.v[1] + v[2]*o.v[2]; }
+  Vec3 cross(const Vec3 &o) const {
+    return Vec3(v[1]*o.v[2] - v[2]*o.v[1],
+		v[2]*o.v[0] - v[0]*o.v[2],
+		v[0]*o.v[1] - v[1]*o.v[0]);
+  }
+  T length() const { return sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]); }
+  /** Gives the vector scaled to unit length */
+  Vec3 normalized() const { return *this/length(); }
+};
+
+/** \brief A 4x4 matrix for affine transformations of 3D vectors.
+
+    Stored row by row, with the same memory layout as Matrix4d. The
+    operations that work on four values at a time (multiplying two
+    matrices and transforming many points at once) use AVX or SSE2
+    instructions for double precision matrices when available. */
+template<class T> class Mat4 {
+ public:
+  T m[4][4];
+
+  void setIdentity() {
+    int i,j;
+    for(i=0;i<4;i++)
+      for(j=0;j<4;j++)
+	m[i][j] = i==j ? (T)1 : (T)0;
+  }
+
+  /** Transforms the point p, ie. with H=1 */
+  Vec3<T> transformPoint(const Vec3<T> &p) const {
+    return Vec3<T>(m[0][0]*p.v[0]+m[0][1]*p.v[1]+m[0][2]*p.v[2]+m[0][3],
+		   m[1][0]*p.v[0]+m[1][1]*p.v[1]+m[1][2]*p.v[2]+m[1][3],
+		   m[2][0]*p.v[0]+m[2][1]*p.v[1]+m[2][2]*p.v[2]+m[2][3]);
+  }
+  /** Transforms the direction d, ie. with H=0 */
+  Vec3<T> transformVector(const Vec3<T> &d) const {
+    return Vec3<T>(m[0][0]*d.v[0]+m[0][1]*d.v[1]+m[0][2]*d.v[2],
+		   m[1][0]*d.v[0]+m[1][1]*d.v[1]+m[1][2]*d.v[2],
+		   m[2][0]*d.v[0]+m[2][1]*d.v[1]+m[2][2]*d.v[2]);
+  }
+  /** Assigns to c the 4D vector M * a */
+  void transform(const T a[4],T c[4]) const {
+    int i;
+    for(i=0;i<4;i++) c[i] = m[i][0]*a[0] + m[i][1]*a[1] + m[i][2]*a[2] + m[i][3]*a[3];
+  }
+  /** Transforms the n vectors (x[i],y[i],z[i],h), given as separate
+      arrays, into outX, outY and outZ. Use h=1 for points and h=0 for
+      directions. The output may not overlap the input. */
+  void transform(int n,const T x[],const T y[],const T z[],T h,T outX[],T outY[],T outZ[]) const {
+    int i;
+    for(i=0;i<n;i++) transformOne(i,x,y,z,h,outX,outY,outZ);
+  }
+
+  /** True if the matrix is exactly the identity */
+  bool isIdentity() const {
+    int i,j;
+    for(i=0;i<4;i++)
+      for(j=0;j<4;j++)
+	if(m[i][j] != (i==j ? (T)1 : (T)0)) return false;
+    return true;
+  }
+  /** Gives the inverse of an affine matrix, ie. one whose last row is
+      0 0 0 1. The upper 3x3 part is inverted with the adjugate and the
+      translation t becomes -inv(A)*t. */
+  Mat4 affineInverse() const {
+    Mat4 r;
+    int i;
+    T c[3][3];
+    c[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    c[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+    c[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+    c[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    c[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+    c[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+    c[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    c[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+    c[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+    T invDet = (T)1 / (m[0][0]*c[0][0] + m[0][1]*c[1][0] + m[0][2]*c[2][0]);
+    for(i=0;i<3;i++) {
+      r.m[i][0] = c[i][0]*invDet;
+      r.m[i][1] = c[i][1]*invDet;
+      r.m[i][2] = c[i][2]*invDet;
+      r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+      r.m[3][i] = (T)0;
+    }
+    r.m[3][3] = (T)1;
+    return r;
+  }
+
+  /** Assigns C = A * B, C may not be the same matrix as A or B */
+  static void multiply(const T A[4][4],const T B[4][4],T C[4][4]) {
+    int i,j,k;
+    for(i=0;i<4;i++)
+      for(j=0;j<4;j++) {
+	C[i][j] = A[i][0] * B[0][j];
+	for(k=1;k<4;k++) C[i][j] += A[i][k] * B[k][j];
+      }
+  }
+  Mat4 operator*(const Mat4 &o) const { Mat4 r; multiply(m,o.m,r.m); return r; }
+
+ private:
+  void transformOne(int i,const T x[],const T y[],const T z[],T h,T outX[],T outY[],T outZ[]) const {
+    outX[i] = m[0][0]*x[i]+m[0][1]*y[i]+m[0][2]*z[i]+m[0][3]*h;
+    outY[i] = m[1][0]*x[i]+m[1][1]*y[i]+m[1][2]*z[i]+m[1][3]*h;
+    outZ[i] = m[2][0]*x[i]+m[2][1]*y[i]+m[2][2]*z[i]+m[2][3]*h;
+  }
+};
+
+#if defined(VECMATH_AVX)
+
+/* Every row of C is a sum of the rows of B, scaled by the elements of
+   the same row of A. One row is one AVX register. */
+template<> inline void Mat4<double>::multiply(const double A[4][4],const double B[4][4],double C[4][4]) {
+  int i,k;
+  __m256d rows[4];
+  for(k=0;k<4;k++) rows[k] = _mm256_loadu_pd(B[k]);
+  for(i=0;i<4;i++) {
+    __m256d sum = _mm256_mul_pd(_mm256_set1_pd(A[i][0]),rows[0]);
+    for(k=1;k<4;k++) sum = _mm256_add_pd(sum,_mm256_mul_pd(_mm256_set1_pd(A[i][k]),rows[k]));
+    _mm256_storeu_pd(C[i],sum);
+  }
+}
+/* Four vectors at a time, each element of the matrix is broadcast to
+   a whole register */
+template<> inline void Mat4<double>::transform(int n,const double x[],const double y[],const double z[],double h,
+					       double outX[],double outY[],double outZ[]) const {
+  int i,j;
+  double *out[3] = { outX, outY, outZ };
+  for(i=0;i+4<=n;i+=4) {
+    __m256d vx = _mm256_loadu_pd(x+i), vy = _mm256_loadu_pd(y+i), vz = _mm256_loadu_pd(z+i);
+    for(j=0;j<3;j++) {
+      __m256d sum = _mm256_mul_pd(_mm256_set1_pd(m[j][0]),vx);
+      sum = _mm256_add_pd(sum,_mm256_mul_pd(_mm256_set1_pd(m[j][1]),vy));
+      sum = _mm256_add_pd(sum,_mm256_mul_pd(_mm256_set1_pd(m[j][2]),vz));
+      sum = _mm256_add_pd(sum,_mm256_set1_pd(m[j][3]*h));
+      _mm256_storeu_pd(out[j]+i,sum);
+    }
+  }
+  for(;i<n;i++) transformOne(i,x,y,z,h,outX,outY,outZ);
+}
+
+#elif defined(VECMATH_SSE2)
+
+/* Same as the AVX version, but with every row split into two halves */
+template<> inline void Mat4<double>::multiply(const double A[4][4],const double B[4][4],double C[4][4]) {
+  int i,k;
+  __m128d lo[4], hi[4];
+  for(k=0;k<4;k++) { lo[k] = _mm_loadu_pd(B[k]); hi[k] = _mm_loadu_pd(B[k]+2); }
+  for(i=0;i<4;i++) {
+    __m128d a = _mm_set1_pd(A[i][0]);
+    __m128d sumLo = _mm_mul_pd(a,lo[0]), sumHi = _mm_mul_pd(a,hi[0]);
+    for(k=1;k<4;k++) {
+      a = _mm_set1_pd(A[i][k]);
+      sumLo = _mm_add_pd(sumLo,_mm_mul_pd(a,lo[k]));
+      sumHi = _mm_add_pd(sumHi,_mm_mul_pd(a,hi[k]));
+    }
+    _mm_storeu_pd(C[i],sumLo);
+    _mm_storeu_pd(C[i]+2,sumHi);
+  }
+}
+template<> inline void Mat4<double>::transform(int n,const double x[],const double y[],const double z[],double h,
+					       double outX[],double outY[],double outZ[]) const {
+  int i,j;
+  double *out[3] = { outX, outY, outZ };
+  for(i=0;i+2<=n;i+=2) {
+    __m128d vx = _mm_loadu_pd(x+i), vy = _mm_loadu_pd(y+i), vz = _mm_loadu_pd(z+i);
+    for(j=0;j<3;j++) {
+      __m128d sum = _mm_mul_pd(_mm_set1_pd(m[j][0]),vx);
+      sum = _mm_add_pd(sum,_mm_mul_pd(_mm_set1_pd(m[j][1]),vy));
+      sum = _mm_add_pd(sum,_mm_mul_pd(_mm_set1_pd(m[j][2]),vz));
+      sum = _mm_add_pd(sum,_mm_set1_pd(m[j][3]*h));
+      _mm_storeu_pd(out[j]+i,sum);
+    }
+  }
+  for(;i<n;i++) transformOne(i,x,y,z,h,outX,outY,outZ);
+}
+
+#endif
+
+#endif 	    /* !VECMATH_H_ */
@@ -20,7 +20,12 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#ifndef   	VECTOR_H_
+# define   	VECTOR_H_
 
+#ifndef VECMATH_H_
+#include "vecmath.h"
+#endif
 
 /* Basic info about the datastructures
 
@@ -32,6 +37,10 @@
 
    We have two different forms of matrixes, Matrix3d and Matrix4d which operate on 3D/4D vectors
    respectively.
+
+   The functions below are thin wrappers around the Vec3 and Mat4
+   templates of vecmath.h, defined here so that they are inlined
+   wherever they are used. New code may use the templates directly.
 */
   
 typedef double Matrix4d[4][4];
@@ -41,15 +50,24 @@ typedef double Matrix3d[3][3];
 /* Basic vector operations */
 /*                         */
 
-void assign(const float A[3],float C[3]);                           /* Copy content of vector A to vector C */
-void assign(const double A[3],double C[3]);                         /* Copy content of vector A to vector C */
-void crossProduct(const double A[3],const double B[3],double C[3]); /* Assign crossproduct of A and B to vector C */   
-double dotProduct(const double A[3],const double B[3]);           /* Return the dotproduct of two vectors */
-void add(const double A[3],const double B[3],double C[3]);          /* Assign C the value of A + B */
-void sub(const double A[3],const double B[3],double C[3]);                /* Assign C the value of A - B */
-void normalize(double[3]);                                          /* Destructivly normalize vector, ie. force to unit length */
-double length(double[3]);                                           /* Give length of vector */
-void zero(double[3]);                                               /* Assign vector the value zero */
+/* Copy content of vector A to vector C */
+inline void assign(const float A[3],float C[3]) { Vec3<float>(A).store(C); }
+/* Copy content of vector A to vector C */
+inline void assign(const double A[3],double C[3]) { Vec3<double>(A).store(C); }
+/* Assign crossproduct of A and B to vector C */
+inline void crossProduct(const double A[3],const double B[3],double C[3]) { Vec3<double>(A).cross(Vec3<double>(B)).store(C); }
+/* Return the dotproduct of two vectors */
+inline double dotProduct(const double A[3],const double B[3]) { return Vec3<double>(A).dot(Vec3<double>(B)); }
+/* Assign C the value of A + B */
+inline void add(const double A[3],const double B[3],double C[3]) { (Vec3<double>(A)+Vec3<double>(B)).store(C); }
+/* Assign C the value of A - B */
+inline void sub(const double A[3],const double B[3],double C[3]) { (Vec3<double>(A)-Vec3<double>(B)).store(C); }
+/* Destructivly normalize vector, ie. force to unit length */
+inline void normalize(double C[3]) { Vec3<double>(C).normalized().store(C); }
+/* Give length of vector */
+inline double length(double A[3]) { return Vec3<double>(A).length(); }
+/* Assign vector the value zero */
+inline void zero(double v[3]) { v[0]=v[1]=v[2]=0.0; }
 
 /*                         */
 /* Basic matrix operations */
@@ -58,21 +76,32 @@ void zero(double[3]);                                               /* Assign ve
 /** Print out a matrix in a human readable form */
 void debugMatrix(Matrix4d);                                         
 /** Homogeneis A and assign to C */
-void homogenise(double A[4],double C[3]);                           
+inline void homogenise(double A[4],double C[3]) { C[0] = A[0] / A[3]; C[1] = A[1] / A[3]; C[2] = A[2] / A[3]; }
 /** Assign to C the value M * A */
-void useMatrix(Matrix4d M,const double A[4],double C[4]);           
+inline void useMatrix(Matrix4d M,const double A[4],double C[4]) { ((Mat4<double>*)M)->transform(A,C); }
 /** Assign to C the value M * A */
-void useMatrix(Matrix3d,const double A[3],double C[3]);             
+inline void useMatrix(Matrix3d M,const double A[3],double C[3]) {
+  for(int i=0;i<3;i++) C[i] = M[i][0]*A[0] + M[i][1]*A[1] + M[i][2]*A[2];
+}
 /** Assign to C the value M * <x,y,z> */
-void useMatrix(Matrix4d A,const double x,const double y,const double z,double C[3]);    
+inline void useMatrix(Matrix4d M,const double x,const double y,const double z,double C[3]) {
+  ((Mat4<double>*)M)->transformPoint(Vec3<double>(x,y,z)).store(C);
+}
 /** Assign to C the value M * <x,y,z> */
-void useMatrix(Matrix4d A,const double x,const double y,const double z,float C[3]);   
-void identityMatrix(Matrix4d);                                      /* Reset a matrix to the identity matrix */
-void assign(const Matrix4d A,Matrix4d C);                           /* Copy matrix A to matrix C */
-void matrixMult(Matrix4d A,Matrix4d B,Matrix4d C);                  /* Assign C the value A * B */
+inline void useMatrix(Matrix4d M,const double x,const double y,const double z,float C[3]) {
+  Vec3<double> p = ((Mat4<double>*)M)->transformPoint(Vec3<double>(x,y,z));
+  C[0]=(float)p[0]; C[1]=(float)p[1]; C[2]=(float)p[2];
+}
+/* Reset a matrix to the identity matrix */
+inline void identityMatrix(Matrix4d M) { ((Mat4<double>*)M)->setIdentity(); }
+/* Copy matrix A to matrix C */
+inline void assign(const Matrix4d A,Matrix4d C) { *(Mat4<double>*)C = *(const Mat4<double>*)A; }
+/* Assign C the value A * B */
+inline void matrixMult(Matrix4d A,Matrix4d B,Matrix4d C) { Mat4<double>::multiply(A,B,C); }
 
 void rotateMatrixX(double,Matrix4d);                                      /* Rotate matrix around the X-axis AFTER the original transformation */
 void rotateMatrixY(double,Matrix4d);                                      /* Rotate matrix around the Y-axis AFTER the original transformation */
 void rotateMatrixZ(double,Matrix4d);                                      /* Rotate matrix around the Z-axis AFTER the original transformation */
 void translateXYZ(double x,double y,double z,Matrix4d);             /* Add a translation to the given matrix. AFTER the original transformation */
 
+#endif 	    /* !VECTOR_H_ */
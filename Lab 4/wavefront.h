@@ -0,0 +1,121 @@
+/** \file wavefront.h
+    \brief Declares the queues of rays used by the wavefront engine of
+    the Raytracer, and the stack of rays used by the recursive engine.
+*/
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef   	WAVEFRONT_H_
+# define   	WAVEFRONT_H_
+
+#ifndef HIT_H_
+#include "hit.h"
+#endif
+
+#include <vector>
+
+/** \brief A primary or reflected ray waiting to be intersected with
+    the scene. */
+class QueuedRay {
+ public:
+  double origin[3], direction[3];
+  /** How much of the colour seen along the ray ends up in the sample,
+      ie. the product of the reflection colours along the way */
+  double weight[3];
+  /** Same as the contribution argument of Raytracer::raytrace */
+  double contribution;
+  /** Number of bounces before this ray, 0 for primary rays */
+  int depth;
+  /** Index of the PixelSample the ray belongs to */
+  int sample;
+};
+
+/** Capacity of a RayStack */
+#define RAY_STACK_SIZE 32
+
+/** \brief The secondary rays of one primary ray that are still to be
+    traced by the recursive engine.
+
+    Shading a hit pushes the rays it spawns, with their weights, and
+    the engine pops and traces rays until the stack is empty. So the
+    rays are followed depth first as if raytrace called itself, but
+    without keeping the state of every level alive on the call stack.
+    Reflections push one ray per hit, rays that split, such as
+    refraction, simply push several. The capacity is fixed, rays
+    pushed onto a full stack are dropped. */
+class RayStack {
+ public:
+  RayStack() { size=0; }
+  bool isEmpty() { return size == 0; }
+  /** Returns false, dropping the ray, if the stack is full */
+  bool push(const QueuedRay &ray) {
+    if(size == RAY_STACK_SIZE) return false;
+    rays[size++] = ray;
+    return true;
+  }
+  /** Removes the last ray pushed and copies it to ray */
+  void pop(QueuedRay *ray) { *ray = rays[--size]; }
+ private:
+  QueuedRay rays[RAY_STACK_SIZE];
+  int size;
+};
+
+/** \brief A shadow test of a light, waiting for the occlusion
+    stage. This is a single feeler for point lights, and several for
+    area lights (see Raytracer::lightVisibility). */
+class QueuedShadowRay {
+ public:
+  double origin[3];
+  class Light *light;
+  /** The object the feelers start from, see BVH::occluded */
+  Object *ignore;
+  /** Colour added to the sample if the light is not occluded, scaled
+      by the visible fraction of area lights */
+  double rgb[3];
+  int sample;
+};
+
+/** \brief The queues of the wavefront engine of one thread.
+
+    Instead of following every ray to the end before starting the
+    next, as Raytracer::raytrace does, the wavefront engine runs each
+    stage over all rays of a generation at once. All rays of the
+    generation are intersected (as packets), all hits are shaded in the
+    order of their materials, and all shadow feelers are tested before
+    the reflected rays become the next generation. Every stage then
+    runs the same code over arrays of similar work, and the colours
+    are added to the samples as each stage finds them.
+
+    The queues keep their memory between calls, so after the first
+    tile nothing is allocated while rendering. */
+class RayQueues {
+ public:
+  /** Rays of the current generation */
+  std::vector<QueuedRay> rays;
+  /** Reflected rays, the next generation */
+  std::vector<QueuedRay> nextRays;
+  std::vector<QueuedShadowRay> shadowRays;
+
+  /* Results of intersecting rays[i], MAX_DISTANCE and NULL for misses */
+  std::vector<double> distances;
+  std::vector<Object*> hitObjects;
+  std::vector<HitRecord> hits;
+  /** Indices of the rays that hit something, sorted by material */
+  std::vector<int> shadeOrder;
+};
+
+#endif 	    /* !WAVEFRONT_H_ */